@@ -0,0 +1,127 @@
+//
+//  audiobenchmark.c
+//  UNTITLED3Dgame
+//
+//  Headless mixer benchmark. Scatters looping and one-shot sounds over the
+//  map's sectors, wanders them and the listener around every tick, and mixes
+//  the result into a WAV file through the same command ring the game uses.
+//  Reports the mixer's cost per second of audio and how much faster than
+//  real time that is.
+//
+//      audiobenchmark [map] [voices] [seconds] [out.wav]
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/audio.h"
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/player.h"
+
+#define TickMs 16
+
+static unsigned seed = 4242;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+// Somewhere inside a sector: a random blend of its corners.
+static XYZ randompoint(unsigned s)
+{
+    const Sector * sect = &sectors[s];
+    XYZ point = {0, 0, sect->floor};
+    float total = 0;
+    for (unsigned p = 0; p < sect->npoints; p++)
+    {
+        float weight = (float)(nextrandom() % 100 + 1);
+        point.x += sect->vertex[p].x * weight;
+        point.y += sect->vertex[p].y * weight;
+        total += weight;
+    }
+    point.x /= total;
+    point.y /= total;
+    return point;
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * mapname = argc > 1 ? argv[1] : MapName;
+    unsigned numvoices = argc > 2 ? (unsigned)atoi(argv[2]) : 128;
+    unsigned seconds = argc > 3 ? (unsigned)atoi(argv[3]) : 10;
+    const char * wavpath = argc > 4 ? argv[4] : "audiobenchmark.wav";
+    numvoices = numvoices && numvoices <= MaxVoices ? numvoices : 128;
+    seconds = seconds ? seconds : 10;
+
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    LoadData(mapname);
+    if (!startaudio(wavpath))
+    {
+        return 1;
+    }
+
+    // Loops keep playing throughout; the rest are gunshots fired again and again.
+    unsigned handles[MaxVoices];
+    unsigned where[MaxVoices];
+    for (unsigned v = 0; v < numvoices; v++)
+    {
+        where[v] = nextrandom() % NumSectors;
+        handles[v] = v % 2 ? playsound(SoundHum, randompoint(where[v]), where[v], 0.1f, 1) : 0;
+    }
+
+    unsigned ticks = seconds * 1000 / TickMs;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (unsigned tick = 0; tick < ticks; tick++)
+    {
+        player.sector = (tick / 120) % NumSectors;
+        setlistener(randompoint(player.sector), tick * 0.01f, player.sector);
+        for (unsigned v = 0; v < numvoices; v++)
+        {
+            if (v % 2)
+            {
+                if (nextrandom() % 8 == 0)
+                {
+                    where[v] = nextrandom() % 4 ? where[v] : nextrandom() % NumSectors;
+                    movesound(handles[v], randompoint(where[v]), where[v]);
+                }
+            }
+            else if (nextrandom() % 25 == 0)
+            {
+                where[v] = nextrandom() % NumSectors;
+                playsound(nextrandom() % 3 ? SoundShot : SoundStep, randompoint(where[v]), where[v], 0.2f, 0);
+            }
+        }
+        advanceaudio(TickMs);
+    }
+    waitaudio();
+    double totalms = elapsedms(start, SDL_GetPerformanceCounter());
+
+    const AudioStats * stats = audiostats();
+    double audioseconds = (double)stats->frames / AudioRate;
+    printf("%u voices on %s, %.1f s of audio to %s\n", numvoices, mapname, audioseconds, wavpath);
+    printf("mix %.3f ms per second of audio (%.0fx real time), %.1f audible voices per block, peak %u\n",
+           stats->mixms / audioseconds, audioseconds * 1000 / stats->mixms,
+           (double)stats->voiceblocks * AudioBlock / (double)stats->frames, stats->peakvoices);
+    printf("propagation %.4f ms each, %u times; %llu commands, %.3f ms per tick with the game side\n",
+           stats->propagations ? stats->propagatems / stats->propagations : 0.0, stats->propagations,
+           stats->commands, totalms / ticks);
+
+    stopaudio();
+    UnloadData();
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,177 @@
+//
+//  benchmark.c
+//  UNTITLED3Dgame
+//
+//  Headless renderer and physics benchmark.
+//  Replays a fixed camera path through the real movement and collision code,
+//  rendering every frame through drawscreen into an offscreen framebuffer, and
+//  reports the time spent per frame. The same run trains the PGO build.
+//
+//      benchmark [map] [frames] [editor]
+//
+//  With "editor" every frame renders the four view editor layout instead.
+//  The path runs once with the float projection and once with the fixed
+//  point one, reporting nanoseconds per first person screen column for each,
+//  and how the render time splits between the visibility and raster stages.
+//
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/player.h"
+#include "../include/playermovement.h"
+#include "../include/renderer.h"
+#include "../include/viewport.h"
+#include "../include/jobs.h"
+#include "../include/automap.h"
+#include "../include/inputlog.h"
+#include "../include/mapcheck.h"
+
+#define DefaultFrames 2000
+
+// One leg of the camera path: hold these keys and turn this much per frame.
+typedef struct pathleg
+{
+    unsigned frames;
+    int wasd[4];
+    float turn;
+} PathLeg;
+
+// Walk, turn and strafe around whatever map is loaded. Collision keeps the
+// camera inside the level, so the path works on any map.
+static const PathLeg camera_path[] =
+{
+    {90, {1, 0, 0, 0},  0},
+    {40, {1, 0, 0, 0},  0.04f},
+    {30, {0, 0, 1, 0},  0},
+    {60, {0, 0, 0, 0}, -0.05f},
+    {45, {1, 0, 0, 1},  0.01f},
+    {30, {0, 1, 0, 0},  0},
+    {50, {1, 0, 1, 0}, -0.02f},
+    {25, {0, 0, 0, 0},  0.12f},
+};
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * mapname = argc > 1 ? argv[1] : MapName;
+    unsigned frames = argc > 2 ? (unsigned)atoi(argv[2]) : DefaultFrames;
+    if (frames == 0)
+    {
+        frames = DefaultFrames;
+    }
+
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    enum view_perspective game[] = {FirstPerson};
+    enum view_perspective editor[] = {FirstPerson, Top, Front, Side};
+    int num_views = argc > 3 && strcmp(argv[3], "editor") == 0 ? 4 : 1;
+    Viewport * views = create_views(num_views == 4 ? editor : game, num_views);
+    Camera cams[num_views];
+    Framebuffer fb = {malloc(sizeof(Uint32) * ScreenWidth * ScreenHeight), ScreenWidth, ScreenHeight, ScreenWidth};
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    LoadData(mapname);
+    double loadms = elapsedms(start, SDL_GetPerformanceCounter());
+    if (num_views > 1)
+    {
+        revealautomap();
+    }
+
+    // Screen columns the first person views cover each frame.
+    unsigned columns = 0;
+    for (int i = 0; i < num_views; i++)
+    {
+        columns += views[i].per == FirstPerson ? (unsigned)views[i].width : 0;
+    }
+
+    printf("map %s: %u sectors, loaded in %.3f ms (%.3f ms checking them, %u split), %d view(s)\n",
+           mapname, NumSectors, loadms, mapreport()->ms, mapreport()->split, num_views);
+    const Player startpose = player;
+    const enum projection_mode modes[] = {FloatProjection, FixedProjection};
+    for (int m = 0; m < 2; m++)
+    {
+        projection = modes[m];
+        player = startpose;
+        renderstats = (RenderStats) {0};
+        double renderms = 0, physicsms = 0, worstms = 0;
+        unsigned leg = 0, legframe = 0;
+        InputFrame input = {0, 0, 0, 0};
+        for (unsigned f = 0; f < frames; f++)
+        {
+            start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < num_views; i++)
+            {
+                cams[i] = viewcamera(&views[i]);
+            }
+            drawviews(&fb, views, cams, num_views);
+            Uint64 drawn = SDL_GetPerformanceCounter();
+            collisiondetection();
+
+            // Replay the camera path the way handleinput would have set the keys.
+            const PathLeg * current = &camera_path[leg];
+            const unsigned char keys[4] = {InputW, InputS, InputA, InputD};
+            input.buttons = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                input.buttons |= current->wasd[k] ? keys[k] : 0;
+            }
+            player.angle += current->turn;
+            handlemovement(&input);
+            if (++legframe == current->frames)
+            {
+                legframe = 0;
+                leg = (leg + 1) % (sizeof(camera_path) / sizeof(*camera_path));
+            }
+            Uint64 end = SDL_GetPerformanceCounter();
+
+            double framems = elapsedms(start, drawn);
+            renderms += framems;
+            physicsms += elapsedms(drawn, end);
+            worstms = framems > worstms ? framems : worstms;
+        }
+
+        printf("%s projection, %u frames: render %.3f ms/frame (worst %.3f ms), %.1f ns/column, physics %.4f ms/frame\n",
+               projection == FixedProjection ? "fixed" : "float", frames, renderms / frames, worstms,
+               columns ? renderms * 1e6 / ((double)frames * columns) : 0.0, physicsms / frames);
+        printf("  visibility %.3f ms/frame, raster %.3f ms/frame, %.0f spans/frame\n",
+               renderstats.projectms / frames, renderstats.rasterms / frames, (double)renderstats.spans / frames);
+        unsigned long long wallpixels = 0;
+        for (int l = 0; l < MaxMipLevels; l++)
+        {
+            wallpixels += renderstats.levelpixels[l];
+        }
+        printf("  occlusion: %.0f columns tested, %.0f rejected per frame\n",
+               (double)renderstats.testedcolumns / frames, (double)renderstats.rejectedcolumns / frames);
+        printf("  wall pixels by mip level:");
+        for (int l = 0; l < MaxMipLevels && wallpixels; l++)
+        {
+            printf(renderstats.levelpixels[l] ? " %d: %.1f%%" : "", l, renderstats.levelpixels[l] * 100.0 / wallpixels);
+        }
+        printf("\n");
+    }
+
+    UnloadData();
+    shutdownjobs();
+    free(views);
+    free(fb.pixels);
+    IMG_Quit();
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,355 @@
+//
+//  mapgen.c
+//  UNTITLED3Dgame
+//
+//  Writes large procedural maps in the text map format, for measuring how
+//  loading, rendering and collision scale with the size of a map.
+//
+//      mapgen out.txt [sectors] [seed] [concave%]
+//
+//  The map is a jittered grid of cells. Most cells are one four sided sector;
+//  some are cut into two triangles and some join their neighbour into a six
+//  sided room, so sectors have three to eight sides and as many portals.
+//  With concave% that share of cells start an L shaped room of three cells,
+//  which is not convex. A random spanning tree keeps every sector reachable
+//  and a quarter of the other sides between sectors are walled off. Floors
+//  roll gently enough to walk everywhere; there are lights and a few doors.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DefaultSectors 1000
+#define Cell 12.f             // World units between grid lines
+#define Jitter 2.5f           // Corners move this far at most, under a quarter cell so cells stay convex
+#define WallChance 25         // Percent of the sides off the spanning tree that are walls
+#define LineValues 10         // Vertex x values per line, well inside the loader's line buffer
+
+// How a cell is divided. Split cells are two triangles, their diagonal from
+// the cell's lower left corner to its upper right; Wide rooms take the cell
+// to their right too, and L rooms the cells to the right and above.
+enum cell_shape {Quad, Split, Wide, Ell, Taken};
+
+enum side {South, East, North, West};
+
+static unsigned seed = 1;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static float jitter(void)
+{
+    return ((float)(nextrandom() % 2001) / 1000.f - 1) * Jitter;
+}
+
+static unsigned width, height;
+static unsigned char * shape;
+static unsigned * owner;      // Sector on each side of each cell, four per cell
+static unsigned * parent;     // Union-find over sectors, for the spanning tree
+
+static unsigned findroot(unsigned s)
+{
+    while (parent[s] != s)
+    {
+        s = parent[s] = parent[parent[s]];
+    }
+    return s;
+}
+
+// The sector across the side of cell (i, j), or -1 off the grid.
+static int across(int i, int j, enum side side)
+{
+    static const int step[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+    int x = i + step[side][0], y = j + step[side][1];
+    if (x < 0 || y < 0 || x >= (int)width || y >= (int)height)
+    {
+        return -1;
+    }
+    return (int)owner[4 * (y * width + x) + (side + 2) % 4];
+}
+
+// Unit sides between two different sectors: the horizontal one along the
+// bottom of cell (i, j) is 2 * cell, the vertical one along its left 2 * cell + 1.
+static unsigned char * walled;
+
+static int sideneighbor(int i, int j, enum side side)
+{
+    // Each side is stored once, on the cell above or to the right of it.
+    unsigned index = side == South ? 2 * (j * width + i) : side == West ? 2 * (j * width + i) + 1
+                   : side == North ? 2 * ((j + 1) * width + i) : 2 * (j * width + i + 1) + 1;
+    int other = across(i, j, side);
+    return other >= 0 && walled[index] ? -1 : other;
+}
+
+// The neighbour across the edge of a sector's outline running from lattice
+// corner (i0, j0) to (i1, j1). Outlines run anticlockwise, so the sector is
+// on the left of the edge and the neighbour on the right.
+static int edgeneighbor(int i0, int j0, int i1, int j1)
+{
+    if (i1 == i0 + 1 && j1 == j0)
+    {
+        return sideneighbor(i0, j0, South);
+    }
+    if (i1 == i0 - 1 && j1 == j0)
+    {
+        return sideneighbor(i1, j0 - 1, North);
+    }
+    if (i1 == i0 && j1 == j0 + 1)
+    {
+        return sideneighbor(i0 - 1, j0, East);
+    }
+    return sideneighbor(i0, j1, West);
+}
+
+int main(int argc, const char * argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: mapgen out.txt [sectors] [seed] [concave%%]\n");
+        return 1;
+    }
+    unsigned target = argc > 2 ? (unsigned)atoi(argv[2]) : DefaultSectors;
+    seed = argc > 3 ? (unsigned)atoi(argv[3]) : 1;
+    unsigned concave = argc > 4 ? (unsigned)atoi(argv[4]) : 0;
+    target = target ? target : DefaultSectors;
+    FILE * fp = fopen(argv[1], "wt");
+    if (!fp)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // Roughly one sector per cell: the triangles make up for the rooms.
+    width = (unsigned)ceil(sqrt(target));
+    height = (target + width - 1) / width;
+    unsigned cells = width * height;
+    shape = malloc(cells);
+    owner = malloc(sizeof(*owner) * 4 * cells);
+    walled = calloc(2 * (width + 1) * (height + 1), 1);
+    for (unsigned c = 0; c < cells; c++)
+    {
+        shape[c] = Quad;
+    }
+
+    // Hand the cells out to sectors, bottom row first.
+    unsigned numsectors = 0;
+    for (unsigned j = 0; j < height; j++)
+    {
+        for (unsigned i = 0; i < width; i++)
+        {
+            unsigned c = j * width + i;
+            if (shape[c] == Taken)
+            {
+                continue;
+            }
+            unsigned roll = nextrandom() % 100;
+            int right = i + 1 < width && shape[c + 1] != Taken;
+            int above = j + 1 < height;
+            unsigned * side = &owner[4 * c];
+            if (roll < concave && right && above)
+            {
+                shape[c] = Ell;
+                shape[c + 1] = shape[c + width] = Taken;
+                for (int s = 0; s < 4; s++)
+                {
+                    side[s] = owner[4 * (c + 1) + s] = owner[4 * (c + width) + s] = numsectors;
+                }
+                numsectors++;
+            }
+            else if (roll < concave + 15 && right)
+            {
+                shape[c] = Wide;
+                shape[c + 1] = Taken;
+                for (int s = 0; s < 4; s++)
+                {
+                    side[s] = owner[4 * (c + 1) + s] = numsectors;
+                }
+                numsectors++;
+            }
+            else if (roll < concave + 35)
+            {
+                // The lower right triangle has the south and east sides.
+                shape[c] = Split;
+                side[South] = side[East] = numsectors++;
+                side[North] = side[West] = numsectors++;
+            }
+            else
+            {
+                side[South] = side[East] = side[North] = side[West] = numsectors++;
+            }
+        }
+    }
+
+    // Join everything with a random spanning tree of open sides, walling
+    // off some of the rest. Split cells are always open across the diagonal.
+    parent = malloc(sizeof(*parent) * numsectors);
+    for (unsigned s = 0; s < numsectors; s++)
+    {
+        parent[s] = s;
+    }
+    for (unsigned c = 0; c < cells; c++)
+    {
+        if (shape[c] == Split)
+        {
+            parent[owner[4 * c + North]] = owner[4 * c + South];
+        }
+    }
+    unsigned numsides = 2 * cells;
+    unsigned * order = malloc(sizeof(*order) * numsides);
+    for (unsigned k = 0; k < numsides; k++)
+    {
+        order[k] = k;
+    }
+    for (unsigned k = numsides - 1; k > 0; k--)
+    {
+        unsigned swap = nextrandom() % (k + 1), temp = order[k];
+        order[k] = order[swap];
+        order[swap] = temp;
+    }
+    for (unsigned k = 0; k < numsides; k++)
+    {
+        unsigned c = order[k] / 2, i = c % width, j = c / width;
+        int other = across((int)i, (int)j, order[k] % 2 ? West : South);
+        unsigned self = owner[4 * c + (order[k] % 2 ? West : South)];
+        if (other < 0 || (unsigned)other == self)
+        {
+            continue;
+        }
+        unsigned a = findroot(self), b = findroot((unsigned)other);
+        if (a != b)
+        {
+            parent[a] = b;
+        }
+        else if (nextrandom() % 100 < WallChance)
+        {
+            walled[order[k]] = 1;
+        }
+    }
+
+    // Corners: each row of the lattice is level, so every cell is a
+    // trapezoid and convex, and the x values can share a vertex line.
+    for (unsigned j = 0; j <= height; j++)
+    {
+        float y = j * Cell + (j > 0 && j < height ? jitter() : 0);
+        for (unsigned i = 0; i <= width; i++)
+        {
+            float x = i * Cell + (i > 0 && i < width ? jitter() : 0);
+            if (i % LineValues)
+            {
+                fprintf(fp, " %.2f", x);
+            }
+            else
+            {
+                fprintf(fp, i ? "\nvertex\t%.2f\t%.2f" : "vertex\t%.2f\t%.2f", y, x);
+            }
+        }
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "\n");
+
+    // Sectors in the order they were numbered. Floors roll gently enough
+    // to step up everywhere; ceilings leave room to stand.
+    unsigned middle = height / 2 * width + width / 2;
+    unsigned * doors = malloc(sizeof(*doors) * numsectors);
+    float * doorfloors = malloc(sizeof(*doorfloors) * numsectors);
+    unsigned numdoors = 0;
+    unsigned written = 0;
+    for (unsigned c = 0; c < cells; c++)
+    {
+        int i = (int)(c % width), j = (int)(c / width);
+        int corners[8][2];
+        int count = 0;
+        switch (shape[c])
+        {
+            case Taken:
+                continue;
+            case Wide:
+                count = 6;
+                memcpy(corners, (int[6][2]) {{i, j}, {i + 1, j}, {i + 2, j}, {i + 2, j + 1}, {i + 1, j + 1}, {i, j + 1}}, sizeof(int) * 12);
+                break;
+            case Ell:
+                count = 8;
+                memcpy(corners, (int[8][2]) {{i, j}, {i + 1, j}, {i + 2, j}, {i + 2, j + 1},
+                                             {i + 1, j + 1}, {i + 1, j + 2}, {i, j + 2}, {i, j + 1}}, sizeof(int) * 16);
+                break;
+            default:
+                count = 4;
+                memcpy(corners, (int[4][2]) {{i, j}, {i + 1, j}, {i + 1, j + 1}, {i, j + 1}}, sizeof(int) * 8);
+                break;
+        }
+        for (int part = 0; part < (shape[c] == Split ? 2 : 1); part++)
+        {
+            if (shape[c] == Split)
+            {
+                // Lower right triangle, then upper left.
+                count = 3;
+                memcpy(corners, part ? (int[3][2]) {{i, j}, {i + 1, j + 1}, {i, j + 1}}
+                                     : (int[3][2]) {{i, j}, {i + 1, j}, {i + 1, j + 1}}, sizeof(int) * 6);
+            }
+            float floor = roundf((2.f * sinf(i * 0.2f) + 2.f * cosf(j * 0.17f) + (float)(nextrandom() % 2) * 0.5f) * 2) / 2;
+            float ceil = floor + 12 + (float)(nextrandom() % 9) * 2;
+            // Now and then a plain cell is a door, shut until someone comes near.
+            if (shape[c] == Quad && c != middle && nextrandom() % 40 == 0)
+            {
+                doorfloors[numdoors] = floor;
+                doors[numdoors++] = written;
+                ceil = floor;
+            }
+            fprintf(fp, "sector\t%g %g\t", floor, ceil);
+            for (int k = 0; k < count; k++)
+            {
+                fprintf(fp, " %u", corners[k][1] * (width + 1) + corners[k][0]);
+            }
+            fprintf(fp, "\t");
+            for (int k = 0; k < count; k++)
+            {
+                // The edge into corner k comes from the corner before it.
+                const int * from = corners[(k + count - 1) % count], * to = corners[k];
+                int neighbor;
+                if (shape[c] == Split && from[0] - to[0] == from[1] - to[1])
+                {
+                    neighbor = (int)owner[4 * c + (part ? South : North)];
+                }
+                else
+                {
+                    neighbor = edgeneighbor(from[0], from[1], to[0], to[1]);
+                }
+                fprintf(fp, " %d", neighbor);
+            }
+            fprintf(fp, "\n");
+            written++;
+        }
+    }
+    fprintf(fp, "\n");
+
+    for (unsigned d = 0; d < numdoors; d++)
+    {
+        fprintf(fp, "door\t%u\t%g 0.5 90\n", doors[d], doorfloors[d] + 16);
+    }
+    for (unsigned s = 0; s < numsectors; s++)
+    {
+        if (nextrandom() % 8 == 0)
+        {
+            fprintf(fp, "light\t%u\t%.2f\n", s, 0.4f + (float)(nextrandom() % 50) / 100);
+        }
+    }
+    // Start in the middle cell, low and to the right, clear of the jitter
+    // and inside the lower triangle if the cell is split.
+    fprintf(fp, "\nplayer\t%.2f %.2f\t0\t%u\n", (width / 2 + 0.75f) * Cell, (height / 2 + 0.3f) * Cell, owner[4 * middle + South]);
+    fclose(fp);
+    printf("%s: %u sectors, %u by %u cells, %u doors\n", argv[1], numsectors, width, height, numdoors);
+
+    free(shape);
+    free(owner);
+    free(walled);
+    free(parent);
+    free(order);
+    free(doors);
+    free(doorfloors);
+    return 0;
+}
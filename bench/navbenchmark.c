@@ -0,0 +1,192 @@
+//
+//  navbenchmark.c
+//  UNTITLED3Dgame
+//
+//  Navigation benchmark. A crowd of agents chases a handful of targets: every
+//  tick each agent asks for its next sector in one batch, waits for the
+//  navigation thread and steps. Reports queries per second, and the cost of
+//  a flow field computed from scratch.
+//
+//      navbenchmark [map | --grid N] [agents] [ticks] [movers]
+//
+//  movers sectors rise and fall like lifts, recosting their portals through
+//  navupdate every tick while the crowd keeps asking.
+//
+//  --grid N builds an N by N grid of sectors in memory with uneven floors,
+//  low ceilings and a few impassable steps, to measure at scale.
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/navigation.h"
+
+#define DefaultAgents 500
+#define DefaultTicks 200
+#define NumTargets 8
+#define GridCell 8.f
+
+static unsigned seed = 12345;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static void makegrid(unsigned n)
+{
+    NumSectors = n * n;
+    sectors = malloc(sizeof(*sectors) * NumSectors);
+    for (unsigned j = 0; j < n; j++)
+    {
+        for (unsigned i = 0; i < n; i++)
+        {
+            Sector * sect = &sectors[j * n + i];
+            float x0 = i * GridCell, y0 = j * GridCell, x1 = x0 + GridCell, y1 = y0 + GridCell;
+            // Mostly walkable steps, with the odd ledge too high and ceiling too low.
+            sect->floor = (float)(nextrandom() % 7) * 0.5f;
+            sect->ceil = sect->floor + (nextrandom() % 10 == 0 ? 5.f : 20.f);
+            sect->light = 1;
+            sect->npoints = 4;
+            sect->vertex = malloc(sizeof(*sect->vertex) * 5);
+            sect->neighbors = malloc(sizeof(*sect->neighbors) * 4);
+            sect->surfaces = calloc(4, sizeof(*sect->surfaces));
+            sect->floortexture = sect->ceiltexture = -1;
+            sect->sky = 0;
+            // vertex[0] repeats the last corner; edge s runs from vertex[s] to vertex[s+1].
+            sect->vertex[0] = (XY) {x0, y1};
+            sect->vertex[1] = (XY) {x0, y0};
+            sect->vertex[2] = (XY) {x1, y0};
+            sect->vertex[3] = (XY) {x1, y1};
+            sect->vertex[4] = (XY) {x0, y1};
+            sect->neighbors[0] = i > 0 ? (int)(j * n + i - 1) : -1;
+            sect->neighbors[1] = j > 0 ? (int)((j - 1) * n + i) : -1;
+            sect->neighbors[2] = i + 1 < n ? (int)(j * n + i + 1) : -1;
+            sect->neighbors[3] = j + 1 < n ? (int)((j + 1) * n + i) : -1;
+        }
+    }
+    BuildGeometry();
+    BuildNavigation();
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, const char * argv[])
+{
+    int grid = argc > 2 && strcmp(argv[1], "--grid") == 0;
+    int arg = grid ? 3 : 2;
+    unsigned agents = argc > arg ? (unsigned)atoi(argv[arg]) : DefaultAgents;
+    unsigned ticks = argc > arg + 1 ? (unsigned)atoi(argv[arg + 1]) : DefaultTicks;
+    agents = agents ? agents : DefaultAgents;
+    ticks = ticks ? ticks : DefaultTicks;
+    unsigned movers = argc > arg + 2 ? (unsigned)atoi(argv[arg + 2]) : 0;
+
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (grid)
+    {
+        makegrid((unsigned)atoi(argv[2]));
+    }
+    else
+    {
+        LoadData(argc > 1 ? argv[1] : MapName);
+    }
+    double buildms = elapsedms(start, SDL_GetPerformanceCounter());
+    if (NumSectors == 0)
+    {
+        printf("No sectors\n");
+        return 1;
+    }
+
+    unsigned targets[NumTargets];
+    for (unsigned t = 0; t < NumTargets; t++)
+    {
+        targets[t] = nextrandom() % NumSectors;
+    }
+
+    // Time one flow field from an empty cache before the crowd starts hitting it.
+    NavQuery probe = {0, targets[0], -1, -1};
+    start = SDL_GetPerformanceCounter();
+    navsubmit(&probe, 1);
+    navwait();
+    double coldms = elapsedms(start, SDL_GetPerformanceCounter());
+
+    NavQuery * queries = malloc(sizeof(*queries) * agents);
+    unsigned * where = malloc(sizeof(*where) * agents);
+    for (unsigned a = 0; a < agents; a++)
+    {
+        where[a] = nextrandom() % NumSectors;
+    }
+    unsigned * moving = malloc(sizeof(*moving) * (movers + 1));
+    for (unsigned m = 0; m < movers; m++)
+    {
+        moving[m] = nextrandom() % NumSectors;
+    }
+    double updatems = 0;
+
+    unsigned long long answered = 0, arrived = 0, stuck = 0;
+    start = SDL_GetPerformanceCounter();
+    for (unsigned tick = 0; tick < ticks; tick++)
+    {
+        // A small step up or down each tick, turning round every 8 ticks.
+        float rise = tick / 8 % 2 ? -0.125f : 0.125f;
+        for (unsigned m = 0; m < movers; m++)
+        {
+            sectors[moving[m]].floor += rise;
+        }
+        Uint64 update = SDL_GetPerformanceCounter();
+        navupdate(moving, movers);
+        updatems += elapsedms(update, SDL_GetPerformanceCounter());
+
+        for (unsigned a = 0; a < agents; a++)
+        {
+            queries[a] = (NavQuery) {where[a], targets[a % NumTargets], -1, -1};
+        }
+        navsubmit(queries, agents);
+        navwait();
+        answered += agents;
+
+        // Step along the field. Agents that arrive or can't get there respawn somewhere else.
+        for (unsigned a = 0; a < agents; a++)
+        {
+            if (queries[a].next >= 0)
+            {
+                where[a] = (unsigned)queries[a].next;
+                continue;
+            }
+            arrived += queries[a].cost == 0;
+            stuck += queries[a].cost < 0;
+            where[a] = nextrandom() % NumSectors;
+        }
+    }
+    double totalms = elapsedms(start, SDL_GetPerformanceCounter());
+
+    printf("%u sectors, graph built in %.3f ms, one flow field from scratch %.3f ms\n", NumSectors, buildms, coldms);
+    printf("%llu queries in %.3f ms: %.0f queries/s (%llu arrived, %llu unreachable)\n",
+           answered, totalms, answered * 1000.0 / totalms, arrived, stuck);
+    if (movers)
+    {
+        printf("%u sectors moving every tick, %.4f ms per tick in navupdate\n", movers, updatems / ticks);
+    }
+
+    free(moving);
+    free(queries);
+    free(where);
+    UnloadData();
+    SDL_Quit();
+    return 0;
+}
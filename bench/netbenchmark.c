@@ -0,0 +1,176 @@
+//
+//  netbenchmark.c
+//  UNTITLED3Dgame
+//
+//  Client/server benchmark. A server and a crowd of simulated clients run in
+//  one process over the in-process transport, or over UNIX sockets with
+//  --socket. Every tick each client sends random input, the server simulates
+//  and sends snapshots, and the clients decode them. Reports the server's
+//  cost per tick, the bandwidth per client and checks every decoded snapshot
+//  against what the server had.
+//
+//      netbenchmark [map] [clients] [ticks] [loss%] [--socket]
+//
+//  loss% drops that share of messages both ways, so deltas have to fall back
+//  on older baselines.
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/netgame.h"
+
+#define DefaultTicks 1000
+#define TickMs 16
+
+static unsigned seed = 12345;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// Whether a client rebuilt exactly what the server sent.
+static int matches(const Snapshot * a, const Snapshot * b)
+{
+    return memcmp(a->entities, b->entities, sizeof a->entities) == 0
+        && memcmp(a->sectors, b->sectors, NumSectors * sizeof(*a->sectors)) == 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * args[4] = {MapName, "64", "1000", "0"};
+    int sockets = 0;
+    for (int i = 1, n = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--socket") == 0)
+        {
+            sockets = 1;
+        }
+        else if (n < 4)
+        {
+            args[n++] = argv[i];
+        }
+    }
+    unsigned numclients = (unsigned)atoi(args[1]);
+    unsigned ticks = (unsigned)atoi(args[2]);
+    unsigned loss = (unsigned)atoi(args[3]);
+    numclients = numclients && numclients <= MaxClients ? numclients : MaxClients;
+    ticks = ticks ? ticks : DefaultTicks;
+
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    LoadData(args[0]);
+
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/untitled3d-net-%d.sock", (int)getpid());
+    Transport * hub = sockets ? socketserver(path) : localserver();
+    if (!hub)
+    {
+        return 1;
+    }
+    hub->loss = loss;
+    Server * server = startserver(hub);
+
+    Transport * links[MaxClients];
+    NetClient * clients[MaxClients];
+    InputFrame inputs[MaxClients];
+    for (unsigned c = 0; c < numclients; c++)
+    {
+        links[c] = sockets ? socketconnect(path) : localconnect(hub);
+        if (!links[c])
+        {
+            return 1;
+        }
+        links[c]->loss = loss;
+        links[c]->seed = c + 2;
+        clients[c] = startclient(links[c]);
+        inputs[c] = (InputFrame) {0, 0, 0, 0};
+    }
+
+    unsigned long long decoded = 0, mismatched = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (unsigned tick = 0; tick < ticks; tick++)
+    {
+        // Hold random keys for a while, sometimes jump, and wiggle the mouse.
+        for (unsigned c = 0; c < numclients; c++)
+        {
+            InputFrame * input = &inputs[c];
+            if (nextrandom() % 30 == 0)
+            {
+                input->buttons = nextrandom() & (InputW | InputS | InputA | InputD | InputDuck);
+            }
+            input->buttons &= ~InputJump;
+            input->buttons |= nextrandom() % 90 == 0 ? InputJump : 0;
+            input->mousex = nextrandom() % 4 == 0 ? (int)(nextrandom() % 9) - 4 : 0;
+            input->mousey = nextrandom() % 8 == 0 ? (int)(nextrandom() % 5) - 2 : 0;
+            input->time = tick * TickMs;
+            clientinput(clients[c], input);
+        }
+
+        servertick(server);
+
+        for (unsigned c = 0; c < numclients; c++)
+        {
+            if (!clientupdate(clients[c]))
+            {
+                continue;
+            }
+            const Snapshot * got = clientsnapshot(clients[c]);
+            const Snapshot * sent = serversnapshot(server, got->tick);
+            decoded++;
+            mismatched += !sent || !matches(got, sent);
+        }
+    }
+    double totalms = elapsedms(start, SDL_GetPerformanceCounter());
+
+    const ServerStats * stats = serverstats(server);
+    const Snapshot * last = serversnapshot(server, stats->ticks);
+    unsigned char * full = malloc(maxsnapshotbytes());
+    unsigned fullbytes = encodesnapshot(NULL, last, full);
+    free(full);
+    unsigned long long inputbytes = 0;
+    for (unsigned c = 0; c < numclients; c++)
+    {
+        inputbytes += links[c]->sent;
+    }
+    double snapshots = stats->snapshots ? (double)stats->snapshots : 1;
+    double bytespertick = (double)stats->bytes / ((double)ticks * numclients);
+
+    printf("%u clients on %s over %s, %u ticks, %u%% loss, %u sectors\n",
+           numclients, args[0], sockets ? "UNIX sockets" : "the in-process transport", ticks, loss, NumSectors);
+    printf("server tick %.3f ms: simulate %.3f ms, snapshots %.3f ms (%.2f encodings per tick for %u clients)\n",
+           (stats->simulatems + stats->encodems) / ticks, stats->simulatems / ticks, stats->encodems / ticks,
+           (double)stats->encodings / ticks, stats->clients);
+    printf("down %.1f bytes per client per tick, %.1f kbit/s at %.1f ticks/s; %.1f bytes per snapshot, %.1f%% deltas, full snapshot %u bytes\n",
+           bytespertick, bytespertick * 8 * 1000 / TickMs / 1000, 1000.0 / TickMs,
+           stats->bytes / snapshots, stats->deltas * 100 / snapshots, fullbytes);
+    printf("up %.1f bytes per client per tick\n", (double)inputbytes / ((double)ticks * numclients));
+    printf("%llu snapshots decoded, %llu mismatched, %.3f ms per tick with the clients\n", decoded, mismatched, totalms / ticks);
+
+    for (unsigned c = 0; c < numclients; c++)
+    {
+        stopclient(clients[c]);
+        closetransport(links[c]);
+    }
+    stopserver(server);
+    closetransport(hub);
+    UnloadData();
+    SDL_Quit();
+    return mismatched != 0;
+}
@@ -0,0 +1,133 @@
+//
+//  raybenchmark.c
+//  UNTITLED3Dgame
+//
+//  Ray casting benchmark. Scatters entities over the map, then every tick
+//  fires a batch of hitscan rays from random points in random directions,
+//  once on the calling thread alone and once spread over the job threads.
+//  Reports rays per second for both and what the rays hit.
+//
+//      raybenchmark [map] [rays] [ticks] [entities]
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/jobs.h"
+#include "../include/raycast.h"
+
+#define DefaultRays 4096
+#define DefaultTicks 100
+#define DefaultEntities 64
+#define HitscanRange 1000.f
+
+static unsigned seed = 12345;
+
+static float nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (float)(seed >> 8) / (float)(1u << 24);
+}
+
+// A random point inside a random sector: somewhere between its centre and one of its corners.
+static XYZ randompoint(unsigned * sector)
+{
+    *sector = (unsigned)(nextrandom() * NumSectors) % NumSectors;
+    const Sector * sect = &sectors[*sector];
+    XY center = {0, 0};
+    for (unsigned p = 0; p < sect->npoints; p++)
+    {
+        center.x += sect->vertex[p].x / sect->npoints;
+        center.y += sect->vertex[p].y / sect->npoints;
+    }
+    XY corner = sect->vertex[(unsigned)(nextrandom() * sect->npoints) % sect->npoints];
+    float f = nextrandom() * 0.9f;
+    return (XYZ) {center.x + (corner.x - center.x) * f,
+                  center.y + (corner.y - center.y) * f,
+                  sect->floor + (sect->ceil - sect->floor) * nextrandom()};
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, const char * argv[])
+{
+    unsigned nrays = argc > 2 ? (unsigned)atoi(argv[2]) : DefaultRays;
+    unsigned ticks = argc > 3 ? (unsigned)atoi(argv[3]) : DefaultTicks;
+    unsigned nentities = argc > 4 ? (unsigned)atoi(argv[4]) : DefaultEntities;
+    nrays = nrays ? nrays : DefaultRays;
+    ticks = ticks ? ticks : DefaultTicks;
+
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    LoadData(argc > 1 ? argv[1] : MapName);
+
+    RayEntity * entities = malloc(sizeof(*entities) * (nentities + 1));
+    for (unsigned i = 0; i < nentities; i++)
+    {
+        XYZ where = randompoint(&entities[i].sector);
+        where.z = sectors[entities[i].sector].floor;
+        entities[i].where = where;
+        entities[i].radius = 0.5f;
+        entities[i].height = EyeHeight;
+    }
+    setrayentities(entities, nentities);
+
+    Ray * rays = malloc(sizeof(*rays) * nrays);
+    RayHit * hits = malloc(sizeof(*hits) * nrays);
+    unsigned long long counts[HitEntity + 1] = {0};
+    double serialms = 0, batchedms = 0;
+    for (unsigned tick = 0; tick < ticks; tick++)
+    {
+        for (unsigned i = 0; i < nrays; i++)
+        {
+            float angle = nextrandom() * 6.2831853f;
+            float pitch = (nextrandom() - 0.5f) * 0.6f;
+            rays[i].from = randompoint(&rays[i].sector);
+            rays[i].dir = (XYZ) {cosf(angle), sinf(angle), pitch};
+            rays[i].length = HitscanRange;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (unsigned i = 0; i < nrays; i++)
+        {
+            hits[i] = castray(&rays[i]);
+        }
+        Uint64 mid = SDL_GetPerformanceCounter();
+        castrays(rays, hits, nrays);
+        Uint64 end = SDL_GetPerformanceCounter();
+        serialms += elapsedms(start, mid);
+        batchedms += elapsedms(mid, end);
+
+        for (unsigned i = 0; i < nrays; i++)
+        {
+            counts[hits[i].what]++;
+        }
+    }
+
+    double total = (double)nrays * ticks;
+    printf("%u sectors, %u entities, %u rays x %u ticks\n", NumSectors, nentities, nrays, ticks);
+    printf("1 thread:   %.3f ms, %.0f rays/s\n", serialms, total * 1000.0 / serialms);
+    printf("%u threads: %.3f ms, %.0f rays/s\n", jobthreads(), batchedms, total * 1000.0 / batchedms);
+    printf("walls %llu, floors %llu, ceilings %llu, entities %llu, nothing %llu\n",
+           counts[HitWall], counts[HitFloor], counts[HitCeiling], counts[HitEntity], counts[HitNothing]);
+
+    setrayentities(NULL, 0);
+    free(entities);
+    free(rays);
+    free(hits);
+    UnloadData();
+    shutdownjobs();
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,146 @@
+//
+//  replay.c
+//  UNTITLED3Dgame
+//
+//  Headless input replay. Plays an input log recorded with
+//  UNTITLED3DShooter --record back through the movement and collision code
+//  as fast as possible, checks the player against the checksums stored in
+//  the log and reports how much faster than real time it ran.
+//
+//      replay log [repeats]
+//      replay --generate log [map] [ticks]
+//
+//  --generate records a scripted session of random keys and mouse motion
+//  without a window, for perf runs on machines without input devices.
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/animation.h"
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/inputlog.h"
+#include "../include/player.h"
+#include "../include/playermovement.h"
+
+#define DefaultTicks 10000
+#define TickMs 16 // Recorded tick length of generated sessions
+
+static unsigned seed = 12345;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// Hold random keys for a while, sometimes jump, and wiggle the mouse.
+static int generate(const char * path, const char * mapname, unsigned ticks)
+{
+    LoadData(mapname);
+    InputLog * log = startrecording(path, mapname);
+    if (!log)
+    {
+        return 1;
+    }
+    InputFrame input = {0, 0, 0, 0};
+    for (unsigned tick = 0; tick < ticks; tick++)
+    {
+        if (nextrandom() % 30 == 0)
+        {
+            input.buttons = nextrandom() & (InputW | InputS | InputA | InputD | InputDuck);
+        }
+        input.buttons &= ~InputJump;
+        input.buttons |= nextrandom() % 90 == 0 ? InputJump : 0;
+        input.mousex = nextrandom() % 4 == 0 ? (int)(nextrandom() % 9) - 4 : 0;
+        input.mousey = nextrandom() % 8 == 0 ? (int)(nextrandom() % 5) - 2 : 0;
+        input.time = tick * TickMs;
+
+        animatesectors();
+        collisiondetection();
+        handlemovement(&input);
+        recordinput(log, &input);
+    }
+    stoprecording(log);
+    printf("%u ticks on %s written to %s, player ends at %.3f %.3f %.3f\n",
+           ticks, mapname, path, player.where.x, player.where.y, player.where.z);
+    UnloadData();
+    return 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    if (argc > 2 && strcmp(argv[1], "--generate") == 0)
+    {
+        unsigned ticks = argc > 4 ? (unsigned)atoi(argv[4]) : DefaultTicks;
+        int failed = generate(argv[2], argc > 3 ? argv[3] : MapName, ticks ? ticks : DefaultTicks);
+        SDL_Quit();
+        return failed;
+    }
+    if (argc < 2)
+    {
+        printf("usage: replay log [repeats] | replay --generate log [map] [ticks]\n");
+        return 1;
+    }
+    unsigned repeats = argc > 2 ? (unsigned)atoi(argv[2]) : 1;
+    repeats = repeats ? repeats : 1;
+
+    int desynced = 0;
+    double totalms = 0;
+    unsigned ticks = 0, recordedms = 0;
+    for (unsigned r = 0; r < repeats && !desynced; r++)
+    {
+        InputLog * log = startreplay(argv[1]);
+        if (!log)
+        {
+            return 1;
+        }
+        LoadData(replaymap(log));
+
+        InputFrame input;
+        unsigned first = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        while (replayinput(log, &input))
+        {
+            first = inputticks(log) == 1 ? input.time : first;
+            animatesectors();
+            collisiondetection();
+            handlemovement(&input);
+            if (!checkreplay(log))
+            {
+                printf("desync at tick %u\n", inputticks(log));
+                desynced = 1;
+                break;
+            }
+        }
+        totalms += elapsedms(start, SDL_GetPerformanceCounter());
+        ticks = inputticks(log);
+        recordedms = input.time - first;
+        if (r == 0)
+        {
+            printf("%s: %u ticks on %s, player ends at %.3f %.3f %.3f\n",
+                   argv[1], ticks, replaymap(log), player.where.x, player.where.y, player.where.z);
+        }
+        stopreplay(log);
+        UnloadData();
+    }
+
+    double perrun = totalms / repeats;
+    printf("%s, %.3f ms per replay, %.0f ticks/s, %.0fx real time\n",
+           desynced ? "DESYNC" : "bit-exact", perrun, ticks * 1000.0 / perrun, recordedms / perrun);
+    SDL_Quit();
+    return desynced;
+}
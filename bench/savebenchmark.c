@@ -0,0 +1,148 @@
+//
+//  savebenchmark.c
+//  UNTITLED3Dgame
+//
+//  Save state benchmark. Plays a scripted session on a map, saving every
+//  tick into a rewind ring the way the game does. Every so often it goes
+//  back a stretch of ticks, plays them again with the same input, and
+//  checks the state it arrives at is byte for byte the one saved the first
+//  time. Reports the cost of saving and loading and the size of a state.
+//
+//      savebenchmark [map] [ticks] [rewind]
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/animation.h"
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/inputlog.h"
+#include "../include/player.h"
+#include "../include/playermovement.h"
+#include "../include/savestate.h"
+
+#define DefaultTicks 20000
+#define DefaultRewind 120
+#define TickMs 16
+
+static unsigned seed = 12345;
+
+static unsigned nextrandom(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void simulate(const InputFrame * input)
+{
+    animatesectors();
+    collisiondetection();
+    handlemovement(input);
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * mapname = argc > 1 ? argv[1] : MapName;
+    unsigned ticks = argc > 2 ? (unsigned)atoi(argv[2]) : DefaultTicks;
+    unsigned back = argc > 3 ? (unsigned)atoi(argv[3]) : DefaultRewind;
+    ticks = ticks ? ticks : DefaultTicks;
+    back = back ? back : DefaultRewind;
+    if (SDL_Init(0) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    LoadData(mapname);
+
+    // The same wandering input as replay --generate, kept to play stretches again.
+    InputFrame * inputs = malloc(sizeof(*inputs) * (ticks + 1));
+    InputFrame input = {0, 0, 0, 0};
+    for (unsigned tick = 1; tick <= ticks; tick++)
+    {
+        if (nextrandom() % 30 == 0)
+        {
+            input.buttons = nextrandom() & (InputW | InputS | InputA | InputD | InputDuck);
+        }
+        input.buttons &= ~InputJump;
+        input.buttons |= nextrandom() % 90 == 0 ? InputJump : 0;
+        input.mousex = nextrandom() % 4 == 0 ? (int)(nextrandom() % 9) - 4 : 0;
+        input.mousey = nextrandom() % 8 == 0 ? (int)(nextrandom() % 5) - 2 : 0;
+        input.time = tick * TickMs;
+        inputs[tick] = input;
+    }
+
+    Rewind * history = startrewind(back + 1);
+    SaveState first = {NULL, 0, 0}, again = {NULL, 0, 0};
+    double savems = 0, loadms = 0, replayms = 0;
+    unsigned saves = 0, loads = 0, mismatches = 0;
+    unsigned long long bytes = 0, largest = 0;
+    recordrewind(history, 0, &player, 1);
+    for (unsigned tick = 1; tick <= ticks; tick++)
+    {
+        simulate(&inputs[tick]);
+        Uint64 start = SDL_GetPerformanceCounter();
+        recordrewind(history, tick, &player, 1);
+        savems += elapsedms(start, SDL_GetPerformanceCounter());
+        saves++;
+
+        if (tick % (2 * back) == 0)
+        {
+            // What this tick looked like, to compare with after playing it again.
+            savestate(&first, tick, &player, 1);
+            bytes += first.size;
+            largest = first.size > largest ? first.size : largest;
+
+            start = SDL_GetPerformanceCounter();
+            unsigned gone = rewindstate(history, back, &player, 1);
+            loadms += elapsedms(start, SDL_GetPerformanceCounter());
+            loads++;
+
+            start = SDL_GetPerformanceCounter();
+            for (unsigned t = tick - gone + 1; t <= tick; t++)
+            {
+                simulate(&inputs[t]);
+                recordrewind(history, t, &player, 1);
+            }
+            replayms += elapsedms(start, SDL_GetPerformanceCounter());
+            savestate(&again, tick, &player, 1);
+            if (again.size != first.size || memcmp(again.data, first.data, first.size) != 0)
+            {
+                if (mismatches++ == 0)
+                {
+                    printf("state differs after rewinding %u ticks at tick %u\n", gone, tick);
+                }
+            }
+        }
+    }
+
+    // A quick-save round trip through a file.
+    savestate(&first, ticks, &player, 1);
+    int roundtrip = writesavestate(&first, "savebenchmark.u3ds") && readsavestate(&again, "savebenchmark.u3ds")
+                 && loadstate(&again, &player, 1) && savedtick(&again) == ticks;
+    remove("savebenchmark.u3ds");
+
+    printf("%s: %u sectors, %u animations, %u ticks, %u sectors changed since loading\n",
+           mapname, NumSectors, numanimations(), ticks, NumChanged);
+    printf("save %.2f us, load %.2f us, %.0f bytes per state (largest %llu)\n",
+           savems * 1000 / saves, loads ? loadms * 1000 / loads : 0.0, loads ? (double)bytes / loads : 0.0, largest);
+    printf("%u rewinds of %u ticks played again %s, %.3f ms per tick; file round trip %s\n",
+           loads, back, mismatches ? "DIFFERENTLY" : "bit-exact", replayms / (loads * back),
+           roundtrip ? "ok" : "FAILED");
+
+    freesavestate(&first);
+    freesavestate(&again);
+    stoprewind(history);
+    free(inputs);
+    UnloadData();
+    SDL_Quit();
+    return mismatches || !roundtrip;
+}
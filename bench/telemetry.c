@@ -0,0 +1,141 @@
+//
+//  telemetry.c
+//  UNTITLED3Dgame
+//
+//  Live view of a running game's or server's telemetry. Follows the file
+//  given to --telemetry as it grows, or connects to the socket given to
+//  --telemetry-socket, and shows each period as a table: what was counted,
+//  per second, how long each timed stretch took and how busy each thread was.
+//
+//      telemetry [--socket] path
+//
+//  On a terminal the table is redrawn in place; otherwise each one is
+//  printed after the last.
+//
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/telemetry.h"
+#include "../include/transport.h"
+
+#define PollMs 100
+#define BlockBytes 8192
+
+static int terminal = 0;
+
+// Show one block of the line protocol, from its telemetry line to its end.
+static void show(char * block)
+{
+    double seconds = 0, period = 1;
+    if (terminal)
+    {
+        printf("\033[H\033[2J");
+    }
+    for (char * line = strtok(block, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char name[32];
+        unsigned n;
+        double mean, p50, p99, most, busy;
+        if (sscanf(line, "telemetry %lf %lf", &seconds, &period) == 2)
+        {
+            period = period > 0 ? period : 1;
+            printf("%.1f s, over the last %.2f s\n\n%-12s %10s\n", seconds, period, "counter", "per second");
+        }
+        else if (sscanf(line, "count %31s %u", name, &n) == 2)
+        {
+            printf("%-12s %10.1f\n", name, n / period);
+        }
+        else if (sscanf(line, "timer %31s %u %lf %lf %lf %lf", name, &n, &mean, &p50, &p99, &most) == 6)
+        {
+            if (strcmp(name, "frame") == 0)
+            {
+                printf("\n%-12s %8s %9s %9s %9s %9s  ms\n", "timer", "runs", "mean", "p50", "p99", "max");
+            }
+            printf("%-12s %8u %9.4f %9.4f %9.4f %9.4f\n", name, n, mean, p50, p99, most);
+        }
+        else if (sscanf(line, "thread %31s %lf", name, &busy) == 2)
+        {
+            printf("%-12s %7.1f%% busy\n", name, busy);
+        }
+        else if (strcmp(line, "end") == 0)
+        {
+            printf(terminal ? "" : "\n");
+        }
+    }
+    fflush(stdout);
+}
+
+static int followsocket(const char * path)
+{
+    Transport * transport = socketconnect(path);
+    if (!transport)
+    {
+        return 1;
+    }
+    // Any message makes us a reader.
+    transportsend(transport, 0, "hello", 5);
+    char block[BlockBytes];
+    for (;;)
+    {
+        unsigned peer, size;
+        const void * message = transportreceive(transport, &peer, &size);
+        if (!message)
+        {
+            SDL_Delay(PollMs);
+            continue;
+        }
+        size = size < BlockBytes ? size : BlockBytes - 1;
+        memcpy(block, message, size);
+        block[size] = '\0';
+        show(block);
+    }
+}
+
+static int followfile(const char * path)
+{
+    FILE * fp = fopen(path, "r");
+    if (!fp)
+    {
+        perror(path);
+        return 1;
+    }
+    // Like tail -f: at the end, wait for the game to write more.
+    char block[BlockBytes], line[256];
+    size_t size = 0;
+    for (;;)
+    {
+        if (!fgets(line, sizeof line, fp))
+        {
+            clearerr(fp);
+            SDL_Delay(PollMs);
+            continue;
+        }
+        size_t length = strlen(line);
+        if (size + length < BlockBytes)
+        {
+            memcpy(block + size, line, length + 1);
+            size += length;
+        }
+        if (strcmp(line, "end\n") == 0)
+        {
+            show(block);
+            size = 0;
+        }
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    int sockets = argc > 2 && strcmp(argv[1], "--socket") == 0;
+    if (argc != 2 + sockets)
+    {
+        printf("usage: %s [--socket] path\n", argv[0]);
+        return 1;
+    }
+    terminal = isatty(STDOUT_FILENO);
+    return sockets ? followsocket(argv[2]) : followfile(argv[1]);
+}
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "animation.h"
+#include "geometry.h"
+#include "mapcheck.h"
+#include "navigation.h"
+#include "player.h"
+#include "mathlib.h"
+#include "telemetry.h"
+
+
+enum anim_kind {Door, Lift, Flicker};
+
+typedef struct sectoranim
+{
+    enum anim_kind kind;
+    unsigned sector;
+    float low, high, speed;
+    unsigned wait;
+    float target;   // Height or light level currently heading for
+    unsigned timer; // Ticks left before turning around
+    float starttarget;
+    unsigned starttimer; // Target and timer as the map started them
+} SectorAnim;
+
+static SectorAnim * anims = NULL;
+static unsigned numanims = 0, animcapacity = 0;
+static unsigned * moved = NULL; // Scratch list of sectors whose heights changed this tick
+static unsigned nummoved = 0, movedcapacity = 0;
+static unsigned flickerseed = 1;
+static Player * actors = &player; // Whoever opens doors and rides lifts
+static unsigned numactors = 1;
+
+static unsigned nextrandom(void)
+{
+    flickerseed = flickerseed * 1103515245u + 12345u;
+    return flickerseed >> 8;
+}
+
+void LoadAnimation(const char * keyword, const char * args)
+{
+    int sector = -1;
+    float a = 0, b = 0, c = 0;
+    unsigned wait = 0;
+    int fields = sscanf(args, "%d %f %f %f %u", &sector, &a, &b, &c, &wait);
+    if (sector < 0 || (unsigned)sector >= NumSectors)
+    {
+        printf("%s: no sector %d\n", keyword, sector);
+        return;
+    }
+    Sector * sect = &sectors[sector];
+
+    SectorAnim anim = {Door, (unsigned)sector, 0, 0, 0, 0, 0, 0, 0, 0};
+    if (strcmp(keyword, "light") == 0 && fields >= 2)
+    {
+        sect->light = clamp(a, 0, 1);
+        return;
+    }
+    else if (strcmp(keyword, "door") == 0 && fields >= 4)
+    {
+        // Closed is the ceiling the map gives the sector.
+        anim = (SectorAnim) {Door, (unsigned)sector, sect->ceil, a, b, (unsigned)c, sect->ceil, 0, sect->ceil, 0};
+    }
+    else if (strcmp(keyword, "lift") == 0 && fields >= 5)
+    {
+        anim = (SectorAnim) {Lift, (unsigned)sector, a, b, c, wait, sect->floor, wait, sect->floor, wait};
+    }
+    else if (strcmp(keyword, "flicker") == 0 && fields >= 4)
+    {
+        anim = (SectorAnim) {Flicker, (unsigned)sector, clamp(a, 0, 1), clamp(b, 0, 1), 0, (unsigned)c, sect->light, (unsigned)c, sect->light, (unsigned)c};
+    }
+    else
+    {
+        printf("Can't read map line: %s %s", keyword, args);
+        return;
+    }
+
+    if (++numanims > animcapacity)
+    {
+        animcapacity = animcapacity ? animcapacity * 2 : 16;
+        anims = realloc(anims, animcapacity * sizeof(*anims));
+    }
+    anims[numanims - 1] = anim;
+}
+
+void setanimationplayers(Player * list, unsigned count)
+{
+    actors = list ? list : &player;
+    numactors = list ? count : 1;
+}
+
+unsigned numanimations(void)
+{
+    return numanims;
+}
+
+unsigned saveanimations(AnimState * out, unsigned * seed)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < numanims; i++)
+    {
+        const SectorAnim * anim = &anims[i];
+        if (anim->target != anim->starttarget || anim->timer != anim->starttimer)
+        {
+            out[count++] = (AnimState) {i, anim->target, anim->timer};
+        }
+    }
+    *seed = flickerseed;
+    return count;
+}
+
+void restoreanimations(const AnimState * in, unsigned count, unsigned seed)
+{
+    for (unsigned i = 0; i < numanims; i++)
+    {
+        anims[i].target = anims[i].starttarget;
+        anims[i].timer = anims[i].starttimer;
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        anims[in[i].index].target = in[i].target;
+        anims[in[i].index].timer = in[i].timer;
+    }
+    flickerseed = seed;
+}
+
+void FreeAnimation(void)
+{
+    free(anims);
+    free(moved);
+    anims = NULL;
+    moved = NULL;
+    nummoved = movedcapacity = 0;
+    numanims = animcapacity = 0;
+    flickerseed = 1;
+}
+
+static float approach(float value, float target, float speed)
+{
+    return value < target ? min(value + speed, target) : max(value - speed, target);
+}
+
+// Whether any player stands in the sector or one next to it. A sector the
+// map check cut up counts as all of its pieces.
+static int playernear(unsigned sector)
+{
+    for (int p = (int)sector; p >= 0; p = nextpiece((unsigned)p))
+    {
+        const Sector * sect = &sectors[p];
+        for (unsigned i = 0; i < numactors; i++)
+        {
+            if (actors[i].sector >= NumSectors)
+            {
+                continue;
+            }
+            if (actors[i].sector == (unsigned)p)
+            {
+                return 1;
+            }
+            for (unsigned s = 0; s < sect->npoints; s++)
+            {
+                if (sect->neighbors[s] == (int)actors[i].sector)
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Set a height or the light of a sector and of every piece the map check cut
+// it into, marking them dirty. Pieces whose heights change go in moved.
+static void setsector(unsigned sector, unsigned char what, float value)
+{
+    for (int p = (int)sector; p >= 0; p = nextpiece((unsigned)p))
+    {
+        Sector * sect = &sectors[p];
+        *(what == DirtyFloor ? &sect->floor : what == DirtyCeil ? &sect->ceil : &sect->light) = value;
+        MarkDirty((unsigned)p, what);
+        if (what == DirtyLight)
+        {
+            continue;
+        }
+        if (nummoved == movedcapacity)
+        {
+            movedcapacity = movedcapacity ? movedcapacity * 2 : 16;
+            moved = realloc(moved, movedcapacity * sizeof(*moved));
+            telemetrycount(CountAllocations, 1);
+        }
+        moved[nummoved++] = (unsigned)p;
+    }
+}
+
+void animatesectors(void)
+{
+    Uint64 start = telemetrystart(TimeAnimate);
+    ClearDirty();
+    nummoved = 0;
+    for (unsigned i = 0; i < numanims; i++)
+    {
+        SectorAnim * anim = &anims[i];
+        Sector * sect = &sectors[anim->sector];
+        switch (anim->kind)
+        {
+            case Door:
+            {
+                // Stay open while the player is close, then close after the wait.
+                if (playernear(anim->sector))
+                {
+                    anim->target = anim->high;
+                    anim->timer = anim->wait;
+                }
+                else if (anim->timer > 0)
+                {
+                    anim->timer--;
+                }
+                else
+                {
+                    anim->target = anim->low;
+                }
+                float ceil = max(approach(sect->ceil, anim->target, anim->speed), sect->floor);
+                if (ceil != sect->ceil)
+                {
+                    setsector(anim->sector, DirtyCeil, ceil);
+                }
+                break;
+            }
+            case Lift:
+            {
+                // Pause at either end, then head for the other one.
+                if (sect->floor == anim->target)
+                {
+                    if (anim->timer > 0)
+                    {
+                        anim->timer--;
+                    }
+                    else
+                    {
+                        anim->target = anim->target == anim->high ? anim->low : anim->high;
+                        anim->timer = anim->wait;
+                    }
+                }
+                float floor = min(approach(sect->floor, anim->target, anim->speed), sect->ceil);
+                if (floor != sect->floor)
+                {
+                    setsector(anim->sector, DirtyFloor, floor);
+                }
+                break;
+            }
+            case Flicker:
+            {
+                if (anim->timer > 0)
+                {
+                    anim->timer--;
+                    break;
+                }
+                anim->target = sect->light == anim->high ? anim->low : anim->high;
+                anim->timer = nextrandom() % (anim->wait + 1);
+                if (anim->target != sect->light)
+                {
+                    setsector(anim->sector, DirtyLight, anim->target);
+                }
+                break;
+            }
+        }
+    }
+    if (NumDirty == 0)
+    {
+        telemetrystop(TimeAnimate, start);
+        return;
+    }
+
+    RefreshGeometry();
+    navupdate(moved, nummoved);
+    // Let gravity settle players onto floors that moved under them.
+    for (unsigned i = 0; i < numactors; i++)
+    {
+        if (actors[i].sector < NumSectors && SectorDirty[actors[i].sector] & (DirtyFloor | DirtyCeil))
+        {
+            actors[i].state.falling = 1;
+        }
+    }
+    telemetrystop(TimeAnimate, start);
+}
@@ -0,0 +1,59 @@
+#ifndef ANIMATION
+#define ANIMATION
+
+#include "player.h"
+
+/**
+ * LoadAnimation: Read one sector animation line of a map file. keyword is
+ * the first word on the line and args the rest of it:
+ *
+ *   light   sector level                  Fixed brightness, 0 to 1
+ *   door    sector open speed wait        Ceiling rises to open while the player is next to it
+ *   lift    sector low high speed wait    Floor travels between low and high
+ *   flicker sector dim bright wait        Light jumps between dim and bright, up to wait ticks apart
+ *
+ * Speeds are world units per tick and waits are in ticks. The sector has to
+ * be listed above the line.
+ */
+void LoadAnimation(const char * keyword, const char * args);
+
+void FreeAnimation(void);
+
+/**
+ * setanimationplayers: The players that open doors and get carried by lifts,
+ * for a server simulating many. Players outside the map are ignored. NULL
+ * goes back to just the local player.
+ */
+void setanimationplayers(Player * list, unsigned count);
+
+// Where an animation has got to, for save states.
+typedef struct animstate
+{
+    unsigned index;     // Which animation, in map order
+    float target;
+    unsigned timer;
+} AnimState;
+
+// How many animations the map has: the most saveanimations can write.
+unsigned numanimations(void);
+
+/**
+ * saveanimations: Write every animation that is no longer where the map
+ * started it to out and return how many there were. seed gets what the
+ * flickers draw their waits from.
+ */
+unsigned saveanimations(AnimState * out, unsigned * seed);
+
+// Put the listed animations back as saved, and all the others where the
+// map started them. The sectors themselves are the caller's to restore.
+void restoreanimations(const AnimState * in, unsigned count, unsigned seed);
+
+/**
+ * animatesectors: Advance every door, lift and light by one tick in a single
+ * pass over them, marking only the sectors that changed dirty. The wall list,
+ * map bounds and navigation graph are then patched for just those sectors.
+ * Call once per simulation tick, before collisiondetection.
+ */
+void animatesectors(void);
+
+#endif
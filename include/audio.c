@@ -0,0 +1,783 @@
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "audio.h"
+#include "mathlib.h"
+#include "telemetry.h"
+
+
+#define RingSize 4096         // Commands in flight between the game and the mixer, a power of two
+#define RefDistance 8.0f      // Sounds play at their own gain this close, half as loud at twice that
+#define PortalGain 0.9f       // Kept by sound going round the edge of a portal
+#define ClosedGain 0.12f      // Kept by sound going through a closed door
+#define OpenGap 6.0f          // Portals at least this tall let all of it through
+#define Knee 0.6f             // Mixed samples louder than this are squeezed in under full scale
+
+enum command_kind {CmdPlay, CmdMove, CmdStop, CmdListener, CmdSector, CmdAdvance, CmdSync, CmdQuit};
+
+// One message from the game thread to the mixer.
+typedef struct audiocommand
+{
+    unsigned char kind, sound, loop;
+    unsigned handle;    // Voice for play, move and stop; frames for advance
+    unsigned sector;
+    float x, y;
+    float value;        // Gain for play, angle for the listener, floor for a sector
+    float ceil;         // Sector ceiling
+} AudioCommand;
+
+typedef struct sound
+{
+    float * samples;    // Mono, at AudioRate
+    unsigned length;
+} Sound;
+
+typedef struct voice
+{
+    unsigned handle;    // 0 when free
+    unsigned sound, pos, sector;
+    int loop;
+    float gain, x, y;
+    float left, right;  // Gains the last block ended on, ramped from towards the next
+} Voice;
+
+typedef struct audioportal
+{
+    unsigned to;
+    XY mid;
+} AudioPortal;
+
+// The game thread only writes ringhead and the slots before it; the mixer
+// only writes ringtail. Each publishes with the atomic store after the slot.
+static AudioCommand ring[RingSize];
+static SDL_atomic_t ringhead, ringtail;
+static SDL_atomic_t dropped;            // Counted by the game thread, so kept out of stats
+
+static int running = 0;
+static int headless = 0;
+static unsigned nexthandle = 1;
+static unsigned long long advancedms = 0, advancedframes = 0;
+static SDL_AudioDeviceID device = 0;
+static SDL_Thread * mixthread = NULL;
+static SDL_sem * wake = NULL;
+static SDL_sem * synced = NULL;
+static FILE * wav = NULL;
+
+// Everything below belongs to the mixer once it runs.
+static Sound sounds[NumSounds];
+static Voice voices[MaxVoices];
+static AudioStats stats;
+static int quitting = 0;
+
+// The mixer's own copy of the portal graph, so it never reads sectors the
+// game thread is moving. Portals are grouped by sector, firstportal[s] on.
+static unsigned numsectors = 0;
+static unsigned * firstportal = NULL;
+static AudioPortal * portals = NULL;
+static float * floors = NULL;
+static float * ceils = NULL;
+
+// How sound from each sector reaches the listener: the length of the way
+// from the listener to via, the portal it enters the sector through, what
+// is left of it, and heard, where the listener hears it come from.
+static float * distance = NULL;
+static float * reach = NULL;
+static XY * via = NULL;
+static XY * heard = NULL;
+static unsigned * heapsector = NULL;
+static float * heapcost = NULL;
+static int graphdirty = 1;
+
+static struct
+{
+    XY where;
+    float anglesin, anglecos;
+    unsigned sector;
+} listener = {{0, 0}, 0, 1, (unsigned)-1};
+
+static unsigned noiseseed = 22222;
+
+static float whitenoise(void)
+{
+    noiseseed = noiseseed * 1103515245u + 12345u;
+    return (float)((noiseseed >> 9) & 0xffff) / 32768.0f - 1;
+}
+
+static float * newsound(enum sound_id id, float seconds)
+{
+    sounds[id].length = (unsigned)(seconds * AudioRate);
+    sounds[id].samples = malloc(sizeof(float) * sounds[id].length);
+    return sounds[id].samples;
+}
+
+// There are no sound files yet, so the sounds are made up at start.
+static void makesounds(void)
+{
+    const float tau = 2 * (float)M_PI;
+    float low = 0;
+    float * shot = newsound(SoundShot, 0.4f);
+    for (unsigned i = 0; i < sounds[SoundShot].length; i++)
+    {
+        float t = (float)i / AudioRate;
+        low += (whitenoise() - low) * 0.5f;
+        shot[i] = low * expf(-t * 18) * 0.9f + sinf(tau * 55 * t) * expf(-t * 10) * 0.6f;
+    }
+    float * step = newsound(SoundStep, 0.09f);
+    for (unsigned i = 0; i < sounds[SoundStep].length; i++)
+    {
+        low += (whitenoise() - low) * 0.2f;
+        step[i] = low * expf(-(float)i / AudioRate * 60) * 0.8f;
+    }
+    float * door = newsound(SoundDoor, 1.0f);
+    for (unsigned i = 0; i < sounds[SoundDoor].length; i++)
+    {
+        float t = (float)i / AudioRate;
+        float envelope = min(t / 0.05f, 1.0f) * min((1 - t) / 0.2f, 1.0f);
+        low += (whitenoise() - low) * 0.05f;
+        door[i] = envelope * ((sinf(tau * 40 * t) + 0.5f * sinf(tau * 83 * t)) * 0.3f + low * 0.6f);
+    }
+    // Whole cycles only, so the loop has no seam.
+    float * hum = newsound(SoundHum, 1.0f);
+    for (unsigned i = 0; i < sounds[SoundHum].length; i++)
+    {
+        float t = (float)i / AudioRate;
+        hum[i] = 0.2f * sinf(tau * 60 * t) + 0.1f * sinf(tau * 120 * t) + 0.05f * sinf(tau * 180 * t);
+    }
+}
+
+static void buildgraph(void)
+{
+    numsectors = NumSectors;
+    firstportal = calloc(numsectors + 1, sizeof(*firstportal));
+    for (unsigned s = 0; s < numsectors; s++)
+    {
+        firstportal[s + 1] = firstportal[s];
+        for (unsigned p = 0; p < sectors[s].npoints; p++)
+        {
+            firstportal[s + 1] += sectors[s].neighbors[p] >= 0;
+        }
+    }
+    unsigned count = firstportal[numsectors];
+    portals = malloc(sizeof(*portals) * (count + 1));
+    for (unsigned s = 0, fill = 0; s < numsectors; s++)
+    {
+        const Sector * sect = &sectors[s];
+        for (unsigned p = 0; p < sect->npoints; p++)
+        {
+            if (sect->neighbors[p] >= 0)
+            {
+                XY mid = {(sect->vertex[p].x + sect->vertex[p + 1].x) / 2, (sect->vertex[p].y + sect->vertex[p + 1].y) / 2};
+                portals[fill++] = (AudioPortal) {(unsigned)sect->neighbors[p], mid};
+            }
+        }
+    }
+    floors = malloc(sizeof(*floors) * (numsectors + 1));
+    ceils = malloc(sizeof(*ceils) * (numsectors + 1));
+    distance = malloc(sizeof(*distance) * (numsectors + 1));
+    reach = malloc(sizeof(*reach) * (numsectors + 1));
+    via = malloc(sizeof(*via) * (numsectors + 1));
+    heard = malloc(sizeof(*heard) * (numsectors + 1));
+    heapsector = malloc(sizeof(*heapsector) * (count + 1));
+    heapcost = malloc(sizeof(*heapcost) * (count + 1));
+    for (unsigned s = 0; s < numsectors; s++)
+    {
+        floors[s] = sectors[s].floor;
+        ceils[s] = sectors[s].ceil;
+    }
+}
+
+static void freegraph(void)
+{
+    free(firstportal);
+    free(portals);
+    free(floors);
+    free(ceils);
+    free(distance);
+    free(reach);
+    free(via);
+    free(heard);
+    free(heapsector);
+    free(heapcost);
+    firstportal = NULL;
+    portals = NULL;
+    floors = ceils = distance = reach = heapcost = NULL;
+    via = heard = NULL;
+    heapsector = NULL;
+    numsectors = 0;
+}
+
+static void heappush(unsigned * size, unsigned sector, float cost)
+{
+    unsigned i = (*size)++;
+    while (i > 0 && heapcost[(i - 1) / 2] > cost)
+    {
+        heapsector[i] = heapsector[(i - 1) / 2];
+        heapcost[i] = heapcost[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heapsector[i] = sector;
+    heapcost[i] = cost;
+}
+
+static unsigned heappop(unsigned * size, float * cost)
+{
+    unsigned top = heapsector[0];
+    *cost = heapcost[0];
+    unsigned lastsector = heapsector[--*size];
+    float lastcost = heapcost[*size];
+    unsigned i = 0;
+    for (;;)
+    {
+        unsigned child = 2 * i + 1;
+        if (child >= *size)
+        {
+            break;
+        }
+        child += child + 1 < *size && heapcost[child + 1] < heapcost[child];
+        if (heapcost[child] >= lastcost)
+        {
+            break;
+        }
+        heapsector[i] = heapsector[child];
+        heapcost[i] = heapcost[child];
+        i = child;
+    }
+    heapsector[i] = lastsector;
+    heapcost[i] = lastcost;
+    return top;
+}
+
+// Dijkstra from the listener out through the portals. Every sector is
+// entered once, by its shortest way, so each push is for a shorter path
+// and the heap never holds more than one entry per portal.
+static void propagate(void)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (unsigned s = 0; s < numsectors; s++)
+    {
+        distance[s] = INFINITY;
+        reach[s] = 0;
+    }
+    unsigned size = 0;
+    unsigned from = listener.sector;
+    if (from < numsectors)
+    {
+        distance[from] = 0;
+        reach[from] = 1;
+        via[from] = heard[from] = listener.where;
+        heappush(&size, from, 0);
+    }
+    while (size > 0)
+    {
+        float cost;
+        unsigned s = heappop(&size, &cost);
+        if (cost > distance[s])
+        {
+            continue;
+        }
+        for (unsigned p = firstportal[s]; p < firstportal[s + 1]; p++)
+        {
+            const AudioPortal * portal = &portals[p];
+            unsigned n = portal->to;
+            float next = cost + hypotf(portal->mid.x - via[s].x, portal->mid.y - via[s].y);
+            if (next >= distance[n])
+            {
+                continue;
+            }
+            float gap = min(ceils[s], ceils[n]) - max(floors[s], floors[n]);
+            distance[n] = next;
+            reach[n] = reach[s] * PortalGain * (gap <= 0 ? ClosedGain : clamp(gap / OpenGap, ClosedGain, 1.0f));
+            via[n] = portal->mid;
+            heard[n] = s == from ? portal->mid : heard[s];
+            heappush(&size, n, next);
+        }
+    }
+    graphdirty = 0;
+    stats.propagations++;
+    stats.propagatems += (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// Left and right gains for a voice: distance along the portals, and the
+// direction of the last portal it comes through.
+static void voicegains(const Voice * voice, float * left, float * right)
+{
+    unsigned s = voice->sector;
+    if (s >= numsectors || reach[s] <= 0)
+    {
+        *left = *right = 0;
+        return;
+    }
+    float way = distance[s] + hypotf(voice->x - via[s].x, voice->y - via[s].y);
+    float gain = voice->gain * reach[s] * RefDistance / (RefDistance + way);
+    XY from = s == listener.sector ? (XY) {voice->x, voice->y} : heard[s];
+    float dx = from.x - listener.where.x, dy = from.y - listener.where.y;
+    float length = hypotf(dx, dy);
+    // Positive across is to the listener's left, as on screen.
+    float pan = length > 0.01f ? -(dx * listener.anglesin - dy * listener.anglecos) / length : 0;
+    *left = gain * sqrtf((1 - pan) / 2);
+    *right = gain * sqrtf((1 + pan) / 2);
+}
+
+// Add count samples into the two channels, the gains moving by dleft and
+// dright every sample.
+static void mixrun(float * left, float * right, const float * in, unsigned count, float gl, float gr, float dleft, float dright)
+{
+    unsigned i = 0;
+#ifdef __SSE__
+    __m128 ramp = _mm_set_ps(3, 2, 1, 0);
+    __m128 vl = _mm_add_ps(_mm_set1_ps(gl), _mm_mul_ps(ramp, _mm_set1_ps(dleft)));
+    __m128 vr = _mm_add_ps(_mm_set1_ps(gr), _mm_mul_ps(ramp, _mm_set1_ps(dright)));
+    __m128 stepl = _mm_set1_ps(4 * dleft), stepr = _mm_set1_ps(4 * dright);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sample = _mm_loadu_ps(in + i);
+        _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), _mm_mul_ps(sample, vl)));
+        _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), _mm_mul_ps(sample, vr)));
+        vl = _mm_add_ps(vl, stepl);
+        vr = _mm_add_ps(vr, stepr);
+    }
+    gl += dleft * i;
+    gr += dright * i;
+#endif
+    for (; i < count; i++)
+    {
+        left[i] += in[i] * gl;
+        right[i] += in[i] * gr;
+        gl += dleft;
+        gr += dright;
+    }
+}
+
+static void mixvoice(Voice * voice, float * left, float * right, unsigned frames)
+{
+    float tl, tr;
+    voicegains(voice, &tl, &tr);
+    const Sound * sound = &sounds[voice->sound];
+    float gl = voice->left, gr = voice->right;
+    float dleft = (tl - gl) / frames, dright = (tr - gr) / frames;
+    int audible = max(max(gl, gr), max(tl, tr)) > 1e-4f;
+    for (unsigned done = 0; done < frames;)
+    {
+        unsigned run = min(frames - done, sound->length - voice->pos);
+        if (audible)
+        {
+            mixrun(left + done, right + done, sound->samples + voice->pos, run, gl, gr, dleft, dright);
+        }
+        gl += dleft * run;
+        gr += dright * run;
+        done += run;
+        voice->pos += run;
+        if (voice->pos == sound->length)
+        {
+            if (!voice->loop)
+            {
+                voice->handle = 0;
+                break;
+            }
+            voice->pos = 0;
+        }
+    }
+    voice->left = tl;
+    voice->right = tr;
+    stats.voiceblocks += audible;
+}
+
+// A crowd of loud voices would clip hard; bend everything past the knee
+// smoothly towards full scale instead.
+static Sint16 tosample(float x)
+{
+    float size = fabsf(x);
+    if (size > Knee)
+    {
+        size = Knee + (1 - Knee) * tanhf((size - Knee) / (1 - Knee));
+        x = copysignf(size, x);
+    }
+    return (Sint16)(x * 32767);
+}
+
+// Mix frames (at most AudioBlock) of every voice into 16 bit stereo.
+static void mixblock(Sint16 * out, unsigned frames)
+{
+    Uint64 timed = telemetrystart(TimeMix);
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (graphdirty)
+    {
+        propagate();
+    }
+    float left[AudioBlock], right[AudioBlock];
+    memset(left, 0, sizeof(float) * frames);
+    memset(right, 0, sizeof(float) * frames);
+    unsigned playing = 0;
+    for (unsigned v = 0; v < MaxVoices; v++)
+    {
+        if (voices[v].handle)
+        {
+            playing++;
+            mixvoice(&voices[v], left, right, frames);
+        }
+    }
+    for (unsigned i = 0; i < frames; i++)
+    {
+        out[2 * i] = tosample(left[i]);
+        out[2 * i + 1] = tosample(right[i]);
+    }
+    stats.frames += frames;
+    stats.peakvoices = max(stats.peakvoices, playing);
+    stats.mixms += (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    telemetrystop(TimeMix, timed);
+}
+
+static Voice * findvoice(unsigned handle)
+{
+    for (unsigned v = 0; v < MaxVoices; v++)
+    {
+        if (voices[v].handle == handle)
+        {
+            return &voices[v];
+        }
+    }
+    return NULL;
+}
+
+// A free voice, or else the quietest one.
+static Voice * freevoice(void)
+{
+    Voice * quietest = &voices[0];
+    for (unsigned v = 0; v < MaxVoices; v++)
+    {
+        if (!voices[v].handle)
+        {
+            return &voices[v];
+        }
+        if (voices[v].left + voices[v].right < quietest->left + quietest->right)
+        {
+            quietest = &voices[v];
+        }
+    }
+    return quietest;
+}
+
+static void putle(unsigned value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        fputc((int)(value >> (8 * i)) & 0xff, wav);
+    }
+}
+
+// RIFF header for 16 bit stereo; the sizes are filled in by stopaudio.
+static void writewavheader(unsigned databytes)
+{
+    fputs("RIFF", wav);
+    putle(36 + databytes, 4);
+    fputs("WAVEfmt ", wav);
+    putle(16, 4);
+    putle(1, 2);
+    putle(2, 2);
+    putle(AudioRate, 4);
+    putle(AudioRate * 4, 4);
+    putle(4, 2);
+    putle(16, 2);
+    fputs("data", wav);
+    putle(databytes, 4);
+}
+
+// Carry out every command the game thread has published.
+static void drain(void)
+{
+    unsigned tail = (unsigned)SDL_AtomicGet(&ringtail);
+    unsigned head = (unsigned)SDL_AtomicGet(&ringhead);
+    for (; tail != head; tail++)
+    {
+        const AudioCommand * cmd = &ring[tail % RingSize];
+        stats.commands++;
+        switch (cmd->kind)
+        {
+            case CmdPlay:
+            {
+                Voice * voice = freevoice();
+                *voice = (Voice) {cmd->handle, cmd->sound, 0, cmd->sector, cmd->loop, cmd->value, cmd->x, cmd->y, 0, 0};
+                if (graphdirty)
+                {
+                    propagate();
+                }
+                // Start at full volume so attacks aren't ramped away.
+                voicegains(voice, &voice->left, &voice->right);
+                break;
+            }
+            case CmdMove:
+            {
+                Voice * voice = findvoice(cmd->handle);
+                if (voice)
+                {
+                    voice->x = cmd->x;
+                    voice->y = cmd->y;
+                    voice->sector = cmd->sector;
+                }
+                break;
+            }
+            case CmdStop:
+            {
+                Voice * voice = findvoice(cmd->handle);
+                if (voice)
+                {
+                    voice->handle = 0;
+                }
+                break;
+            }
+            case CmdListener:
+                listener.where = (XY) {cmd->x, cmd->y};
+                listener.anglesin = sinf(cmd->value);
+                listener.anglecos = cosf(cmd->value);
+                listener.sector = cmd->sector;
+                graphdirty = 1;
+                break;
+            case CmdSector:
+                if (cmd->sector < numsectors)
+                {
+                    floors[cmd->sector] = cmd->value;
+                    ceils[cmd->sector] = cmd->ceil;
+                    graphdirty = 1;
+                }
+                break;
+            case CmdAdvance:
+            {
+                Sint16 block[AudioBlock * 2];
+                for (unsigned done = 0; done < cmd->handle; done += AudioBlock)
+                {
+                    unsigned frames = min(cmd->handle - done, (unsigned)AudioBlock);
+                    mixblock(block, frames);
+                    fwrite(block, sizeof(Sint16) * 2, frames, wav);
+                }
+                break;
+            }
+            case CmdSync:
+                SDL_SemPost(synced);
+                break;
+            case CmdQuit:
+                quitting = 1;
+                break;
+        }
+        SDL_AtomicSet(&ringtail, (int)(tail + 1));
+    }
+}
+
+static int mixerloop(void * unused)
+{
+    (void)unused;
+    telemetrythread("audio");
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+    while (!quitting)
+    {
+        SDL_SemWait(wake);
+        drain();
+    }
+    return 0;
+}
+
+static void devicecallback(void * unused, Uint8 * stream, int len)
+{
+    (void)unused;
+    telemetrythread("audio");
+    drain();
+    Sint16 * out = (Sint16 *)stream;
+    unsigned frames = (unsigned)len / (sizeof(Sint16) * 2);
+    for (unsigned done = 0; done < frames; done += AudioBlock)
+    {
+        mixblock(out + 2 * done, min(frames - done, (unsigned)AudioBlock));
+    }
+}
+
+// Queue a command. A live device must never wait on the game, so a full
+// ring drops the command; headless, the game waits for the mixer instead.
+static int push(AudioCommand cmd)
+{
+    if (!running)
+    {
+        return 0;
+    }
+    for (;;)
+    {
+        unsigned head = (unsigned)SDL_AtomicGet(&ringhead);
+        unsigned tail = (unsigned)SDL_AtomicGet(&ringtail);
+        if (head - tail < RingSize)
+        {
+            ring[head % RingSize] = cmd;
+            SDL_AtomicSet(&ringhead, (int)(head + 1));
+            break;
+        }
+        if (!headless)
+        {
+            SDL_AtomicAdd(&dropped, 1);
+            return 0;
+        }
+        SDL_SemPost(wake);
+        SDL_Delay(1);
+    }
+    if (headless && (cmd.kind == CmdAdvance || cmd.kind == CmdSync || cmd.kind == CmdQuit))
+    {
+        SDL_SemPost(wake);
+    }
+    return 1;
+}
+
+int startaudio(const char * wavpath)
+{
+    if (running)
+    {
+        return 1;
+    }
+    memset(voices, 0, sizeof(voices));
+    memset(&stats, 0, sizeof(stats));
+    SDL_AtomicSet(&dropped, 0);
+    SDL_AtomicSet(&ringhead, 0);
+    SDL_AtomicSet(&ringtail, 0);
+    quitting = 0;
+    graphdirty = 1;
+    advancedms = advancedframes = 0;
+    listener.sector = (unsigned)-1;
+    makesounds();
+    buildgraph();
+    headless = wavpath != NULL;
+
+    if (headless)
+    {
+        wav = fopen(wavpath, "wb");
+        if (!wav)
+        {
+            printf("Can't write %s\n", wavpath);
+            stopaudio();
+            return 0;
+        }
+        writewavheader(0);
+        wake = SDL_CreateSemaphore(0);
+        synced = SDL_CreateSemaphore(0);
+        mixthread = SDL_CreateThread(mixerloop, "audio", NULL);
+    }
+    else
+    {
+        SDL_AudioSpec want = {AudioRate, AUDIO_S16SYS, 2, 0, AudioBlock, 0, 0, devicecallback, NULL};
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0 || !(device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0)))
+        {
+            printf("No audio: %s\n", SDL_GetError());
+            stopaudio();
+            return 0;
+        }
+        SDL_PauseAudioDevice(device, 0);
+    }
+    running = 1;
+    return 1;
+}
+
+void stopaudio(void)
+{
+    if (mixthread)
+    {
+        push((AudioCommand) {CmdQuit, 0, 0, 0, 0, 0, 0, 0, 0});
+        SDL_WaitThread(mixthread, NULL);
+        mixthread = NULL;
+    }
+    if (device)
+    {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+    if (wav)
+    {
+        unsigned long long databytes = stats.frames * sizeof(Sint16) * 2;
+        fseek(wav, 0, SEEK_SET);
+        writewavheader((unsigned)min(databytes, 0xffffffffull - 36));
+        fclose(wav);
+        wav = NULL;
+    }
+    if (wake)
+    {
+        SDL_DestroySemaphore(wake);
+        SDL_DestroySemaphore(synced);
+        wake = synced = NULL;
+    }
+    for (unsigned s = 0; s < NumSounds; s++)
+    {
+        free(sounds[s].samples);
+        sounds[s] = (Sound) {NULL, 0};
+    }
+    freegraph();
+    running = 0;
+}
+
+unsigned playsound(enum sound_id sound, XYZ where, unsigned sector, float gain, int loop)
+{
+    unsigned handle = nexthandle;
+    if (!push((AudioCommand) {CmdPlay, (unsigned char)sound, (unsigned char)(loop != 0), handle, sector, where.x, where.y, gain, 0}))
+    {
+        return 0;
+    }
+    // 0 means no sound, so skip it when the handles wrap.
+    nexthandle = nexthandle + 1 ? nexthandle + 1 : 1;
+    return handle;
+}
+
+void movesound(unsigned handle, XYZ where, unsigned sector)
+{
+    push((AudioCommand) {CmdMove, 0, 0, handle, sector, where.x, where.y, 0, 0});
+}
+
+void stopsound(unsigned handle)
+{
+    push((AudioCommand) {CmdStop, 0, 0, handle, 0, 0, 0, 0, 0});
+}
+
+void setlistener(XYZ where, float angle, unsigned sector)
+{
+    push((AudioCommand) {CmdListener, 0, 0, 0, sector, where.x, where.y, angle, 0});
+}
+
+void audiosectors(const unsigned * changed, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        // Lights flicker every tick and make no difference to sound.
+        if (SectorDirty && !(SectorDirty[changed[i]] & (DirtyFloor | DirtyCeil)))
+        {
+            continue;
+        }
+        const Sector * sect = &sectors[changed[i]];
+        push((AudioCommand) {CmdSector, 0, 0, 0, changed[i], 0, 0, sect->floor, sect->ceil});
+    }
+}
+
+void advanceaudio(unsigned ms)
+{
+    if (!headless)
+    {
+        return;
+    }
+    // Count in whole frames from the start, so the odd fractions don't drift.
+    advancedms += ms;
+    unsigned frames = (unsigned)(advancedms * AudioRate / 1000 - advancedframes);
+    if (push((AudioCommand) {CmdAdvance, 0, 0, frames, 0, 0, 0, 0, 0}))
+    {
+        advancedframes += frames;
+    }
+}
+
+void waitaudio(void)
+{
+    if (headless && push((AudioCommand) {CmdSync, 0, 0, 0, 0, 0, 0, 0, 0}))
+    {
+        SDL_SemWait(synced);
+    }
+}
+
+const AudioStats * audiostats(void)
+{
+    // The mixer never touches dropped, so this write is not a race.
+    stats.dropped = (unsigned)SDL_AtomicGet(&dropped);
+    return &stats;
+}
@@ -0,0 +1,69 @@
+#ifndef AUDIO
+#define AUDIO
+
+#include "geometry.h"
+
+
+#define AudioRate 44100
+#define AudioBlock 256        // Frames mixed at a time
+#define MaxVoices 256         // Sounds playing at once; the quietest is cut for a new one
+
+enum sound_id {SoundShot, SoundStep, SoundDoor, SoundHum, NumSounds};
+
+// What the mixer has done so far. Written by the mixer, so only read it after
+// waitaudio, which the headless mixer answers once it has caught up.
+typedef struct audiostats
+{
+    unsigned long long frames;          // Stereo frames mixed
+    unsigned long long voiceblocks;     // Voices mixed, summed over every block
+    unsigned long long commands;
+    unsigned long long dropped;         // Commands lost to a full ring with a live device, current whenever read
+    unsigned propagations;              // Times the portal graph was walked
+    unsigned peakvoices;
+    double mixms, propagatems;
+} AudioStats;
+
+/**
+ * startaudio: Start the mixer for the loaded map. With wavpath NULL it mixes
+ * for the audio device on SDL's audio thread. Otherwise it runs headless on
+ * its own thread, writing 16 bit stereo to wavpath, and only mixes as much
+ * as advanceaudio asks for, so the file follows game time exactly.
+ * Returns 0 when neither could be opened; every other call is then a no-op.
+ */
+int startaudio(const char * wavpath);
+
+// Finish the WAV file, if any, and stop the mixer.
+void stopaudio(void);
+
+/**
+ * playsound: Start a sound at where, in sector, and return a handle for
+ * movesound and stopsound (0 when audio is off). One-shot sounds free their
+ * voice when they end; looping ones play until stopped.
+ */
+unsigned playsound(enum sound_id sound, XYZ where, unsigned sector, float gain, int loop);
+
+void movesound(unsigned handle, XYZ where, unsigned sector);
+
+void stopsound(unsigned handle);
+
+/**
+ * setlistener: Where the sounds are heard from. Loudness and direction come
+ * from the shortest way through the portals, not a straight line: every
+ * portal passed costs a little, and doors closed or nearly closed muffle
+ * what comes through them.
+ */
+void setlistener(XYZ where, float angle, unsigned sector);
+
+// Tell the mixer the heights of sectors that changed, e.g. the dirty list
+// after animatesectors, so portals open and close for sound too.
+void audiosectors(const unsigned * changed, unsigned count);
+
+// Headless only: mix another ms of audio into the WAV file.
+void advanceaudio(unsigned ms);
+
+// Headless only: block until the mixer has carried out every command so far.
+void waitaudio(void);
+
+const AudioStats * audiostats(void);
+
+#endif
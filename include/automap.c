@@ -0,0 +1,144 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+
+#include "automap.h"
+#include "renderer.h"
+#include "color.h"
+#include "geometry.h"
+#include "mathlib.h"
+#include "player.h"
+
+
+typedef struct automapline
+{
+    XY a, b;
+    int neighbor;
+} AutomapLine;
+
+// Every edge of one sector and the box around them, so a whole sector can be
+// culled against the view with one test.
+typedef struct automapbatch
+{
+    unsigned first, count;
+    XY min, max;
+} AutomapBatch;
+
+SDL_bool showautomap = SDL_FALSE;
+
+static AutomapLine * lines = NULL;
+static AutomapBatch * batches = NULL;
+
+// The sectors drawn so far, in the order they were discovered. This mirrors
+// the renderer's VisitOrder up to layersize, but is only touched between
+// frames so the views can read it while the renderer is still visiting.
+static unsigned * layer = NULL;
+static unsigned char * inlayer = NULL;
+static unsigned layersize = 0;
+
+void BuildAutomap(void)
+{
+    FreeAutomap();
+    lines = malloc(sizeof(*lines) * NumWalls);
+    batches = malloc(sizeof(*batches) * NumSectors);
+    layer = malloc(sizeof(*layer) * NumSectors);
+    inlayer = calloc(NumSectors, sizeof(*inlayer));
+
+    unsigned n = 0;
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        const Sector * sect = &sectors[s];
+        AutomapBatch * batch = &batches[s];
+        *batch = (AutomapBatch) {n, sect->npoints, sect->vertex[0], sect->vertex[0]};
+        for (unsigned p = 0; p < sect->npoints; p++, n++)
+        {
+            lines[n] = (AutomapLine) {sect->vertex[p], sect->vertex[p+1], sect->neighbors[p]};
+            batch->min.x = min(batch->min.x, sect->vertex[p].x);
+            batch->min.y = min(batch->min.y, sect->vertex[p].y);
+            batch->max.x = max(batch->max.x, sect->vertex[p].x);
+            batch->max.y = max(batch->max.y, sect->vertex[p].y);
+        }
+    }
+}
+
+void FreeAutomap(void)
+{
+    free(lines);
+    free(batches);
+    free(layer);
+    free(inlayer);
+    lines = NULL;
+    batches = NULL;
+    layer = NULL;
+    inlayer = NULL;
+    layersize = 0;
+}
+
+void updateautomap(void)
+{
+    while (layersize < NumVisited)
+    {
+        layer[layersize] = VisitOrder[layersize];
+        inlayer[layer[layersize]] = 1;
+        layersize++;
+    }
+}
+
+void revealautomap(void)
+{
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        MarkVisited(&s, 1);
+    }
+    updateautomap();
+}
+
+Camera automapcamera(void)
+{
+    Camera cam = playercamera();
+    cam.zoom = AutomapZoom;
+    return cam;
+}
+
+void drawautomap(const Framebuffer * fb, const Camera * cam)
+{
+    clearframe(fb, charcoal);
+
+    // The world rectangle the view covers. Screen y grows downwards, world y upwards.
+    float halfw = fb->width / 2.f / cam->zoom, halfh = fb->height / 2.f / cam->zoom;
+    XY lo = {cam->where.x - halfw, cam->where.y - halfh};
+    XY hi = {cam->where.x + halfw, cam->where.y + halfh};
+    #define ToScreenX(wx) (fb->width / 2.f + ((wx) - cam->where.x) * cam->zoom)
+    #define ToScreenY(wy) (fb->height / 2.f - ((wy) - cam->where.y) * cam->zoom)
+
+    for (unsigned i = 0; i < layersize; i++)
+    {
+        unsigned s = layer[i];
+        const AutomapBatch * batch = &batches[s];
+        if (!IntersectBox(lo.x, lo.y, hi.x, hi.y, batch->min.x, batch->min.y, batch->max.x, batch->max.y))
+        {
+            continue;
+        }
+        for (unsigned l = batch->first; l < batch->first + batch->count; l++)
+        {
+            const AutomapLine * line = &lines[l];
+            // A portal between two visited sectors belongs to the lower numbered one.
+            if (line->neighbor >= 0 && (unsigned)line->neighbor < s && inlayer[line->neighbor])
+            {
+                continue;
+            }
+            if (!IntersectBox(lo.x, lo.y, hi.x, hi.y, line->a.x, line->a.y, line->b.x, line->b.y))
+            {
+                continue;
+            }
+            renderaaline(fb, ToScreenX(line->a.x), ToScreenY(line->a.y), ToScreenX(line->b.x), ToScreenY(line->b.y),
+                         line->neighbor < 0 ? orang_yellow : pers_green);
+        }
+    }
+
+    // The player: a short line in the direction they are facing.
+    float px = ToScreenX(player.where.x), py = ToScreenY(player.where.y);
+    renderaaline(fb, px, py, px + player.anglecos * 2 * cam->zoom, py - player.anglesin * 2 * cam->zoom, burnt_sen);
+    renderaaline(fb, px - 2, py, px + 2, py, burnt_sen);
+    #undef ToScreenX
+    #undef ToScreenY
+}
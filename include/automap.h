@@ -0,0 +1,31 @@
+#ifndef AUTOMAP
+#define AUTOMAP
+
+#include <SDL2/SDL.h>
+
+#include "framebuffer.h"
+#include "viewport.h"
+
+
+#define AutomapZoom 8 // Pixels per world unit when the automap follows the player
+
+extern SDL_bool showautomap;
+
+// Build the per sector line batches. Called once per map load.
+void BuildAutomap(void);
+
+void FreeAutomap(void);
+
+// Append the sectors the renderer has visited since the last update.
+void updateautomap(void);
+
+// Mark every sector visited, so the whole map shows (used by the editor).
+void revealautomap(void);
+
+// Camera for the automap: centred on the player.
+Camera automapcamera(void);
+
+// Draw the visited sectors into fb, seen from above.
+void drawautomap(const Framebuffer * fb, const Camera * cam);
+
+#endif
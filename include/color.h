@@ -1,15 +1,17 @@
+
+
 #ifndef COLOR
 #define COLOR
 
 #include <SDL2/SDL.h>
 
 
-SDL_Color charcoal = {20, 33, 61, 255};
-SDL_Color pers_green = {42, 157, 143, 255};
-SDL_Color orang_yellow = {233, 196, 106, 255};
-SDL_Color sandy_brown = {244, 162, 97, 255};
-SDL_Color burnt_sen = {231, 111, 81, 255};
-SDL_Color ceil_color = {203, 153, 126, 255};
-SDL_Color floor_color = {183, 183, 164, 255};
+extern SDL_Color charcoal;
+extern SDL_Color pers_green;
+extern SDL_Color orang_yellow;
+extern SDL_Color sandy_brown;
+extern SDL_Color burnt_sen;
+extern SDL_Color ceil_color;
+extern SDL_Color floor_color;
 
 #endif
@@ -4,8 +4,10 @@
 // Screen dimension constants
 #define ScreenWidth 640
 #define ScreenHeight 480
-#define hfov (0.73f*ScreenHeight)  // Affects the horizontal field of vision
-#define vfov (.2f*ScreenHeight)    // Affects the vertical field of vision
+#define HFovScale 0.73f            // Horizontal field of vision per pixel of view height
+#define VFovScale .2f              // Vertical field of vision per pixel of view height
+#define hfov (HFovScale*ScreenHeight)  // Affects the horizontal field of vision
+#define vfov (VFovScale*ScreenHeight)    // Affects the vertical field of vision
 
 // Player attributes
 #define EyeHeight  6    // Camera height from floor when standing
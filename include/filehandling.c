@@ -1,13 +1,19 @@
 #include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <math.h>
 
+#include "filehandling.h"
+#include "animation.h"
+#include "automap.h"
+#include "navigation.h"
+#include "raycast.h"
 #include "geometry.h"
+#include "mapcheck.h"
+#include "material.h"
 #include "player.h"
 #include "constants.h"
 
 
-static SDL_Surface * images[256];
-static int nimages = 0;
-
 SDL_Color getpixel(SDL_Surface *surface, int x, int y)
 {
     int bpp = surface->format->BytesPerPixel;
@@ -41,12 +47,12 @@ SDL_Color getpixel(SDL_Surface *surface, int x, int y)
 }
 
 
-static void LoadData()
+void LoadData(const char * mapname)
 {
-    FILE * fp = fopen(MapName, "rt");
+    FILE * fp = fopen(mapname, "rt");
     if (!fp)
     {
-        perror(MapName);
+        perror(mapname);
         exit(1);
     }
     
@@ -56,6 +62,8 @@ static void LoadData()
     XY * vert = NULL;
     XY v;
     int n, m, NumVertices = 0;
+    // Both arrays double as they fill, so big maps load in linear time.
+    unsigned vertcapacity = 0, sectcapacity = 0;
     
     // Read a line the size of buffer and store it.
     while(fgets(Buf, sizeof Buf, fp))
@@ -87,13 +95,25 @@ static void LoadData()
                 //       n = remaining length
                 for (sscanf(ptr += n, "%f%n", &v.y, &n); sscanf(ptr += n, "%f%n", &v.x, &n) == 1;)
                 {
-                    NumVertices++;
-                    vert = realloc(vert, NumVertices * sizeof(*vert));
+                    if (++NumVertices > (int)vertcapacity)
+                    {
+                        vertcapacity = vertcapacity ? vertcapacity * 2 : 256;
+                        vert = realloc(vert, vertcapacity * sizeof(*vert));
+                    }
                     vert[NumVertices - 1] = v;
                 }
                 break;
-            case 's': // Sector
-                sectors = realloc(sectors, ++NumSectors * sizeof(*sectors));
+            case 's': // Sector, sky
+                if (strcmp(word, "sky") == 0)
+                {
+                    LoadMaterial(word, ptr + n);
+                    break;
+                }
+                if (++NumSectors > sectcapacity)
+                {
+                    sectcapacity = sectcapacity ? sectcapacity * 2 : 64;
+                    sectors = realloc(sectors, sectcapacity * sizeof(*sectors));
+                }
                 
                 // Assign to local pointer so its easier to access
                 Sector * sect = &sectors[NumSectors-1];
@@ -106,6 +126,7 @@ static void LoadData()
                 // v v
                 // 0 20     3 14 29 49             -1 1 11 22
                 sscanf(ptr += n, "%f%f%n", &sect->floor, &sect->ceil, &n);
+                sect->light = 1;
                 
                 // For each remianing word in the string.
                 // We want to make sure the word doesn't start with a '#' or we want to
@@ -151,8 +172,23 @@ static void LoadData()
                     sect->vertex[n+1]  = vert[num[n]]; // TODO: Range checking
                 }
                 sect->vertex[0] = sect->vertex[m]; // Ensure the vertexes form a loop
+                sect->surfaces = calloc(m, sizeof(*sect->surfaces)); // Texture 0 unless a wall line says otherwise
+                sect->floortexture = sect->ceiltexture = -1;
+                sect->sky = 0;
                 free(num);
                 break;
+            case 'd': // door
+            case 'f': // flicker
+            case 'l': // light, lift
+                // Sector animations, see animation.h
+                LoadAnimation(word, ptr + n);
+                break;
+            case 'm': // material
+            case 't': // texture
+            case 'w': // wall
+                // Textures and where they go, see material.h
+                LoadMaterial(word, ptr + n);
+                break;
             case 'p':; // player
                 float angle;
                 // Only one line for player. Grab the x and y pos, the angle player is facing and sector
@@ -171,16 +207,35 @@ static void LoadData()
         }
     }
     fclose(fp);
-    
-    
-    IMG_Init(IMG_INIT_PNG);
-    SDL_Surface * img_test;
-    images[0] = IMG_Load("resources/stonetiles_003_diff.png");
-    nimages = 1;
-    
-    if(!images[0]) {
-        printf("IMG_Load: %s\n", IMG_GetError());
-        // handle error
-    }
+    CheckMap();
+    BuildGeometry();
+    BuildAutomap();
+    BuildNavigation();
+    BuildAtlas();
     free(vert);
 }
+
+void UnloadData(void)
+{
+    // Clear the geometry
+    for (unsigned i = 0; i < NumSectors; i++)
+    {
+        free(sectors[i].vertex);
+    }
+    for (unsigned i=0; i < NumSectors; i++) {
+        free(sectors[i].neighbors);
+        free(sectors[i].surfaces);
+    }
+    free(sectors);
+    sectors = NULL;
+    FreeGeometry();
+    FreeMapCheck();
+    FreeAutomap();
+    FreeNavigation();
+    FreeAnimation();
+    setrayentities(NULL, 0);
+    
+    // Clear the texture memory
+    NumSectors = 0;
+    FreeMaterials();
+}
@@ -1,8 +1,11 @@
 #ifndef FILEHANDLING
 #define FILEHANDLING
 
-#include "filehandling.c"
+#include <SDL2/SDL.h>
 
-static void LoadData();
+
+void LoadData(const char * mapname);
+
+void UnloadData(void);
 
 #endif
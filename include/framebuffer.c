@@ -0,0 +1,28 @@
+#include <SDL2/SDL.h>
+
+#include "framebuffer.h"
+#include "mathlib.h"
+
+
+Framebuffer subframe(const Framebuffer * fb, int x, int y, int width, int height)
+{
+    // Clip the rectangle to the parent so callers never write outside it.
+    x = clamp(x, 0, fb->width);
+    y = clamp(y, 0, fb->height);
+    width = clamp(width, 0, fb->width - x);
+    height = clamp(height, 0, fb->height - y);
+    return (Framebuffer) {fb->pixels + y * fb->pitch + x, width, height, fb->pitch};
+}
+
+void clearframe(const Framebuffer * fb, SDL_Color color)
+{
+    Uint32 pixel = PackColor(color);
+    for (int y = 0; y < fb->height; y++)
+    {
+        Uint32 * row = fb->pixels + y * fb->pitch;
+        for (int x = 0; x < fb->width; x++)
+        {
+            row[x] = pixel;
+        }
+    }
+}
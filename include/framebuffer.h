@@ -0,0 +1,22 @@
+#ifndef FRAMEBUFFER
+#define FRAMEBUFFER
+
+#include <SDL2/SDL.h>
+
+
+// ARGB8888 pixels. pitch is in pixels so a sub-rectangle of a larger
+// framebuffer is just an offset pointer with a smaller width and height.
+typedef struct framebuffer
+{
+    Uint32 * pixels;
+    int width, height, pitch;
+} Framebuffer;
+
+// PackColor: Convert an SDL_Color into an opaque ARGB8888 pixel.
+#define PackColor(c) (0xff000000u | ((Uint32)(c).r << 16) | ((Uint32)(c).g << 8) | (Uint32)(c).b)
+
+Framebuffer subframe(const Framebuffer * fb, int x, int y, int width, int height);
+
+void clearframe(const Framebuffer * fb, SDL_Color color);
+
+#endif
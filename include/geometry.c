@@ -0,0 +1,168 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geometry.h"
+#include "mathlib.h"
+
+
+Sector * sectors = NULL;
+unsigned NumSectors = 0;
+
+Wall * walls = NULL;
+unsigned NumWalls = 0;
+XYZ MapMin = {0, 0, 0};
+XYZ MapMax = {0, 0, 0};
+
+unsigned char * SectorDirty = NULL;
+unsigned * DirtySectors = NULL;
+unsigned NumDirty = 0;
+SectorState * LoadedSectors = NULL;
+unsigned char * SectorChanged = NULL;
+unsigned * ChangedSectors = NULL;
+unsigned NumChanged = 0;
+unsigned MapFingerprint = 0;
+static unsigned * firstwall = NULL; // walls[firstwall[n]] is the first wall of sector n
+
+unsigned char * SectorVisited = NULL;
+unsigned * VisitOrder = NULL;
+unsigned NumVisited = 0;
+static SDL_SpinLock visitlock = 0;
+
+// FNV-1a a word at a time.
+static unsigned hashword(unsigned hash, unsigned word)
+{
+    return (hash ^ word) * 16777619u;
+}
+
+static unsigned hashfloat(unsigned hash, float f)
+{
+    unsigned bits;
+    memcpy(&bits, &f, sizeof bits);
+    return hashword(hash, bits);
+}
+
+void BuildGeometry(void)
+{
+    FreeGeometry();
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        NumWalls += sectors[n].npoints;
+    }
+    walls = malloc(NumWalls * sizeof(*walls));
+    firstwall = malloc(NumSectors * sizeof(*firstwall));
+    SectorDirty = calloc(NumSectors, sizeof(*SectorDirty));
+    DirtySectors = malloc(NumSectors * sizeof(*DirtySectors));
+    SectorVisited = calloc(NumSectors, sizeof(*SectorVisited));
+    VisitOrder = malloc(NumSectors * sizeof(*VisitOrder));
+    LoadedSectors = malloc(NumSectors * sizeof(*LoadedSectors));
+    SectorChanged = calloc(NumSectors, sizeof(*SectorChanged));
+    ChangedSectors = malloc(NumSectors * sizeof(*ChangedSectors));
+    MapFingerprint = hashword(2166136261u, NumSectors);
+
+    MapMin = (XYZ) {9e9f, 9e9f, 9e9f};
+    MapMax = (XYZ) {-9e9f, -9e9f, -9e9f};
+    Wall * wall = walls;
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        const Sector * sect = &sectors[n];
+        firstwall[n] = (unsigned)(wall - walls);
+        LoadedSectors[n] = (SectorState) {sect->floor, sect->ceil, sect->light};
+        MapFingerprint = hashword(hashfloat(hashfloat(hashfloat(MapFingerprint, sect->floor), sect->ceil), sect->light), sect->npoints);
+        for (unsigned s = 0; s < sect->npoints; s++, wall++)
+        {
+            *wall = (Wall) {sect->vertex[s], sect->vertex[s+1], sect->floor, sect->ceil, n, sect->neighbors[s]};
+            MapFingerprint = hashword(hashfloat(hashfloat(MapFingerprint, sect->vertex[s].x), sect->vertex[s].y), (unsigned)sect->neighbors[s]);
+            MapMin.x = min(MapMin.x, sect->vertex[s].x);
+            MapMin.y = min(MapMin.y, sect->vertex[s].y);
+            MapMax.x = max(MapMax.x, sect->vertex[s].x);
+            MapMax.y = max(MapMax.y, sect->vertex[s].y);
+        }
+        MapMin.z = min(MapMin.z, sect->floor);
+        MapMax.z = max(MapMax.z, sect->ceil);
+    }
+}
+
+void FreeGeometry(void)
+{
+    free(walls);
+    walls = NULL;
+    NumWalls = 0;
+    free(firstwall);
+    free(SectorDirty);
+    free(DirtySectors);
+    firstwall = NULL;
+    SectorDirty = NULL;
+    DirtySectors = NULL;
+    NumDirty = 0;
+    free(SectorVisited);
+    free(VisitOrder);
+    SectorVisited = NULL;
+    VisitOrder = NULL;
+    NumVisited = 0;
+    free(LoadedSectors);
+    free(SectorChanged);
+    free(ChangedSectors);
+    LoadedSectors = NULL;
+    SectorChanged = NULL;
+    ChangedSectors = NULL;
+    NumChanged = 0;
+}
+
+void MarkDirty(unsigned sector, unsigned char what)
+{
+    if (!SectorDirty[sector])
+    {
+        DirtySectors[NumDirty++] = sector;
+    }
+    SectorDirty[sector] |= what;
+    if (!SectorChanged[sector])
+    {
+        SectorChanged[sector] = 1;
+        ChangedSectors[NumChanged++] = sector;
+    }
+}
+
+void ClearDirty(void)
+{
+    for (unsigned i = 0; i < NumDirty; i++)
+    {
+        SectorDirty[DirtySectors[i]] = 0;
+    }
+    NumDirty = 0;
+}
+
+void RefreshGeometry(void)
+{
+    for (unsigned i = 0; i < NumDirty; i++)
+    {
+        unsigned n = DirtySectors[i];
+        const Sector * sect = &sectors[n];
+        if (!(SectorDirty[n] & (DirtyFloor | DirtyCeil)))
+        {
+            continue;
+        }
+        for (unsigned w = firstwall[n]; w < firstwall[n] + sect->npoints; w++)
+        {
+            walls[w].floor = sect->floor;
+            walls[w].ceil = sect->ceil;
+        }
+        // The bounds only grow, so views fitted to them don't jump around as things move.
+        MapMin.z = min(MapMin.z, sect->floor);
+        MapMax.z = max(MapMax.z, sect->ceil);
+    }
+}
+
+void MarkVisited(const unsigned * list, unsigned count)
+{
+    SDL_AtomicLock(&visitlock);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!SectorVisited[list[i]])
+        {
+            SectorVisited[list[i]] = 1;
+            VisitOrder[NumVisited++] = list[i];
+        }
+    }
+    SDL_AtomicUnlock(&visitlock);
+}
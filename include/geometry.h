@@ -15,15 +15,87 @@ typedef struct xyz {
     float x, y, z;
 } XYZ;
 
+// How a wall is textured: which material, shifted by u and v texels.
+typedef struct surface
+{
+    unsigned texture;
+    int u, v;
+} Surface;
+
 typedef struct sector
 {
     float floor, ceil;
+    float light; // Brightness from 0 (black) to 1 (unlit texture colours)
     struct xy * vertex;
-    signed char *neighbors; // Neighbor sectors
+    int *neighbors; // Neighbor sectors
+    Surface * surfaces; // One per edge
+    int floortexture, ceiltexture; // Materials for the flats, -1 for the plain colours
+    int sky; // The ceiling is open to the sky
     unsigned npoints; // Num of verticies
 } Sector;
 
-static Sector * sectors = NULL;
-static unsigned NumSectors = 0;
+// Flattened copy of every sector edge, built once per map load so views that
+// don't need the portal traversal can walk the geometry in one linear pass.
+typedef struct wall
+{
+    XY a, b;
+    float floor, ceil;
+    int sector, neighbor;
+} Wall;
+
+extern Sector * sectors;
+extern unsigned NumSectors;
+
+extern Wall * walls;
+extern unsigned NumWalls;
+extern XYZ MapMin, MapMax; // Bounding box of the whole map, z from lowest floor to highest ceiling
+
+// Sectors the renderer has drawn since the map was loaded, in the order they were first seen.
+// The order only ever grows, so readers can remember how far they got.
+extern unsigned char * SectorVisited;
+extern unsigned * VisitOrder;
+extern unsigned NumVisited;
+
+// What changed about a sector during the last animatesectors pass.
+#define DirtyFloor 0x01
+#define DirtyCeil  0x02
+#define DirtyLight 0x04
+
+// Sectors changed since ClearDirty, so caches derived from them can be
+// patched instead of rebuilt. DirtySectors lists each one once.
+extern unsigned char * SectorDirty;
+extern unsigned * DirtySectors;
+extern unsigned NumDirty;
+
+// The parts of a sector the simulation changes.
+typedef struct sectorstate
+{
+    float floor, ceil, light;
+} SectorState;
+
+// Every sector as the map was loaded, and the sectors marked dirty at any
+// time since, each listed once. Save states only copy those.
+extern SectorState * LoadedSectors;
+extern unsigned char * SectorChanged;
+extern unsigned * ChangedSectors;
+extern unsigned NumChanged;
+
+// Hash of the map as loaded: its outlines, portals, heights and lights.
+extern unsigned MapFingerprint;
+
+void BuildGeometry(void);
+
+void FreeGeometry(void);
+
+// Flag what changed about a sector. Only the simulation thread calls this.
+void MarkDirty(unsigned sector, unsigned char what);
+
+void ClearDirty(void);
+
+// Bring the wall list and map bounds up to date with the dirty sectors.
+void RefreshGeometry(void);
+
+// Add sectors to the visited set. Views drawing in parallel may call this at the same time.
+void MarkVisited(const unsigned * list, unsigned count);
 
 #endif
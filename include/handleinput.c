@@ -1,10 +1,28 @@
 #include <SDL2/SDL.h>
 
-#include "player.h"
+#include "handleinput.h"
 
 
-static int * handleinput(SDL_Event * event, SDL_bool * done, int * wasd)
+unsigned char gamekeys = 0;
+
+
+// Set or clear a held button on key down and up.
+static void holdbutton(InputFrame * input, unsigned char button, const SDL_Event * event)
+{
+    if (event->type==SDL_KEYDOWN)
+    {
+        input->buttons |= button;
+    }
+    else
+    {
+        input->buttons &= ~button;
+    }
+}
+
+void handleinput(SDL_Event * event, SDL_bool * done, InputFrame * input)
 {
+    input->buttons &= InputW | InputS | InputA | InputD | InputDuck;
+    gamekeys &= KeyRewind;
     while (SDL_PollEvent(event))
     {
         switch(event->type)
@@ -14,38 +32,52 @@ static int * handleinput(SDL_Event * event, SDL_bool * done, int * wasd)
                 switch(event->key.keysym.sym)
                 {
                     case 'w':
-                        wasd[0] = event->type==SDL_KEYDOWN;
+                        holdbutton(input, InputW, event);
                         break;
                     case 's':
-                        wasd[1] = event->type==SDL_KEYDOWN;
+                        holdbutton(input, InputS, event);
                         break;
                     case 'a':
-                        wasd[2] = event->type==SDL_KEYDOWN;
+                        holdbutton(input, InputA, event);
                         break;
                     case 'd':
-                        wasd[3] = event->type==SDL_KEYDOWN;
+                        holdbutton(input, InputD, event);
                         break;
                     case 'q':
+                        input->buttons |= InputQuit;
                         *done = SDL_TRUE;
                         break;
-                    case ' ': /* jump */
-                        if (player.state.ground)
+                    case SDLK_TAB: /* automap */
+                        if (event->type==SDL_KEYDOWN)
                         {
-                            player.velocity.z += 0.5; player.state.falling = 1;
+                            input->buttons |= InputAutomap;
                         }
                         break;
+                    case ' ': /* jump */
+                        input->buttons |= InputJump;
+                        break;
                     case SDLK_LCTRL: /* duck */
                     case SDLK_RCTRL:
-                        player.state.ducking = event->type==SDL_KEYDOWN; player.state.falling=1;
+                        holdbutton(input, InputDuck, event);
+                        break;
+                    case SDLK_F5:
+                        gamekeys |= event->type == SDL_KEYDOWN ? KeyQuickSave : 0;
+                        break;
+                    case SDLK_F9:
+                        gamekeys |= event->type == SDL_KEYDOWN ? KeyQuickLoad : 0;
+                        break;
+                    case SDLK_BACKSPACE:
+                        gamekeys = event->type == SDL_KEYDOWN ? gamekeys | KeyRewind : gamekeys & ~KeyRewind;
                         break;
                     default: break;
                 }
                 break;
             case SDL_QUIT:
+                input->buttons |= InputQuit;
                 *done = SDL_TRUE;
                 break;
         }
     }
-    return wasd;
+    SDL_GetRelativeMouseState(&input->mousex, &input->mousey);
+    input->time = SDL_GetTicks();
 }
-
@@ -1,10 +1,27 @@
 #ifndef HANDLEINPUT
 #define HANDLEINPUT
 
-#include "handleinput.c"
-#include "entity.h"
+#include <SDL2/SDL.h>
 
+#include "inputlog.h"
 
-static int * handleinput(SDL_Event * event, SDL_bool * done, int * wasd);
+
+// Keys for the game rather than the simulation, set by handleinput: F5
+// quick-saves and F9 quick-loads on the tick they are pressed, and
+// Backspace rewinds while held. They are not part of InputFrame, so input
+// logs never see them.
+#define KeyQuickSave 0x01
+#define KeyQuickLoad 0x02
+#define KeyRewind    0x04
+
+extern unsigned char gamekeys;
+
+/**
+ * handleinput: Poll SDL for this tick's input. Held keys carry over in
+ * input->buttons from the previous call; presses and the mouse are
+ * sampled fresh. Nothing here touches the player, so the frame can be
+ * recorded and replayed through handlemovement.
+ */
+void handleinput(SDL_Event * event, SDL_bool * done, InputFrame * input);
 
 #endif
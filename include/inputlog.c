@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "inputlog.h"
+#include "geometry.h"
+#include "player.h"
+
+
+// Log layout: the magic and version, the map name, the starting player, then
+// one record per tick and LogEnd. A record is a flags byte followed by only
+// the fields that changed since the previous tick: the buttons byte, the mouse
+// motion and the change in tick duration as zigzag varints, and every
+// InputChecksumInterval ticks a checksum of the player. Runs of ticks that
+// change nothing collapse into LogRun and a count.
+#define LogMagic "U3DI"
+#define LogVersion 1
+
+#define LogButtons  0x01
+#define LogMouseX   0x02
+#define LogMouseY   0x04
+#define LogTime     0x08
+#define LogChecksum 0x10
+#define LogRun      0x40
+#define LogEnd      0xff
+
+struct inputlog
+{
+    FILE * fp;
+    char mapname[256];
+    unsigned char start[PlayerBytes]; // Player when the recording began
+    unsigned ticks;
+    unsigned char buttons; // Previous tick's buttons
+    unsigned time, delta;  // Previous tick's time and its duration
+    unsigned run;          // Recording: unchanged ticks not written yet. Replay: unchanged ticks left
+    int checking;          // Replay: the current tick carries a checksum
+    unsigned checksum;
+};
+
+static void putword(unsigned char * out, unsigned value)
+{
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+}
+
+static unsigned getword(const unsigned char * in)
+{
+    return in[0] | (unsigned)in[1] << 8 | (unsigned)in[2] << 16 | (unsigned)in[3] << 24;
+}
+
+static unsigned floatbits(float f)
+{
+    unsigned bits;
+    memcpy(&bits, &f, sizeof bits);
+    return bits;
+}
+
+static float bitsfloat(unsigned bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+void packplayer(const Player * from, unsigned char * out)
+{
+    const float f[] = {from->where.x, from->where.y, from->where.z,
+                       from->velocity.x, from->velocity.y, from->velocity.z,
+                       from->angle, from->anglesin, from->anglecos, from->yaw};
+    const unsigned u[] = {from->sector, from->state.ducking, from->state.falling, from->state.ground, from->state.moving};
+    unsigned n = 0;
+    for (unsigned i = 0; i < sizeof f / sizeof *f; i++, n += 4)
+    {
+        putword(out + n, floatbits(f[i]));
+    }
+    for (unsigned i = 0; i < sizeof u / sizeof *u; i++, n += 4)
+    {
+        putword(out + n, u[i]);
+    }
+}
+
+void unpackplayer(const unsigned char * in, Player * into)
+{
+    float * f[] = {&into->where.x, &into->where.y, &into->where.z,
+                   &into->velocity.x, &into->velocity.y, &into->velocity.z,
+                   &into->angle, &into->anglesin, &into->anglecos, &into->yaw};
+    unsigned * u[] = {&into->sector, &into->state.ducking, &into->state.falling, &into->state.ground, &into->state.moving};
+    unsigned n = 0;
+    for (unsigned i = 0; i < sizeof f / sizeof *f; i++, n += 4)
+    {
+        *f[i] = bitsfloat(getword(in + n));
+    }
+    for (unsigned i = 0; i < sizeof u / sizeof *u; i++, n += 4)
+    {
+        *u[i] = getword(in + n);
+    }
+}
+
+int checkplayer(const unsigned char * in)
+{
+    // Ten floats, then the sector.
+    for (unsigned n = 0; n < 40; n += 4)
+    {
+        if (!isfinite(bitsfloat(getword(in + n))))
+        {
+            return 0;
+        }
+    }
+    return getword(in + 40) < NumSectors;
+}
+
+// FNV-1a over the packed player.
+static unsigned playerchecksum(void)
+{
+    unsigned char bytes[PlayerBytes];
+    packplayer(&player, bytes);
+    unsigned hash = 2166136261u;
+    for (unsigned i = 0; i < PlayerBytes; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void putvarint(FILE * fp, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        fputc((int)(value & 0x7f) | 0x80, fp);
+        value >>= 7;
+    }
+    fputc((int)value, fp);
+}
+
+static unsigned getvarint(FILE * fp)
+{
+    unsigned value = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7)
+    {
+        int c = fgetc(fp);
+        if (c == EOF)
+        {
+            break;
+        }
+        value |= (unsigned)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+// Zigzag folds small negative numbers into small unsigned ones: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ...
+static void putsigned(FILE * fp, int value)
+{
+    putvarint(fp, ((unsigned)value << 1) ^ (unsigned)(value >> 31));
+}
+
+static int getsigned(FILE * fp)
+{
+    unsigned value = getvarint(fp);
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static void flushrun(InputLog * log)
+{
+    if (log->run == 1)
+    {
+        fputc(0, log->fp);
+    }
+    else if (log->run > 1)
+    {
+        fputc(LogRun, log->fp);
+        putvarint(log->fp, log->run);
+    }
+    log->run = 0;
+}
+
+InputLog * startrecording(const char * path, const char * mapname)
+{
+    FILE * fp = fopen(path, "wb");
+    if (!fp)
+    {
+        perror(path);
+        return NULL;
+    }
+    InputLog * log = calloc(1, sizeof(*log));
+    log->fp = fp;
+    snprintf(log->mapname, sizeof log->mapname, "%s", mapname);
+    packplayer(&player, log->start);
+
+    size_t namelength = strlen(log->mapname);
+    fwrite(LogMagic, 1, 4, fp);
+    fputc(LogVersion, fp);
+    fputc((int)namelength, fp);
+    fwrite(log->mapname, 1, namelength, fp);
+    fwrite(log->start, 1, PlayerBytes, fp);
+    return log;
+}
+
+void recordinput(InputLog * log, const InputFrame * input)
+{
+    unsigned delta = input->time - log->time;
+    unsigned char flags = 0;
+    flags |= input->buttons != log->buttons ? LogButtons : 0;
+    flags |= input->mousex ? LogMouseX : 0;
+    flags |= input->mousey ? LogMouseY : 0;
+    flags |= delta != log->delta ? LogTime : 0;
+    flags |= log->ticks % InputChecksumInterval == InputChecksumInterval - 1 ? LogChecksum : 0;
+    log->ticks++;
+    log->time = input->time;
+    if (flags == 0)
+    {
+        log->run++;
+        return;
+    }
+
+    flushrun(log);
+    fputc(flags, log->fp);
+    if (flags & LogButtons)
+    {
+        fputc(input->buttons, log->fp);
+    }
+    if (flags & LogMouseX)
+    {
+        putsigned(log->fp, input->mousex);
+    }
+    if (flags & LogMouseY)
+    {
+        putsigned(log->fp, input->mousey);
+    }
+    if (flags & LogTime)
+    {
+        putsigned(log->fp, (int)(delta - log->delta));
+    }
+    if (flags & LogChecksum)
+    {
+        unsigned char word[4];
+        putword(word, playerchecksum());
+        fwrite(word, 1, 4, log->fp);
+    }
+    log->buttons = input->buttons;
+    log->delta = delta;
+}
+
+void stoprecording(InputLog * log)
+{
+    if (!log)
+    {
+        return;
+    }
+    flushrun(log);
+    fputc(LogEnd, log->fp);
+    fclose(log->fp);
+    free(log);
+}
+
+InputLog * startreplay(const char * path)
+{
+    FILE * fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return NULL;
+    }
+    char magic[4];
+    int namelength = -1;
+    InputLog * log = calloc(1, sizeof(*log));
+    if (fread(magic, 1, 4, fp) == 4 && memcmp(magic, LogMagic, 4) == 0 && fgetc(fp) == LogVersion)
+    {
+        namelength = fgetc(fp);
+    }
+    if (namelength < 0
+        || fread(log->mapname, 1, (size_t)namelength, fp) != (size_t)namelength
+        || fread(log->start, 1, PlayerBytes, fp) != PlayerBytes)
+    {
+        printf("%s: not an input log\n", path);
+        fclose(fp);
+        free(log);
+        return NULL;
+    }
+    log->fp = fp;
+    return log;
+}
+
+const char * replaymap(const InputLog * log)
+{
+    return log->mapname;
+}
+
+int replayinput(InputLog * log, InputFrame * input)
+{
+    if (log->ticks == 0)
+    {
+        if (!checkplayer(log->start))
+        {
+            printf("Replay starts outside %s\n", log->mapname);
+            return 0;
+        }
+        unpackplayer(log->start, &player);
+    }
+    int flags = 0;
+    if (log->run > 0)
+    {
+        log->run--;
+    }
+    else
+    {
+        flags = fgetc(log->fp);
+        if (flags == EOF || flags == LogEnd)
+        {
+            return 0;
+        }
+        if (flags == LogRun)
+        {
+            log->run = getvarint(log->fp) - 1;
+            flags = 0;
+        }
+    }
+
+    input->buttons = flags & LogButtons ? (unsigned char)fgetc(log->fp) : log->buttons;
+    input->mousex = flags & LogMouseX ? getsigned(log->fp) : 0;
+    input->mousey = flags & LogMouseY ? getsigned(log->fp) : 0;
+    log->delta += flags & LogTime ? (unsigned)getsigned(log->fp) : 0;
+    log->checking = (flags & LogChecksum) != 0;
+    if (log->checking)
+    {
+        unsigned char word[4] = {0};
+        if (fread(word, 1, 4, log->fp) != 4)
+        {
+            return 0;
+        }
+        log->checksum = getword(word);
+    }
+    log->time += log->delta;
+    input->time = log->time;
+    log->buttons = input->buttons;
+    log->ticks++;
+    return 1;
+}
+
+int checkreplay(InputLog * log)
+{
+    return !log->checking || playerchecksum() == log->checksum;
+}
+
+unsigned inputticks(const InputLog * log)
+{
+    return log->ticks;
+}
+
+void stopreplay(InputLog * log)
+{
+    if (log)
+    {
+        fclose(log->fp);
+        free(log);
+    }
+}
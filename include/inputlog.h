@@ -0,0 +1,74 @@
+#ifndef INPUTLOG
+#define INPUTLOG
+
+#include "player.h"
+
+
+// Buttons in InputFrame.buttons. W, S, A, D and Duck are held down; Jump,
+// Automap and Quit are set only on the tick the key was pressed.
+#define InputW       0x01
+#define InputS       0x02
+#define InputA       0x04
+#define InputD       0x08
+#define InputDuck    0x10
+#define InputJump    0x20
+#define InputAutomap 0x40
+#define InputQuit    0x80
+
+#define InputChecksumInterval 64 // Ticks between player state checksums in a log
+#define PlayerBytes (15 * 4)     // A packed player: ten floats and five unsigned words
+
+// Everything the player did during one tick. The simulation only ever reads
+// input through this, so a session can be replayed from a log of frames.
+typedef struct inputframe
+{
+    unsigned time; // Milliseconds from any fixed starting point
+    unsigned char buttons;
+    int mousex, mousey; // Relative mouse motion
+} InputFrame;
+
+typedef struct inputlog InputLog;
+
+/**
+ * startrecording: Create a log at path for a session on mapname, starting
+ * from the player as it is now. Returns NULL when the file can't be written.
+ */
+InputLog * startrecording(const char * path, const char * mapname);
+
+// Append one tick. Call it after the tick was simulated, so the periodic
+// player checksum matches what replay will see.
+void recordinput(InputLog * log, const InputFrame * input);
+
+void stoprecording(InputLog * log);
+
+/**
+ * startreplay: Open a log written by startrecording. Returns NULL when the
+ * file is missing or not an input log. Load replaymap() before the first
+ * replayinput call; that call also puts the player back where the
+ * recording started.
+ */
+InputLog * startreplay(const char * path);
+
+const char * replaymap(const InputLog * log);
+
+// Read the next tick into input. Returns 0 at the end of the log.
+int replayinput(InputLog * log, InputFrame * input);
+
+// Call after simulating a replayed tick. Returns 0 when the player no
+// longer matches the checksum recorded at this tick.
+int checkreplay(InputLog * log);
+
+// Every field of a player, bit for bit, in a fixed byte order: PlayerBytes of them.
+void packplayer(const Player * from, unsigned char * out);
+void unpackplayer(const unsigned char * in, Player * into);
+
+// Whether a packed player stands in a sector of the loaded map with every
+// float finite, so it can be unpacked over a live one.
+int checkplayer(const unsigned char * in);
+
+// Ticks recorded or replayed so far.
+unsigned inputticks(const InputLog * log);
+
+void stopreplay(InputLog * log);
+
+#endif
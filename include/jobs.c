@@ -0,0 +1,162 @@
+#include <SDL2/SDL.h>
+
+#include "jobs.h"
+#include "mathlib.h"
+#include "telemetry.h"
+
+
+enum { MaxWorkers = 15 };
+
+static SDL_Thread * workers[MaxWorkers];
+static int nworkers = -1;
+
+static SDL_mutex * lock = NULL;
+static SDL_cond * wake = NULL;
+static SDL_cond * finished = NULL;
+
+// The batch being run. generation is bumped for every batch so a worker
+// can tell a new batch from a spurious wakeup, and busy counts the workers
+// that have not checked back in yet.
+static Job batchjob = NULL;
+static void * batchdata = NULL;
+static unsigned batchcount = 0;
+static unsigned generation = 0;
+static int busy = 0;
+static int quitting = 0;
+static SDL_atomic_t nextindex;
+static SDL_atomic_t running;
+
+static void drainbatch(Job job, void * data, unsigned count)
+{
+    for (;;)
+    {
+        unsigned index = (unsigned)SDL_AtomicAdd(&nextindex, 1);
+        if (index >= count)
+        {
+            break;
+        }
+        job(index, data);
+    }
+}
+
+static int workerloop(void * unused)
+{
+    (void)unused;
+    telemetrythread("worker");
+    unsigned seen = 0;
+    SDL_LockMutex(lock);
+    for (;;)
+    {
+        while (!quitting && generation == seen)
+        {
+            SDL_CondWait(wake, lock);
+        }
+        if (quitting)
+        {
+            break;
+        }
+        seen = generation;
+        Job job = batchjob;
+        void * data = batchdata;
+        unsigned count = batchcount;
+        SDL_UnlockMutex(lock);
+
+        Uint64 start = telemetrystart(TimeJobs);
+        drainbatch(job, data, count);
+        telemetrystop(TimeJobs, start);
+
+        SDL_LockMutex(lock);
+        if (--busy == 0)
+        {
+            SDL_CondSignal(finished);
+        }
+    }
+    SDL_UnlockMutex(lock);
+    return 0;
+}
+
+static void startworkers(void)
+{
+    nworkers = clamp(SDL_GetCPUCount() - 1, 0, MaxWorkers);
+    lock = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    finished = SDL_CreateCond();
+    for (int i = 0; i < nworkers; i++)
+    {
+        workers[i] = SDL_CreateThread(workerloop, "worker", NULL);
+        if (!workers[i])
+        {
+            nworkers = i;
+            break;
+        }
+    }
+}
+
+unsigned jobthreads(void)
+{
+    if (nworkers < 0)
+    {
+        startworkers();
+    }
+    return (unsigned)nworkers + 1;
+}
+
+void runjobs(unsigned count, Job job, void * data)
+{
+    if (nworkers < 0)
+    {
+        startworkers();
+    }
+
+    // Only one batch at a time. Anything else, including a job that starts
+    // its own batch, just runs on the calling thread.
+    if (count <= 1 || nworkers == 0 || !SDL_AtomicCAS(&running, 0, 1))
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            job(i, data);
+        }
+        return;
+    }
+
+    SDL_LockMutex(lock);
+    batchjob = job;
+    batchdata = data;
+    batchcount = count;
+    SDL_AtomicSet(&nextindex, 0);
+    busy = nworkers;
+    generation++;
+    SDL_CondBroadcast(wake);
+    SDL_UnlockMutex(lock);
+
+    drainbatch(job, data, count);
+
+    SDL_LockMutex(lock);
+    while (busy > 0)
+    {
+        SDL_CondWait(finished, lock);
+    }
+    SDL_UnlockMutex(lock);
+    SDL_AtomicSet(&running, 0);
+}
+
+void shutdownjobs(void)
+{
+    if (nworkers < 0)
+    {
+        return;
+    }
+    SDL_LockMutex(lock);
+    quitting = 1;
+    SDL_CondBroadcast(wake);
+    SDL_UnlockMutex(lock);
+    for (int i = 0; i < nworkers; i++)
+    {
+        SDL_WaitThread(workers[i], NULL);
+    }
+    SDL_DestroyCond(finished);
+    SDL_DestroyCond(wake);
+    SDL_DestroyMutex(lock);
+    nworkers = -1;
+    quitting = 0;
+}
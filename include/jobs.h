@@ -0,0 +1,20 @@
+#ifndef JOBS
+#define JOBS
+
+
+// A job is called once for every index in [0, count).
+typedef void (*Job)(unsigned index, void * data);
+
+/**
+ * runjobs: Run job(0..count-1) spread across the worker threads and the calling
+ * thread, returning once every index has finished. The workers are started on
+ * first use. Nested or concurrent calls fall back to running serially.
+ */
+void runjobs(unsigned count, Job job, void * data);
+
+// Number of threads runjobs spreads work over, including the caller.
+unsigned jobthreads(void);
+
+void shutdownjobs(void);
+
+#endif
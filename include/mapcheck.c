@@ -0,0 +1,738 @@
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapcheck.h"
+#include "geometry.h"
+#include "jobs.h"
+#include "mathlib.h"
+#include "player.h"
+
+
+#define SectorsPerJob 256
+#define Bend 1e-5f // Corners turning right by less than this, relative to their edges, count as straight
+
+// What was wrong with a sector.
+enum
+{
+    Rewound = 0x01,
+    Cut = 0x02,
+    TooFew = 0x04,  // Under three points
+    NoArea = 0x08,
+    Crossing = 0x10 // Edges cross or touch, or the outline goes round more than once
+};
+
+// One sector's share of the check, filled in by whichever worker took it.
+typedef struct sectorcheck
+{
+    unsigned char problems;
+    unsigned numpieces;
+    Sector * pieces; // When cut: the first takes the sector's place, the others are added
+} SectorCheck;
+
+// A corner of an outline being cut up, and the edge leaving it: one of the
+// sector's own, or a cut, numbered -1 - edge.
+typedef struct corner
+{
+    unsigned point;
+    int edge;
+} Corner;
+
+// The pieces a sector is being cut into, one after another in corners.
+typedef struct cutting
+{
+    const XY * vertex;
+    Corner * corners;
+    unsigned numcorners, cornercapacity;
+    unsigned * start; // Piece i is corners start[i] to start[i + 1]
+    unsigned numpieces, piececapacity;
+    int cuts;
+} Cutting;
+
+// A directed edge in the table of every edge in the map.
+typedef struct edgeentry
+{
+    XY a, b;
+    unsigned sector, edge;
+} EdgeEntry;
+
+// Where each edge of the map ought to lead, as found by the workers, and
+// which edge of that sector it meets when that one is a wall.
+typedef struct portaljob
+{
+    const unsigned * firstedge;
+    int * wanted;
+    int * partner;
+} PortalJob;
+
+#define Keep -2      // A wall, unless the sector across has a portal here
+#define Unmatched -3 // A portal whose edge isn't in the sector it names
+
+static int * pieces = NULL; // The next piece of each sector, -1 for none
+static unsigned numlinked = 0;
+static MapReport report;
+
+static SectorCheck * checks = NULL;
+static EdgeEntry * table = NULL;
+static unsigned tablemask = 0;
+
+int nextpiece(unsigned sector)
+{
+    return pieces && sector < numlinked ? pieces[sector] : -1;
+}
+
+const MapReport * mapreport(void)
+{
+    return &report;
+}
+
+void FreeMapCheck(void)
+{
+    free(pieces);
+    pieces = NULL;
+    numlinked = 0;
+}
+
+// Twice the signed area of a b c: positive when c is left of the line from a to b.
+static float turn(XY a, XY b, XY c)
+{
+    return PointSide(c.x, c.y, a.x, a.y, b.x, b.y);
+}
+
+static int sign(float f)
+{
+    return (f > 0) - (f < 0);
+}
+
+// Whether the corner at b, coming from a and going on to c, turns right.
+static int reflex(XY a, XY b, XY c)
+{
+    float ux = b.x - a.x, uy = b.y - a.y, vx = c.x - b.x, vy = c.y - b.y;
+    return vxs(ux, uy, vx, vy) < -Bend * sqrtf((ux * ux + uy * uy) * (vx * vx + vy * vy));
+}
+
+// Whether c, on the line through a and b, lies on the segment between them.
+static int between(XY a, XY b, XY c)
+{
+    return min(a.x, b.x) <= c.x && c.x <= max(a.x, b.x) && min(a.y, b.y) <= c.y && c.y <= max(a.y, b.y);
+}
+
+// Whether segments ab and cd cross or touch.
+static int touching(XY a, XY b, XY c, XY d)
+{
+    int abc = sign(turn(a, b, c)), abd = sign(turn(a, b, d));
+    int cda = sign(turn(c, d, a)), cdb = sign(turn(c, d, b));
+    if (abc * abd < 0 && cda * cdb < 0)
+    {
+        return 1;
+    }
+    return (abc == 0 && between(a, b, c)) || (abd == 0 && between(a, b, d))
+        || (cda == 0 && between(c, d, a)) || (cdb == 0 && between(c, d, b));
+}
+
+// Turn a sector around. Edge k runs from vertex k to k + 1, so after
+// reversing the vertices edge k is the old edge m - 2 - k the other way.
+static void reverse(Sector * sect)
+{
+    unsigned m = sect->npoints;
+    for (unsigned i = 0; i < m / 2; i++)
+    {
+        XY v = sect->vertex[i];
+        sect->vertex[i] = sect->vertex[m - 1 - i];
+        sect->vertex[m - 1 - i] = v;
+    }
+    sect->vertex[m] = sect->vertex[0];
+    for (unsigned i = 0; i < m; i++)
+    {
+        unsigned j = (2 * m - 2 - i) % m;
+        if (i < j)
+        {
+            int n = sect->neighbors[i];
+            sect->neighbors[i] = sect->neighbors[j];
+            sect->neighbors[j] = n;
+            Surface surface = sect->surfaces[i];
+            sect->surfaces[i] = sect->surfaces[j];
+            sect->surfaces[j] = surface;
+        }
+    }
+}
+
+// No corner turns right, and the edges head left and then right only once
+// each, so the outline goes round just once.
+static int convex(const Sector * sect)
+{
+    const XY * v = sect->vertex;
+    unsigned m = sect->npoints, flips = 0;
+    int first = 0, last = 0;
+    for (unsigned k = 0; k < m; k++)
+    {
+        if (reflex(v[k ? k - 1 : m - 1], v[k], v[k + 1]))
+        {
+            return 0;
+        }
+        float dx = v[k + 1].x - v[k].x, dy = v[k + 1].y - v[k].y;
+        if (dx * dx <= Bend * Bend * (dx * dx + dy * dy))
+        {
+            continue;
+        }
+        int s = sign(dx);
+        flips += last && s != last;
+        first = first ? first : s;
+        last = s;
+    }
+    return flips + (first != last) <= 2;
+}
+
+// No two edges that aren't next to each other meet.
+static int simple(const Sector * sect)
+{
+    const XY * v = sect->vertex;
+    unsigned m = sect->npoints;
+    for (unsigned i = 0; i < m; i++)
+    {
+        for (unsigned j = i + 2; j < m; j++)
+        {
+            if (!(i == 0 && j == m - 1) && touching(v[i], v[i + 1], v[j], v[j + 1]))
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Whether the cut from corner i to corner j of an outline leaves i into the inside.
+static int incone(const XY * p, unsigned count, unsigned i, unsigned j)
+{
+    XY before = p[(i + count - 1) % count], after = p[(i + 1) % count];
+    if (turn(before, p[i], after) >= 0)
+    {
+        return turn(p[i], p[j], before) > 0 && turn(p[j], p[i], after) > 0;
+    }
+    return !(turn(p[i], p[j], after) >= 0 && turn(p[j], p[i], before) >= 0);
+}
+
+// Whether i to j runs inside the outline without touching any other corner or edge.
+static int diagonal(const XY * p, unsigned count, unsigned i, unsigned j)
+{
+    if (!incone(p, count, i, j) || !incone(p, count, j, i))
+    {
+        return 0;
+    }
+    for (unsigned k = 0; k < count; k++)
+    {
+        unsigned next = (k + 1) % count;
+        if (k != i && k != j && turn(p[i], p[j], p[k]) == 0 && between(p[i], p[j], p[k]))
+        {
+            return 0;
+        }
+        if (k != i && k != j && next != i && next != j && touching(p[i], p[j], p[k], p[next]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void addpiece(Cutting * cut, const Corner * outline, unsigned count)
+{
+    if (cut->numcorners + count > cut->cornercapacity)
+    {
+        cut->cornercapacity = (cut->numcorners + count) * 2;
+        cut->corners = realloc(cut->corners, sizeof(*cut->corners) * cut->cornercapacity);
+    }
+    if (cut->numpieces + 2 > cut->piececapacity)
+    {
+        cut->piececapacity = (cut->numpieces + 2) * 2;
+        cut->start = realloc(cut->start, sizeof(*cut->start) * cut->piececapacity);
+    }
+    memcpy(cut->corners + cut->numcorners, outline, sizeof(*outline) * count);
+    cut->start[cut->numpieces++] = cut->numcorners;
+    cut->numcorners += count;
+    cut->start[cut->numpieces] = cut->numcorners;
+}
+
+/**
+ * cutoutline: Cut an outline at a corner that turns right until no corner
+ * does. Each cut goes from such a corner to another one, preferring one that
+ * leaves both sides of that corner and then the other one convex, then the
+ * shortest. Every simple outline has a cut from each of its right turns, and
+ * each cut leaves two smaller outlines, so this always finishes.
+ */
+static void cutoutline(Cutting * cut, const Corner * outline, unsigned count)
+{
+    XY * p = malloc(sizeof(*p) * count);
+    for (unsigned k = 0; k < count; k++)
+    {
+        p[k] = cut->vertex[outline[k].point];
+    }
+    unsigned i = 0;
+    while (i < count && !reflex(p[(i + count - 1) % count], p[i], p[(i + 1) % count]))
+    {
+        i++;
+    }
+    int best = -1, bestscore = -1;
+    float bestlength = 0;
+    for (unsigned j = 0; i < count && j < count; j++)
+    {
+        if (j == i || j == (i + 1) % count || (j + 1) % count == i || !diagonal(p, count, i, j))
+        {
+            continue;
+        }
+        XY ibefore = p[(i + count - 1) % count], iafter = p[(i + 1) % count];
+        XY jbefore = p[(j + count - 1) % count], jafter = p[(j + 1) % count];
+        int score = 2 * (!reflex(ibefore, p[i], p[j]) && !reflex(p[j], p[i], iafter))
+                  + (!reflex(jbefore, p[j], p[i]) && !reflex(p[i], p[j], jafter));
+        float dx = p[j].x - p[i].x, dy = p[j].y - p[i].y, length = dx * dx + dy * dy;
+        if (score > bestscore || (score == bestscore && length < bestlength))
+        {
+            best = (int)j;
+            bestscore = score;
+            bestlength = length;
+        }
+    }
+    free(p);
+    if (best < 0)
+    {
+        addpiece(cut, outline, count);
+        return;
+    }
+
+    // One side runs from i round to j, the other from j round to i.
+    unsigned j = (unsigned)best, edge = (unsigned)cut->cuts++;
+    unsigned counta = (j + count - i) % count + 1, countb = (i + count - j) % count + 1;
+    Corner * side = malloc(sizeof(*side) * max(counta, countb));
+    for (unsigned k = 0; k < counta; k++)
+    {
+        side[k] = outline[(i + k) % count];
+    }
+    side[counta - 1].edge = -1 - (int)edge;
+    cutoutline(cut, side, counta);
+    for (unsigned k = 0; k < countb; k++)
+    {
+        side[k] = outline[(j + k) % count];
+    }
+    side[countb - 1].edge = -1 - (int)edge;
+    cutoutline(cut, side, countb);
+    free(side);
+}
+
+// Cut a sector into convex pieces. Their portals to each other hold -2 - the
+// piece across, until the pieces are numbered.
+static void cutsector(const Sector * sect, SectorCheck * check)
+{
+    Cutting cut = {sect->vertex, NULL, 0, 0, NULL, 0, 0, 0};
+    Corner * outline = malloc(sizeof(*outline) * sect->npoints);
+    for (unsigned k = 0; k < sect->npoints; k++)
+    {
+        outline[k] = (Corner) {k, (int)k};
+    }
+    cutoutline(&cut, outline, sect->npoints);
+    free(outline);
+
+    // Each cut is an edge of exactly two pieces.
+    int * across = malloc(sizeof(*across) * 2 * (unsigned)max(cut.cuts, 1));
+    for (int d = 0; d < 2 * cut.cuts; d++)
+    {
+        across[d] = -1;
+    }
+    for (unsigned piece = 0; piece < cut.numpieces; piece++)
+    {
+        for (unsigned k = cut.start[piece]; k < cut.start[piece + 1]; k++)
+        {
+            int d = cut.corners[k].edge;
+            if (d < 0)
+            {
+                across[2 * (-1 - d) + (across[2 * (-1 - d)] >= 0)] = (int)piece;
+            }
+        }
+    }
+
+    check->numpieces = cut.numpieces;
+    check->pieces = malloc(sizeof(*check->pieces) * cut.numpieces);
+    for (unsigned piece = 0; piece < cut.numpieces; piece++)
+    {
+        unsigned count = cut.start[piece + 1] - cut.start[piece];
+        const Corner * corner = cut.corners + cut.start[piece];
+        Sector * into = &check->pieces[piece];
+        *into = *sect;
+        into->npoints = count;
+        into->vertex = malloc(sizeof(*into->vertex) * (count + 1));
+        into->neighbors = malloc(sizeof(*into->neighbors) * count);
+        into->surfaces = malloc(sizeof(*into->surfaces) * count);
+        for (unsigned k = 0; k < count; k++)
+        {
+            into->vertex[k] = sect->vertex[corner[k].point];
+            int d = corner[k].edge;
+            if (d >= 0)
+            {
+                into->neighbors[k] = sect->neighbors[d];
+                into->surfaces[k] = sect->surfaces[d];
+            }
+            else
+            {
+                const int * pair = &across[2 * (-1 - d)];
+                into->neighbors[k] = -2 - (pair[0] == (int)piece ? pair[1] : pair[0]);
+                into->surfaces[k] = (Surface) {0, 0, 0};
+            }
+        }
+        into->vertex[count] = into->vertex[0];
+    }
+    free(across);
+    free(cut.corners);
+    free(cut.start);
+}
+
+static void checksector(unsigned s, SectorCheck * check)
+{
+    Sector * sect = &sectors[s];
+    *check = (SectorCheck) {0, 1, NULL};
+    if (sect->npoints < 3)
+    {
+        check->problems = TooFew;
+        return;
+    }
+    double area = 0;
+    for (unsigned k = 0; k < sect->npoints; k++)
+    {
+        area += vxs((double)sect->vertex[k].x, (double)sect->vertex[k].y, sect->vertex[k + 1].x, sect->vertex[k + 1].y);
+        sect->neighbors[k] = max(sect->neighbors[k], -1);
+    }
+    if (area == 0)
+    {
+        check->problems = NoArea;
+        return;
+    }
+    if (area < 0)
+    {
+        reverse(sect);
+        check->problems |= Rewound;
+    }
+    if (convex(sect))
+    {
+        return;
+    }
+    if (!simple(sect))
+    {
+        check->problems |= Crossing;
+        return;
+    }
+    cutsector(sect, check);
+    check->problems |= Cut;
+}
+
+static void checkchunk(unsigned index, void * data)
+{
+    (void)data;
+    unsigned last = min((index + 1) * SectorsPerJob, NumSectors);
+    for (unsigned s = index * SectorsPerJob; s < last; s++)
+    {
+        checksector(s, &checks[s]);
+    }
+}
+
+static unsigned mixfloat(unsigned hash, float f)
+{
+    unsigned bits;
+    f += 0.0f; // -0 and 0 alike
+    memcpy(&bits, &f, sizeof bits);
+    return (hash ^ bits) * 16777619u;
+}
+
+static unsigned edgeslot(XY a, XY b)
+{
+    return mixfloat(mixfloat(mixfloat(mixfloat(2166136261u, a.x), a.y), b.x), b.y) & tablemask;
+}
+
+// The entry for the edge from a to b, or NULL.
+static const EdgeEntry * findedge(XY a, XY b)
+{
+    for (unsigned slot = edgeslot(a, b); table[slot].sector != ~0u; slot = (slot + 1) & tablemask)
+    {
+        const EdgeEntry * e = &table[slot];
+        if (e->a.x == a.x && e->a.y == a.y && e->b.x == b.x && e->b.y == b.y)
+        {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Whether sector n has an edge along part of a to b, the other way: a portal
+// meeting several smaller ones on the far side.
+static int alongside(unsigned n, XY a, XY b)
+{
+    const Sector * sect = &sectors[n];
+    float dx = b.x - a.x, dy = b.y - a.y, length = dx * dx + dy * dy;
+    for (unsigned k = 0; k < sect->npoints; k++)
+    {
+        XY c = sect->vertex[k], d = sect->vertex[k + 1];
+        // How far along a to b the far side's edge starts and ends.
+        float tc = ((c.x - a.x) * dx + (c.y - a.y) * dy) / length;
+        float td = ((d.x - a.x) * dx + (d.y - a.y) * dy) / length;
+        if (turn(a, b, c) == 0 && turn(a, b, d) == 0 && td < tc && td < 1 && tc > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The piece of sector n, if any, with the edge from a to b; j gets which edge it is.
+static int findpiece(unsigned n, XY a, XY b, int * j)
+{
+    for (int p = (int)n; p >= 0; p = nextpiece((unsigned)p))
+    {
+        const Sector * sect = &sectors[p];
+        for (unsigned k = 0; k < sect->npoints; k++)
+        {
+            if (sect->vertex[k].x == a.x && sect->vertex[k].y == a.y && sect->vertex[k + 1].x == b.x && sect->vertex[k + 1].y == b.y)
+            {
+                *j = (int)k;
+                return p;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * portalchunk: Where the portals of a run of sectors ought to lead, reading
+ * the map but not changing it. Nearly every portal finds its edge the other
+ * way round in the sector it names, or in a piece of it. The few that don't
+ * are left to look up in the table of every edge afterwards. Walls are kept
+ * unless a portal from the other side turns them into one.
+ */
+static void portalchunk(unsigned index, void * data)
+{
+    PortalJob * job = data;
+    unsigned last = min((index + 1) * SectorsPerJob, NumSectors);
+    for (unsigned s = index * SectorsPerJob; s < last; s++)
+    {
+        const Sector * sect = &sectors[s];
+        for (unsigned k = 0; k < sect->npoints; k++)
+        {
+            int n = sect->neighbors[k], wanted = Keep, partner = -1;
+            XY a = sect->vertex[k], b = sect->vertex[k + 1];
+            if (n >= 0 && (unsigned)n < NumSectors)
+            {
+                int found = findpiece((unsigned)n, b, a, &partner);
+                wanted = found >= 0 ? found : alongside((unsigned)n, a, b) ? n : Unmatched;
+                partner = found >= 0 && sectors[found].neighbors[partner] < 0 ? partner : -1;
+            }
+            else if (n >= 0)
+            {
+                wanted = Unmatched;
+            }
+            job->wanted[job->firstedge[s] + k] = wanted;
+            job->partner[job->firstedge[s] + k] = partner;
+        }
+    }
+}
+
+// Fill the table of every edge in the map, for the portals that lead nowhere.
+static void filltable(void)
+{
+    unsigned numedges = 0, size = 64;
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        numedges += sectors[s].npoints;
+    }
+    while (size < 2 * numedges)
+    {
+        size *= 2;
+    }
+    table = malloc(sizeof(*table) * size);
+    tablemask = size - 1;
+    for (unsigned slot = 0; slot < size; slot++)
+    {
+        table[slot].sector = ~0u;
+    }
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        const Sector * sect = &sectors[s];
+        for (unsigned k = 0; k < sect->npoints; k++)
+        {
+            XY a = sect->vertex[k], b = sect->vertex[k + 1];
+            if (findedge(a, b))
+            {
+                continue;
+            }
+            unsigned slot = edgeslot(a, b);
+            while (table[slot].sector != ~0u)
+            {
+                slot = (slot + 1) & tablemask;
+            }
+            table[slot] = (EdgeEntry) {a, b, s, k};
+        }
+    }
+}
+
+// Whether sector b is a piece a was cut into.
+static int samesector(int a, int b)
+{
+    for (int p = a; p >= 0 && (unsigned)p < NumSectors; p = nextpiece((unsigned)p))
+    {
+        if (p == b)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Put the pieces in the map: the first in place of the sector, the rest after the last one.
+static void placepieces(void)
+{
+    unsigned total = NumSectors;
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        total += checks[s].numpieces - 1;
+    }
+    sectors = realloc(sectors, sizeof(*sectors) * total);
+    pieces = malloc(sizeof(*pieces) * total);
+    numlinked = total;
+    for (unsigned s = 0; s < total; s++)
+    {
+        pieces[s] = -1;
+    }
+
+    unsigned base = NumSectors;
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        SectorCheck * check = &checks[s];
+        if (check->numpieces < 2)
+        {
+            continue;
+        }
+        free(sectors[s].vertex);
+        free(sectors[s].neighbors);
+        free(sectors[s].surfaces);
+        for (unsigned p = 0; p < check->numpieces; p++)
+        {
+            Sector * piece = &check->pieces[p];
+            for (unsigned k = 0; k < piece->npoints; k++)
+            {
+                int n = piece->neighbors[k];
+                piece->neighbors[k] = n >= -1 ? n : n == -2 ? (int)s : (int)base + (-2 - n) - 1;
+            }
+            unsigned index = p ? base + p - 1 : s;
+            sectors[index] = *piece;
+            pieces[index] = p + 1 < check->numpieces ? (int)(base + p) : -1;
+        }
+        base += check->numpieces - 1;
+        free(check->pieces);
+    }
+    NumSectors = total;
+}
+
+// Point every portal at the sector that really has its edge the other way round.
+static void matchportals(void)
+{
+    unsigned * firstedge = malloc(sizeof(*firstedge) * (NumSectors + 1));
+    firstedge[0] = 0;
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        firstedge[s + 1] = firstedge[s] + sectors[s].npoints;
+    }
+    unsigned numedges = max(firstedge[NumSectors], 1);
+    PortalJob job = {firstedge, malloc(sizeof(*job.wanted) * numedges), malloc(sizeof(*job.partner) * numedges)};
+    runjobs((NumSectors + SectorsPerJob - 1) / SectorsPerJob, portalchunk, &job);
+
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        Sector * sect = &sectors[s];
+        for (unsigned k = 0; k < sect->npoints; k++)
+        {
+            int n = sect->neighbors[k], wanted = job.wanted[firstedge[s] + k], partner = job.partner[firstedge[s] + k];
+            if (wanted == Keep)
+            {
+                continue;
+            }
+            if (wanted == Unmatched)
+            {
+                if (!table)
+                {
+                    filltable();
+                }
+                const EdgeEntry * e = findedge(sect->vertex[k + 1], sect->vertex[k]);
+                wanted = e && e->sector != s ? (int)e->sector : -1;
+                partner = wanted >= 0 && sectors[wanted].neighbors[e->edge] < 0 ? (int)e->edge : -1;
+            }
+            if (partner >= 0)
+            {
+                sectors[wanted].neighbors[partner] = (int)s;
+                report.mended++;
+            }
+            if (n != wanted)
+            {
+                report.retargeted += wanted >= 0 && !samesector(n, wanted);
+                report.dropped += wanted < 0;
+                sect->neighbors[k] = wanted;
+            }
+        }
+    }
+    free(job.wanted);
+    free(job.partner);
+    free(firstedge);
+    free(table);
+    table = NULL;
+}
+
+static const char * problem(unsigned char problems)
+{
+    return problems & TooFew ? "has fewer than three points"
+         : problems & NoArea ? "has no area"
+         : "has crossing edges";
+}
+
+void CheckMap(void)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    FreeMapCheck();
+    report = (MapReport) {0, 0, 0, 0, 0, 0, 0, 0};
+    unsigned loaded = NumSectors;
+    checks = malloc(sizeof(*checks) * max(loaded, 1));
+    runjobs((loaded + SectorsPerJob - 1) / SectorsPerJob, checkchunk, NULL);
+    for (unsigned s = 0; s < loaded; s++)
+    {
+        report.rewound += (checks[s].problems & Rewound) != 0;
+        report.split += (checks[s].problems & Cut) != 0;
+        report.pieces += checks[s].numpieces - 1;
+        if (checks[s].problems & (TooFew | NoArea | Crossing))
+        {
+            report.broken++;
+            printf("sector %u %s, leaving it as it is\n", s, problem(checks[s].problems));
+        }
+    }
+    placepieces();
+    free(checks);
+    checks = NULL;
+    matchportals();
+
+    // The player may be standing in a piece of the sector the map gave.
+    for (int p = (int)player.sector; p >= 0 && (unsigned)p < NumSectors; p = nextpiece((unsigned)p))
+    {
+        const Sector * sect = &sectors[p];
+        unsigned k = 0;
+        while (k < sect->npoints && PointSide(player.where.x, player.where.y, sect->vertex[k].x, sect->vertex[k].y,
+                                              sect->vertex[k + 1].x, sect->vertex[k + 1].y) >= 0)
+        {
+            k++;
+        }
+        if (k == sect->npoints)
+        {
+            player.sector = (unsigned)p;
+            break;
+        }
+    }
+
+    report.ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    if (report.rewound || report.split || report.retargeted || report.mended || report.dropped)
+    {
+        printf("Map check: %u sectors turned around, %u split into %u more, portals %u retargeted, %u mended, %u dropped\n",
+               report.rewound, report.split, report.pieces, report.retargeted, report.mended, report.dropped);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef MAPCHECK
+#define MAPCHECK
+
+
+// What CheckMap found and mended in the map it last checked.
+typedef struct mapreport
+{
+    unsigned rewound;       // Sectors wound the wrong way round, turned around
+    unsigned split;         // Non-convex sectors split into convex pieces
+    unsigned pieces;        // Sectors those pieces added to the map
+    unsigned retargeted;    // Portals that led to a sector not across their edge
+    unsigned mended;        // Walls made portals because the sector across had one
+    unsigned dropped;       // Portals with no sector across, made walls
+    unsigned broken;        // Sectors that could not be mended: too few points, no area or crossing edges
+    double ms;
+} MapReport;
+
+/**
+ * CheckMap: Check and mend the sectors just read from a map file, before
+ * anything is built from them. The renderer and collision need every sector
+ * convex, with the inside on the left of each edge, and every portal matched
+ * by one leading back along the same edge:
+ *
+ * - A sector wound the other way round is reversed.
+ * - A non-convex one is cut along diagonals between its own vertices into
+ *   convex pieces joined by portals. The first piece keeps the sector's
+ *   number and the others are added after the last sector, so numbers in
+ *   the map file stay valid; nextpiece links them.
+ * - Each portal is pointed at the sector that really has the edge the other
+ *   way round. An edge is a portal on both sides if it is one on either,
+ *   and a portal with no sector across it becomes a wall.
+ *
+ * Sectors are checked and split in parallel. Problems it can't mend are
+ * printed and the sector left as it is.
+ */
+void CheckMap(void);
+
+void FreeMapCheck(void);
+
+// The next piece of a sector CheckMap split, or -1 after the last one and for sectors that weren't.
+int nextpiece(unsigned sector);
+
+const MapReport * mapreport(void);
+
+#endif
@@ -0,0 +1,420 @@
+#include <SDL2/SDL_image.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "material.h"
+#include "framebuffer.h"
+#include "geometry.h"
+#include "jobs.h"
+#include "mathlib.h"
+
+
+SDL_Color * Atlas = NULL;
+unsigned AtlasWidth = 0;
+unsigned AtlasHeight = 0;
+
+Material * materials = NULL;
+unsigned NumMaterials = 0;
+
+size_t TextureBudget = DefaultTextureBudget;
+
+Uint32 * Sky = NULL;
+unsigned SkyWidth = 0;
+unsigned SkyHeight = 0;
+unsigned SkyTurn = 0;
+
+#define SkyRepeats 4      // Times a sky texture wraps around a full turn
+#define BuiltinSkyWidth 1024
+#define BuiltinSkyHeight 256
+#define MipBands 8        // Jobs each level of a texture is filtered in
+
+// A texture's mip chain while it is built, before it is packed into the atlas.
+typedef struct mipchain
+{
+    SDL_Color * pixels[MaxMipLevels];
+    unsigned width[MaxMipLevels], height[MaxMipLevels];
+    unsigned levels;
+    unsigned first;       // Finest level that fits the budget
+} MipChain;
+
+typedef struct mipjobs
+{
+    MipChain * chains;
+    SDL_Surface ** images;
+    unsigned level;       // Level being filtered
+} MipJobs;
+
+static SDL_Surface ** textures = NULL; // Loaded but not packed yet
+static unsigned numtextures = 0;
+static int skytexture = -1;
+static int anysky = 0;
+
+static void addtexture(const char * path)
+{
+    IMG_Init(IMG_INIT_PNG);
+    SDL_Surface * image = IMG_Load(path);
+    if (!image)
+    {
+        printf("IMG_Load: %s\n", IMG_GetError());
+        return;
+    }
+    textures = realloc(textures, ++numtextures * sizeof(*textures));
+    textures[numtextures - 1] = image;
+}
+
+void LoadMaterial(const char * keyword, const char * args)
+{
+    char path[256];
+    int sector = -1, edge = -1, texture = 0, u = 0, v = 0;
+    if (strcmp(keyword, "texture") == 0 && sscanf(args, "%255s", path) == 1)
+    {
+        addtexture(path);
+        return;
+    }
+    if (strcmp(keyword, "sky") == 0)
+    {
+        int n = 0;
+        if (sscanf(args, "%d%n", &skytexture, &n) != 1)
+        {
+            printf("Can't read map line: %s %s", keyword, args);
+            return;
+        }
+        for (args += n; sscanf(args, "%d%n", &sector, &n) == 1; args += n)
+        {
+            if (sector < 0 || (unsigned)sector >= NumSectors)
+            {
+                printf("sky: no sector %d\n", sector);
+                continue;
+            }
+            sectors[sector].sky = 1;
+            anysky = 1;
+        }
+        return;
+    }
+    int fields = sscanf(args, "%d %d %d %d %d", &sector, &edge, &texture, &u, &v);
+    if (sector < 0 || (unsigned)sector >= NumSectors)
+    {
+        printf("%s: no sector %d\n", keyword, sector);
+        return;
+    }
+    Sector * sect = &sectors[sector];
+    if (strcmp(keyword, "wall") == 0 && fields >= 3)
+    {
+        if (edge < 0 || (unsigned)edge >= sect->npoints)
+        {
+            printf("wall: sector %d has no edge %d\n", sector, edge);
+            return;
+        }
+        sect->surfaces[edge] = (Surface) {(unsigned)texture, u, v};
+    }
+    else if (strcmp(keyword, "material") == 0 && fields >= 3)
+    {
+        // Read as sector floor ceil, so the edge slot holds the floor.
+        sect->floortexture = edge;
+        sect->ceiltexture = texture;
+    }
+    else
+    {
+        printf("Can't read map line: %s %s", keyword, args);
+    }
+}
+
+// A dusk gradient over a range of hills. The hills are sums of whole
+// numbers of waves around the circle, so the panorama wraps seamlessly.
+static void builtinsky(void)
+{
+    SkyWidth = SkyTurn = BuiltinSkyWidth;
+    SkyHeight = BuiltinSkyHeight;
+    Sky = malloc(sizeof(*Sky) * SkyWidth * SkyHeight);
+    for (unsigned x = 0; x < SkyWidth; x++)
+    {
+        float a = x * 2 * (float)M_PI / SkyWidth;
+        float hill = 0.72f - 0.08f * sinf(a * 3 + 1) - 0.05f * sinf(a * 7 + 2) - 0.02f * sinf(a * 19);
+        for (unsigned y = 0; y < SkyHeight; y++)
+        {
+            float t = (float)y / SkyHeight;
+            SDL_Color color = t > hill
+                ? (SDL_Color) {(Uint8)(40 - 20 * t), (Uint8)(46 - 20 * t), (Uint8)(58 - 20 * t), 255}
+                : (SDL_Color) {(Uint8)(70 + 170 * t), (Uint8)(90 + 80 * t), (Uint8)(150 - 40 * t), 255};
+            Sky[x * SkyHeight + y] = PackColor(color);
+        }
+    }
+}
+
+// Turn the sky texture's atlas rows into packed columns.
+static void texturesky(const Material * material)
+{
+    const MipLevel * finest = &material->level[0];
+    SkyWidth = finest->width;
+    SkyHeight = finest->height;
+    SkyTurn = SkyWidth * SkyRepeats;
+    Sky = malloc(sizeof(*Sky) * SkyWidth * SkyHeight);
+    for (unsigned y = 0; y < SkyHeight; y++)
+    {
+        const SDL_Color * row = Atlas + finest->offset + (size_t)y * AtlasWidth;
+        for (unsigned x = 0; x < SkyWidth; x++)
+        {
+            Sky[x * SkyHeight + y] = PackColor(row[x]);
+        }
+    }
+}
+
+// Wrap an offset into 0 - size, so sampling only ever adds positive numbers.
+static int wrapoffset(int offset, unsigned size)
+{
+    int wrapped = offset % (int)size;
+    return wrapped < 0 ? wrapped + (int)size : wrapped;
+}
+
+// Copy a band of rows of a loaded texture into the first level of its chain.
+static void copyjob(unsigned index, void * data)
+{
+    const MipJobs * jobs = data;
+    MipChain * chain = &jobs->chains[index / MipBands];
+    const SDL_Surface * image = jobs->images[index / MipBands];
+    unsigned band = index % MipBands, width = chain->width[0], height = chain->height[0];
+    int bpp = image->format->BytesPerPixel;
+    for (unsigned y = height * band / MipBands; y < height * (band + 1) / MipBands; y++)
+    {
+        const Uint8 * row = (const Uint8 *)image->pixels + y * image->pitch;
+        SDL_Color * out = chain->pixels[0] + (size_t)y * width;
+        for (unsigned x = 0; x < width; x++)
+        {
+            const Uint8 * texel = row + x * bpp;
+            out[x] = (SDL_Color) {texel[0], texel[1], texel[2], 255};
+        }
+    }
+}
+
+// Box filter a band of rows of one level from the level above it. Odd sizes
+// drop their last row or column, except where that would leave nothing.
+static void downsamplejob(unsigned index, void * data)
+{
+    const MipJobs * jobs = data;
+    MipChain * chain = &jobs->chains[index / MipBands];
+    unsigned level = jobs->level, band = index % MipBands;
+    if (level >= chain->levels)
+    {
+        return;
+    }
+    unsigned width = chain->width[level], height = chain->height[level];
+    unsigned srcwidth = chain->width[level - 1], srcheight = chain->height[level - 1];
+    const SDL_Color * src = chain->pixels[level - 1];
+    for (unsigned y = height * band / MipBands; y < height * (band + 1) / MipBands; y++)
+    {
+        const SDL_Color * row0 = src + (size_t)2 * y * srcwidth;
+        const SDL_Color * row1 = src + (size_t)min(2 * y + 1, srcheight - 1) * srcwidth;
+        SDL_Color * out = chain->pixels[level] + (size_t)y * width;
+        for (unsigned x = 0; x < width; x++)
+        {
+            unsigned x0 = 2 * x, x1 = min(2 * x + 1, srcwidth - 1);
+            out[x] = (SDL_Color) {(Uint8)((row0[x0].r + row0[x1].r + row1[x0].r + row1[x1].r + 2) >> 2),
+                                  (Uint8)((row0[x0].g + row0[x1].g + row1[x0].g + row1[x1].g + 2) >> 2),
+                                  (Uint8)((row0[x0].b + row0[x1].b + row1[x0].b + row1[x1].b + 2) >> 2), 255};
+        }
+    }
+}
+
+// Atlas rows a chain takes: its first kept level, and a band under it
+// holding the rest side by side.
+static unsigned chainrows(const MipChain * chain)
+{
+    unsigned first = chain->first;
+    return chain->height[first] + (first + 1 < chain->levels ? chain->height[first + 1] : 0);
+}
+
+// Atlas columns a chain takes: its first kept level, or the band of the
+// rest when that is wider. Widths stop halving at 1 while heights go on,
+// so a tall or narrow texture's band can be wider than the texture.
+static unsigned chainwidth(const MipChain * chain)
+{
+    unsigned band = 0;
+    for (unsigned l = chain->first + 1; l < chain->levels; l++)
+    {
+        band += chain->width[l];
+    }
+    return max(chain->width[chain->first], band);
+}
+
+static size_t atlasbytes(const MipChain * chains, unsigned count)
+{
+    size_t width = 0, rows = 0;
+    for (unsigned t = 0; t < count; t++)
+    {
+        width = max(width, (size_t)chainwidth(&chains[t]));
+        rows += chainrows(&chains[t]);
+    }
+    return width * rows * sizeof(SDL_Color);
+}
+
+// Drop the finest levels of the largest textures until the atlas fits the budget.
+static void fitbudget(MipChain * chains, unsigned count)
+{
+    while (TextureBudget && atlasbytes(chains, count) > TextureBudget)
+    {
+        unsigned largest = count;
+        size_t most = 0;
+        for (unsigned t = 0; t < count; t++)
+        {
+            const MipChain * chain = &chains[t];
+            size_t texels = (size_t)chain->width[chain->first] * chain->height[chain->first];
+            if (chain->first + 1 < chain->levels && texels > most)
+            {
+                largest = t;
+                most = texels;
+            }
+        }
+        if (largest == count)
+        {
+            printf("Textures need %zu bytes even at their smallest, over the budget of %zu\n",
+                   atlasbytes(chains, count), TextureBudget);
+            return;
+        }
+        chains[largest].first++;
+    }
+}
+
+void BuildAtlas(void)
+{
+    FreeMaterials();
+    if (numtextures == 0)
+    {
+        addtexture(DefaultTexture);
+    }
+
+    // Every level halves the one before, down to a single texel.
+    MipChain * chains = calloc(numtextures ? numtextures : 1, sizeof(*chains));
+    for (unsigned t = 0; t < numtextures; t++)
+    {
+        MipChain * chain = &chains[t];
+        unsigned width = (unsigned)textures[t]->w, height = (unsigned)textures[t]->h;
+        for (chain->levels = 0; chain->levels < MaxMipLevels; chain->levels++)
+        {
+            chain->width[chain->levels] = width;
+            chain->height[chain->levels] = height;
+            chain->pixels[chain->levels] = malloc(sizeof(SDL_Color) * width * height);
+            if (width == 1 && height == 1)
+            {
+                chain->levels++;
+                break;
+            }
+            width = max(width / 2, 1u);
+            height = max(height / 2, 1u);
+        }
+    }
+    MipJobs jobs = {chains, textures, 0};
+    runjobs(numtextures * MipBands, copyjob, &jobs);
+    for (jobs.level = 1; jobs.level < MaxMipLevels; jobs.level++)
+    {
+        runjobs(numtextures * MipBands, downsamplejob, &jobs);
+    }
+    fitbudget(chains, numtextures);
+
+    // Stack the textures one below the other, each with its smaller levels beneath it.
+    NumMaterials = numtextures;
+    materials = calloc(NumMaterials ? NumMaterials : 1, sizeof(*materials));
+    for (unsigned t = 0; t < numtextures; t++)
+    {
+        AtlasWidth = max(AtlasWidth, chainwidth(&chains[t]));
+        AtlasHeight += chainrows(&chains[t]);
+    }
+    size_t texels = (size_t)AtlasWidth * AtlasHeight;
+    Atlas = calloc(texels > 0 ? texels : 1, sizeof(*Atlas));
+
+    unsigned top = 0;
+    for (unsigned t = 0; t < numtextures; t++)
+    {
+        const MipChain * chain = &chains[t];
+        Material * material = &materials[t];
+        material->width = chain->width[0];
+        material->height = chain->height[0];
+        material->levels = chain->levels - chain->first;
+        unsigned left = 0;
+        for (unsigned l = 0; l < material->levels; l++)
+        {
+            unsigned from = chain->first + l;
+            unsigned y = l == 0 ? top : top + chain->height[chain->first];
+            MipLevel * level = &material->level[l];
+            *level = (MipLevel) {y * AtlasWidth + left, chain->width[from], chain->height[from]};
+            for (unsigned row = 0; row < level->height; row++)
+            {
+                memcpy(Atlas + level->offset + (size_t)row * AtlasWidth, chain->pixels[from] + (size_t)row * level->width,
+                       level->width * sizeof(*Atlas));
+            }
+            left += l == 0 ? 0 : level->width;
+        }
+        top += chainrows(chain);
+
+        // Flats take the colour of the whole texture as loaded.
+        unsigned long long sum[3] = {0, 0, 0};
+        unsigned long long count = (unsigned long long)chain->width[0] * chain->height[0];
+        for (unsigned long long i = 0; i < count; i++)
+        {
+            sum[0] += chain->pixels[0][i].r;
+            sum[1] += chain->pixels[0][i].g;
+            sum[2] += chain->pixels[0][i].b;
+        }
+        material->average = (SDL_Color) {(Uint8)(sum[0] / count), (Uint8)(sum[1] / count), (Uint8)(sum[2] / count), 255};
+
+        for (unsigned l = 0; l < chain->levels; l++)
+        {
+            free(chain->pixels[l]);
+        }
+        SDL_FreeSurface(textures[t]);
+    }
+    free(chains);
+    free(textures);
+    textures = NULL;
+    numtextures = 0;
+
+    // With no texture at all there is nothing to fall back on; draw walls black.
+    if (NumMaterials == 0)
+    {
+        NumMaterials = AtlasWidth = AtlasHeight = 1;
+        Atlas[0] = (SDL_Color) {0, 0, 0, 255};
+        materials[0] = (Material) {1, 1, {0, 0, 0, 255}, 1, {{0, 1, 1}}};
+    }
+
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        Sector * sect = &sectors[n];
+        for (unsigned s = 0; s < sect->npoints; s++)
+        {
+            Surface * surface = &sect->surfaces[s];
+            if (surface->texture >= NumMaterials)
+            {
+                printf("Sector %u wall %u: no texture %u\n", n, s, surface->texture);
+                surface->texture = 0;
+            }
+            surface->u = wrapoffset(surface->u, materials[surface->texture].width);
+            surface->v = wrapoffset(surface->v, materials[surface->texture].height);
+        }
+        sect->floortexture = sect->floortexture < (int)NumMaterials ? sect->floortexture : -1;
+        sect->ceiltexture = sect->ceiltexture < (int)NumMaterials ? sect->ceiltexture : -1;
+    }
+
+    if (anysky && skytexture >= 0 && (unsigned)skytexture < NumMaterials)
+    {
+        texturesky(&materials[skytexture]);
+    }
+    else if (anysky)
+    {
+        builtinsky();
+    }
+    anysky = 0;
+    skytexture = -1;
+}
+
+void FreeMaterials(void)
+{
+    free(Atlas);
+    free(materials);
+    free(Sky);
+    Atlas = NULL;
+    materials = NULL;
+    Sky = NULL;
+    NumMaterials = AtlasWidth = AtlasHeight = 0;
+    SkyWidth = SkyHeight = SkyTurn = 0;
+}
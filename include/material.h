@@ -0,0 +1,73 @@
+#ifndef MATERIAL
+#define MATERIAL
+
+#include <SDL2/SDL.h>
+
+
+#define DefaultTexture "resources/stonetiles_003_diff.png"
+
+#define MaxMipLevels 12                   // Enough to take 2048 texels down to 1
+#define DefaultTextureBudget (64u << 20)  // Bytes
+
+// Where one mip level of a texture sits in the atlas.
+typedef struct miplevel
+{
+    unsigned offset;       // Atlas index of its top left texel
+    unsigned width, height;
+} MipLevel;
+
+// A texture and its mip chain, each level half the size of the one before.
+typedef struct material
+{
+    unsigned width, height; // As loaded. Wall offsets count these texels
+    SDL_Color average;      // Used for flats, which are not textured
+    unsigned levels;        // Levels in the atlas, finest first
+    MipLevel level[MaxMipLevels];
+} Material;
+
+// Every texture of the map, one below the other, AtlasWidth texels apart.
+// Under each texture its smaller mip levels sit side by side.
+extern SDL_Color * Atlas;
+extern unsigned AtlasWidth, AtlasHeight;
+
+extern Material * materials;
+extern unsigned NumMaterials;
+
+// Bytes the atlas may take. When the mip chains don't fit, the finest level
+// of the largest texture is dropped until they do, so distant walls look the
+// same and only close ones lose detail. 0 for no limit.
+extern size_t TextureBudget;
+
+// The sky panorama, packed and stored column by column so a screen column
+// of sky reads one run: Sky[column * SkyHeight + row]. SkyTurn columns make
+// a full turn, repeating the panorama when it is narrower. NULL when no
+// sector shows the sky.
+extern Uint32 * Sky;
+extern unsigned SkyWidth, SkyHeight, SkyTurn;
+
+/**
+ * LoadMaterial: Read one material line of a map file. keyword is the first
+ * word on the line and args the rest of it:
+ *
+ *   texture  path                         Adds a texture; the first is 0, the next 1 and so on
+ *   wall     sector edge texture u v      Texture of one wall, shifted u and v texels
+ *   material sector floor ceil            Textures whose colour fills the flats, -1 for the plain colours
+ *   sky      texture sector...            Sectors whose ceiling opens onto the sky, with the texture
+ *                                         to wrap around it, -1 for a built in one
+ *
+ * Walls not listed use texture 0 unshifted. Textures can be listed after the
+ * lines that use them.
+ */
+void LoadMaterial(const char * keyword, const char * args);
+
+/**
+ * BuildAtlas: Filter each texture's mip chain, in parallel, and pack as much
+ * of them as TextureBudget allows into the atlas, loading DefaultTexture if
+ * the map named none. Then check every texture index the sectors use, and
+ * lay out the sky.
+ */
+void BuildAtlas(void);
+
+void FreeMaterials(void);
+
+#endif
@@ -0,0 +1,655 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "navigation.h"
+#include "geometry.h"
+#include "constants.h"
+#include "mathlib.h"
+#include "telemetry.h"
+
+
+#define NavDuckPenalty 2.0f // Cost multiplier for portals that have to be crouched through
+
+enum { MaxBatches = 256 };
+
+typedef struct navedge
+{
+    unsigned from; // Sector the edge leaves; edges are stored under the sector they enter
+    unsigned edge; // Which of from's edges the portal is
+    float cost;    // -1 while the portal can't be walked through
+} NavEdge;
+
+// Shortest way from every sector to one target sector.
+typedef struct flowfield
+{
+    unsigned target;
+    unsigned lastused;
+    int * next;
+    float * cost;
+} FlowField;
+
+typedef struct navbatch
+{
+    NavQuery * queries;
+    unsigned count;
+} NavBatch;
+
+// An edge out of a sector: incoming[edge], which enters sector to.
+typedef struct navout
+{
+    unsigned edge, to;
+} NavOut;
+
+// A new cost for incoming[edge], which enters sector to.
+typedef struct navchange
+{
+    unsigned edge, to;
+    float cost;
+} NavChange;
+
+// The graph in compressed rows: the edges into sector s are incoming[firstin[s] .. firstin[s+1]).
+static unsigned * firstin = NULL;
+static NavEdge * incoming = NULL;
+static XY * centers = NULL;
+// And the same edges by the sector they leave: outgoing[firstout[s] .. firstout[s+1]).
+static unsigned * firstout = NULL;
+static NavOut * outgoing = NULL;
+
+static FlowField fields[NavCacheFields];
+static int * fieldof = NULL; // Cache slot per target sector, -1 when not cached
+static unsigned fieldclock = 0;
+
+// Dijkstra's heap, sized for one entry per edge plus one per sector.
+static unsigned * heapsector = NULL;
+static float * heapcost = NULL;
+
+// Scratch for repairing a field: which sectors lost their way, or were
+// seeded, and a list of them.
+enum { Unmarked, Lost, Seeded };
+static unsigned char * mark = NULL;
+static unsigned * marked = NULL;
+
+static SDL_Thread * navthread = NULL;
+static SDL_mutex * navlock = NULL;
+static SDL_cond * navwake = NULL;
+static SDL_cond * navdone = NULL;
+static NavBatch batches[MaxBatches];
+static unsigned batchhead = 0, batchtail = 0;
+static int navbusy = 0;
+static int navquit = 0;
+
+// Costs navupdate worked out, queued for the navigation thread to apply
+// before its next batch. The thread swaps the two lists under navlock.
+static NavChange * pending = NULL, * applying = NULL;
+static unsigned numpending = 0, pendingcapacity = 0, applyingcapacity = 0;
+
+// Cost of walking from sector a into neighbor b through the edge from p0 to p1, or -1 when it can't be done.
+static float edgecost(unsigned a, unsigned b, XY p0, XY p1)
+{
+    const Sector * from = &sectors[a];
+    const Sector * to = &sectors[b];
+    float width = hypotf(p1.x - p0.x, p1.y - p0.y);
+    float step = to->floor - from->floor;
+    float gap = min(from->ceil, to->ceil) - max(from->floor, to->floor);
+    if (width < NavAgentWidth || step > KneeHeight || gap < DuckHeight + HeadMargin)
+    {
+        return -1;
+    }
+
+    // Walk from centre to centre through the middle of the portal. Narrow
+    // portals, climbing and crouching all make the way less attractive.
+    XY mid = {(p0.x + p1.x) / 2, (p0.y + p1.y) / 2};
+    float cost = hypotf(mid.x - centers[a].x, mid.y - centers[a].y) + hypotf(centers[b].x - mid.x, centers[b].y - mid.y);
+    cost *= 1 + NavAgentWidth / width;
+    if (step > 0)
+    {
+        cost += step;
+    }
+    if (gap < EyeHeight + HeadMargin)
+    {
+        cost *= NavDuckPenalty;
+    }
+    return cost;
+}
+
+static void freegraph(void)
+{
+    free(firstin);
+    free(incoming);
+    free(centers);
+    free(firstout);
+    free(outgoing);
+    free(heapsector);
+    free(heapcost);
+    free(mark);
+    free(marked);
+    firstin = NULL;
+    incoming = NULL;
+    centers = NULL;
+    firstout = NULL;
+    outgoing = NULL;
+    heapsector = NULL;
+    heapcost = NULL;
+    mark = NULL;
+    marked = NULL;
+}
+
+static void buildgraph(void)
+{
+    freegraph();
+    firstin = calloc(NumSectors + 1, sizeof(*firstin));
+    firstout = calloc(NumSectors + 1, sizeof(*firstout));
+    centers = malloc(sizeof(*centers) * (NumSectors + 1));
+
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        const Sector * sect = &sectors[s];
+        XY center = {0, 0};
+        for (unsigned p = 0; p < sect->npoints; p++)
+        {
+            center.x += sect->vertex[p].x / sect->npoints;
+            center.y += sect->vertex[p].y / sect->npoints;
+            if (sect->neighbors[p] >= 0)
+            {
+                firstin[sect->neighbors[p] + 1]++;
+                firstout[s + 1]++;
+            }
+        }
+        centers[s] = center;
+    }
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        firstin[s + 1] += firstin[s];
+        firstout[s + 1] += firstout[s];
+    }
+
+    // Fill each sector's incoming edges. Impassable portals keep their slot so
+    // navupdate can open them up again when heights change.
+    unsigned numedges = firstin[NumSectors];
+    incoming = malloc(sizeof(*incoming) * (numedges + 1));
+    outgoing = malloc(sizeof(*outgoing) * (numedges + 1));
+    unsigned * fill = malloc(sizeof(*fill) * (NumSectors + 1));
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        fill[s] = firstin[s];
+    }
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        const Sector * sect = &sectors[s];
+        unsigned out = 0;
+        for (unsigned p = 0; p < sect->npoints; p++)
+        {
+            int n = sect->neighbors[p];
+            if (n >= 0)
+            {
+                outgoing[firstout[s] + out++] = (NavOut) {fill[n], (unsigned)n};
+                incoming[fill[n]++] = (NavEdge) {s, p, edgecost(s, n, sect->vertex[p], sect->vertex[p+1])};
+            }
+        }
+    }
+    free(fill);
+
+    heapsector = malloc(sizeof(*heapsector) * (numedges + NumSectors + 1));
+    heapcost = malloc(sizeof(*heapcost) * (numedges + NumSectors + 1));
+    mark = calloc(NumSectors + 1, sizeof(*mark));
+    marked = malloc(sizeof(*marked) * (NumSectors + 1));
+}
+
+// Queue the edge's cost as the sector heights now make it. Called with navlock held.
+static void queueedge(unsigned e, unsigned to)
+{
+    const Sector * from = &sectors[incoming[e].from];
+    if (numpending == pendingcapacity)
+    {
+        pendingcapacity = pendingcapacity ? pendingcapacity * 2 : 64;
+        pending = realloc(pending, sizeof(*pending) * pendingcapacity);
+    }
+    pending[numpending++] = (NavChange) {e, to, edgecost(incoming[e].from, to, from->vertex[incoming[e].edge], from->vertex[incoming[e].edge + 1])};
+}
+
+static void clearfields(void)
+{
+    for (unsigned i = 0; i < NavCacheFields; i++)
+    {
+        if (fields[i].next)
+        {
+            fieldof[fields[i].target] = -1;
+        }
+        free(fields[i].next);
+        free(fields[i].cost);
+        fields[i] = (FlowField) {0, 0, NULL, NULL};
+    }
+}
+
+// Min-heap on cost. Entries are never updated in place; stale ones are skipped when popped.
+static void heappush(unsigned * size, unsigned sector, float cost)
+{
+    unsigned i = (*size)++;
+    while (i > 0 && heapcost[(i - 1) / 2] > cost)
+    {
+        heapsector[i] = heapsector[(i - 1) / 2];
+        heapcost[i] = heapcost[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heapsector[i] = sector;
+    heapcost[i] = cost;
+}
+
+static unsigned heappop(unsigned * size, float * cost)
+{
+    unsigned top = heapsector[0];
+    *cost = heapcost[0];
+    unsigned lastsector = heapsector[--*size];
+    float lastcost = heapcost[*size];
+    unsigned i = 0;
+    for (;;)
+    {
+        unsigned child = i * 2 + 1;
+        if (child >= *size)
+        {
+            break;
+        }
+        if (child + 1 < *size && heapcost[child + 1] < heapcost[child])
+        {
+            child++;
+        }
+        if (heapcost[child] >= lastcost)
+        {
+            break;
+        }
+        heapsector[i] = heapsector[child];
+        heapcost[i] = heapcost[child];
+        i = child;
+    }
+    heapsector[i] = lastsector;
+    heapcost[i] = lastcost;
+    return top;
+}
+
+// Dijkstra outwards along incoming edges from the sectors in the heap, so
+// every sector it reaches learns its cost to the target and which neighbor
+// to step into next.
+static void spread(FlowField * field, unsigned size)
+{
+    while (size > 0)
+    {
+        float cost;
+        unsigned s = heappop(&size, &cost);
+        if (cost > field->cost[s])
+        {
+            continue;
+        }
+        for (unsigned e = firstin[s]; e < firstin[s + 1]; e++)
+        {
+            if (incoming[e].cost < 0)
+            {
+                continue;
+            }
+            unsigned from = incoming[e].from;
+            float through = cost + incoming[e].cost;
+            if (field->cost[from] < 0 || through < field->cost[from])
+            {
+                field->cost[from] = through;
+                field->next[from] = (int)s;
+                heappush(&size, from, through);
+            }
+        }
+    }
+}
+
+static void computefield(FlowField * field, unsigned target)
+{
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        field->next[s] = -1;
+        field->cost[s] = -1;
+    }
+    field->target = target;
+    field->cost[target] = 0;
+
+    unsigned size = 0;
+    heappush(&size, target, 0);
+    spread(field, size);
+}
+
+// The flow field towards target, computed on a miss into the least recently used slot.
+static const FlowField * getfield(unsigned target)
+{
+    fieldclock++;
+    if (fieldof[target] >= 0)
+    {
+        FlowField * field = &fields[fieldof[target]];
+        field->lastused = fieldclock;
+        return field;
+    }
+
+    unsigned slot = 0;
+    for (unsigned i = 1; i < NavCacheFields; i++)
+    {
+        if (fields[i].lastused < fields[slot].lastused)
+        {
+            slot = i;
+        }
+    }
+    FlowField * field = &fields[slot];
+    if (field->next)
+    {
+        fieldof[field->target] = -1;
+    }
+    else
+    {
+        field->next = malloc(sizeof(*field->next) * NumSectors);
+        field->cost = malloc(sizeof(*field->cost) * NumSectors);
+    }
+    computefield(field, target);
+    field->lastused = fieldclock;
+    fieldof[target] = (int)slot;
+    return field;
+}
+
+// Give sector s the cheapest way through a neighbor that still has one, if
+// that beats the way it has, and queue it to spread from.
+static void seed(FlowField * field, unsigned s, unsigned * size)
+{
+    float best = field->cost[s];
+    int next = field->next[s];
+    for (unsigned o = firstout[s]; o < firstout[s + 1]; o++)
+    {
+        float cost = incoming[outgoing[o].edge].cost;
+        unsigned to = outgoing[o].to;
+        if (cost < 0 || mark[to] == Lost || field->cost[to] < 0)
+        {
+            continue;
+        }
+        if (best < 0 || field->cost[to] + cost < best)
+        {
+            best = field->cost[to] + cost;
+            next = (int)to;
+        }
+    }
+    if (best >= 0 && (field->cost[s] < 0 || best < field->cost[s]))
+    {
+        field->cost[s] = best;
+        field->next[s] = next;
+        heappush(size, s, best);
+    }
+}
+
+// Bring a field up to date with recosted edges, touching only what they
+// change. A sector whose way runs through a recosted edge loses it, along
+// with every sector whose way runs through that one; the lost sectors and
+// the ones a recosted edge leaves are seeded from their neighbors, and
+// Dijkstra spreads from there. Everything else keeps its way: it was the
+// shortest and still is unless a cheaper edge now beats it, which the seeds
+// find.
+static void repairfield(FlowField * field, const NavChange * changes, unsigned count)
+{
+    unsigned nummarked = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned from = incoming[changes[i].edge].from;
+        if (field->next[from] == (int)changes[i].to && mark[from] == Unmarked)
+        {
+            mark[from] = Lost;
+            marked[nummarked++] = from;
+        }
+    }
+    for (unsigned i = 0; i < nummarked; i++)
+    {
+        unsigned s = marked[i];
+        for (unsigned e = firstin[s]; e < firstin[s + 1]; e++)
+        {
+            unsigned from = incoming[e].from;
+            if (mark[from] == Unmarked && field->next[from] == (int)s)
+            {
+                mark[from] = Lost;
+                marked[nummarked++] = from;
+            }
+        }
+    }
+    unsigned numlost = nummarked;
+    for (unsigned i = 0; i < numlost; i++)
+    {
+        field->cost[marked[i]] = -1;
+        field->next[marked[i]] = -1;
+    }
+
+    unsigned size = 0;
+    for (unsigned i = 0; i < numlost; i++)
+    {
+        seed(field, marked[i], &size);
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned from = incoming[changes[i].edge].from;
+        if (mark[from] == Unmarked)
+        {
+            mark[from] = Seeded;
+            marked[nummarked++] = from;
+            seed(field, from, &size);
+        }
+    }
+    for (unsigned i = 0; i < nummarked; i++)
+    {
+        mark[marked[i]] = Unmarked;
+    }
+    spread(field, size);
+}
+
+// Give edges their new costs and repair every cached field to match.
+static void applychanges(NavChange * changes, unsigned count)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        NavEdge * e = &incoming[changes[i].edge];
+        if (e->cost != changes[i].cost)
+        {
+            e->cost = changes[i].cost;
+            changes[kept++] = changes[i];
+        }
+    }
+    for (unsigned f = 0; kept && f < NavCacheFields; f++)
+    {
+        if (fields[f].next)
+        {
+            repairfield(&fields[f], changes, kept);
+        }
+    }
+}
+
+static void answer(NavQuery * queries, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        NavQuery * q = &queries[i];
+        if (!fieldof || q->from >= NumSectors || q->to >= NumSectors)
+        {
+            q->next = -1;
+            q->cost = -1;
+            continue;
+        }
+        const FlowField * field = getfield(q->to);
+        q->next = field->next[q->from];
+        q->cost = field->cost[q->from];
+    }
+}
+
+static int navloop(void * unused)
+{
+    (void)unused;
+    telemetrythread("navigation");
+    SDL_LockMutex(navlock);
+    for (;;)
+    {
+        while (!navquit && batchhead == batchtail && numpending == 0)
+        {
+            SDL_CondWait(navwake, navlock);
+        }
+        if (navquit)
+        {
+            break;
+        }
+        // Take every change queued so far along with the next batch, so the
+        // batch is answered on the heights it was asked with.
+        NavChange * changes = pending;
+        unsigned numchanges = numpending, capacity = pendingcapacity;
+        pending = applying;
+        pendingcapacity = applyingcapacity;
+        applying = changes;
+        applyingcapacity = capacity;
+        numpending = 0;
+        int hasbatch = batchhead != batchtail;
+        NavBatch batch = hasbatch ? batches[batchtail % MaxBatches] : (NavBatch) {NULL, 0};
+        SDL_UnlockMutex(navlock);
+
+        Uint64 start = telemetrystart(TimeNavigate);
+        applychanges(changes, numchanges);
+        answer(batch.queries, batch.count);
+        telemetrystop(TimeNavigate, start);
+
+        SDL_LockMutex(navlock);
+        batchtail += hasbatch;
+        if (batchhead == batchtail && numpending == 0)
+        {
+            navbusy = 0;
+        }
+        SDL_CondBroadcast(navdone);
+    }
+    SDL_UnlockMutex(navlock);
+    return 0;
+}
+
+void BuildNavigation(void)
+{
+    FreeNavigation();
+    buildgraph();
+    fieldof = malloc(sizeof(*fieldof) * (NumSectors + 1));
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        fieldof[s] = -1;
+    }
+
+    navlock = SDL_CreateMutex();
+    navwake = SDL_CreateCond();
+    navdone = SDL_CreateCond();
+    navquit = 0;
+    navthread = SDL_CreateThread(navloop, "navigation", NULL);
+}
+
+void FreeNavigation(void)
+{
+    if (navthread)
+    {
+        SDL_LockMutex(navlock);
+        navquit = 1;
+        SDL_CondBroadcast(navwake);
+        SDL_UnlockMutex(navlock);
+        SDL_WaitThread(navthread, NULL);
+        SDL_DestroyCond(navdone);
+        SDL_DestroyCond(navwake);
+        SDL_DestroyMutex(navlock);
+        navthread = NULL;
+    }
+    if (fieldof)
+    {
+        clearfields();
+    }
+    free(fieldof);
+    freegraph();
+    free(pending);
+    free(applying);
+    fieldof = NULL;
+    pending = applying = NULL;
+    numpending = pendingcapacity = applyingcapacity = 0;
+    batchhead = batchtail = 0;
+    navbusy = 0;
+}
+
+void navsubmit(NavQuery * queries, unsigned count)
+{
+    if (!navthread)
+    {
+        answer(queries, count);
+        return;
+    }
+    SDL_LockMutex(navlock);
+    while (batchhead - batchtail == MaxBatches)
+    {
+        SDL_CondWait(navdone, navlock);
+    }
+    batches[batchhead++ % MaxBatches] = (NavBatch) {queries, count};
+    navbusy = 1;
+    SDL_CondSignal(navwake);
+    SDL_UnlockMutex(navlock);
+}
+
+void navwait(void)
+{
+    if (!navthread)
+    {
+        return;
+    }
+    SDL_LockMutex(navlock);
+    while (navbusy)
+    {
+        SDL_CondWait(navdone, navlock);
+    }
+    SDL_UnlockMutex(navlock);
+}
+
+void navinvalidate(void)
+{
+    navwait();
+    clearfields();
+    buildgraph();
+}
+
+void navupdate(const unsigned * changed, unsigned count)
+{
+    if (!firstin || count == 0)
+    {
+        return;
+    }
+    // The costs are worked out here, where the heights change, and only
+    // handed over; the navigation thread may be busy with a batch.
+    if (navthread)
+    {
+        SDL_LockMutex(navlock);
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        // Edges into the sector live in its own row; edges out of it in its neighbors' rows.
+        unsigned s = changed[i];
+        for (unsigned e = firstin[s]; e < firstin[s + 1]; e++)
+        {
+            queueedge(e, s);
+        }
+        const Sector * sect = &sectors[s];
+        for (unsigned p = 0; p < sect->npoints; p++)
+        {
+            int n = sect->neighbors[p];
+            if (n < 0)
+            {
+                continue;
+            }
+            for (unsigned e = firstin[n]; e < firstin[n + 1]; e++)
+            {
+                if (incoming[e].from == s && incoming[e].edge == p)
+                {
+                    queueedge(e, (unsigned)n);
+                }
+            }
+        }
+    }
+    if (!navthread)
+    {
+        applychanges(pending, numpending);
+        numpending = 0;
+        return;
+    }
+    navbusy = 1;
+    SDL_CondSignal(navwake);
+    SDL_UnlockMutex(navlock);
+}
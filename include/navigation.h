@@ -0,0 +1,52 @@
+#ifndef NAVIGATION
+#define NAVIGATION
+
+
+// Agent limits used when deciding whether a portal can be walked through.
+#define NavAgentWidth 1.0f    // Portals narrower than this are impassable
+#define NavCacheFields 16     // Flow fields kept, one per target sector
+
+// A request to get from one sector to another. The navigation thread fills in
+// next, the neighbor to walk into (the target itself once adjacent, -1 when
+// unreachable or already there), and cost, the total path cost (-1 when unreachable).
+typedef struct navquery
+{
+    unsigned from, to;
+    int next;
+    float cost;
+} NavQuery;
+
+/**
+ * BuildNavigation: Build the weighted sector graph from Sector.neighbors.
+ * An edge exists where a portal is wide enough, the step up is at most
+ * KneeHeight and the gap between floor and ceiling leaves HeadMargin above
+ * a standing (or, at a cost, ducking) agent. Called once per map load.
+ */
+void BuildNavigation(void);
+
+void FreeNavigation(void);
+
+/**
+ * navsubmit: Queue a batch of queries for the navigation thread and return
+ * immediately. The array must stay alive until navwait returns. Queries that
+ * share a target are answered from one cached flow field.
+ */
+void navsubmit(NavQuery * queries, unsigned count);
+
+// Block until every submitted batch has been answered and every update applied.
+void navwait(void);
+
+// Rebuild the graph and drop every cached flow field. Waits for outstanding
+// batches first.
+void navinvalidate(void);
+
+/**
+ * navupdate: Recost only the portals of sectors whose heights changed, e.g.
+ * the dirty list after animatesectors. Never waits for the navigation
+ * thread: the new costs are queued for it to apply before its next batch,
+ * and only the cached flow fields that walk through a recosted portal, or
+ * that it now gives a shorter way, are dropped and computed again on demand.
+ */
+void navupdate(const unsigned * changed, unsigned count);
+
+#endif
@@ -0,0 +1,368 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netgame.h"
+#include "animation.h"
+#include "geometry.h"
+#include "player.h"
+#include "playermovement.h"
+#include "telemetry.h"
+
+
+// Messages start with their kind. Input: the newest snapshot tick the client
+// has plus one (0 for none), the buttons, the mouse motion and the time.
+// Snapshot: the tick, how many ticks back its baseline is (0 for a full
+// snapshot), which entity the receiver is, then the encoded snapshot.
+#define MsgInput    'i'
+#define MsgSnapshot 's'
+
+#define MaxHeader 16
+
+typedef struct serverclient
+{
+    int active;
+    unsigned peer;
+    unsigned ack;       // Newest snapshot tick the client has, plus one; 0 for none
+    unsigned idle;      // Ticks since it last said anything
+    InputFrame input;   // Held buttons carry over, motion and jumps add up until the next tick
+} ServerClient;
+
+// One encoding of this tick's snapshot, shared by every client with the same baseline.
+typedef struct encoding
+{
+    unsigned tick;      // Tick it was encoded for, so stale ones are ignored
+    unsigned size;
+    unsigned char * data;
+} Encoding;
+
+struct server
+{
+    Transport * transport;
+    Player spawn;
+    Player players[MaxClients];
+    ServerClient clients[MaxClients];
+    Snapshot history[SnapshotRing];
+    Encoding encodings[SnapshotRing]; // By age of the baseline, 0 for a full snapshot
+    unsigned char * message;
+    unsigned tick;
+    ServerStats stats;
+};
+
+struct netclient
+{
+    Transport * transport;
+    Snapshot history[SnapshotRing];
+    unsigned newest;    // Tick of the newest snapshot, plus one; 0 for none
+    unsigned slot;
+};
+
+static unsigned char * putvarint(unsigned char * out, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (unsigned char)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+static unsigned getvarint(const unsigned char ** in, const unsigned char * end)
+{
+    unsigned value = 0;
+    for (unsigned shift = 0; *in < end && shift < 35; shift += 7)
+    {
+        unsigned char c = *(*in)++;
+        value |= (unsigned)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+static unsigned zigzag(int value)
+{
+    return ((unsigned)value << 1) ^ (unsigned)(value >> 31);
+}
+
+static int unzigzag(unsigned value)
+{
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static double elapsedms(Uint64 start, Uint64 end)
+{
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+Server * startserver(Transport * transport)
+{
+    Server * server = calloc(1, sizeof(*server));
+    server->transport = transport;
+    server->spawn = player;
+    for (unsigned i = 0; i < MaxClients; i++)
+    {
+        server->players[i].sector = (unsigned)-1;
+    }
+    for (unsigned t = 0; t < SnapshotRing; t++)
+    {
+        allocsnapshot(&server->history[t]);
+        server->encodings[t].data = malloc(maxsnapshotbytes());
+    }
+    server->message = malloc(MaxHeader + maxsnapshotbytes());
+    setanimationplayers(server->players, MaxClients);
+    return server;
+}
+
+// Find the client a message came from, giving new peers a free slot.
+static int clientfor(Server * server, unsigned peer)
+{
+    int open = -1;
+    for (int i = 0; i < MaxClients; i++)
+    {
+        if (server->clients[i].active && server->clients[i].peer == peer)
+        {
+            return i;
+        }
+        open = open < 0 && !server->clients[i].active ? i : open;
+    }
+    if (open >= 0)
+    {
+        server->clients[open] = (ServerClient) {1, peer, 0, 0, {0, 0, 0, 0}};
+        server->players[open] = server->spawn;
+        server->stats.clients++;
+    }
+    return open;
+}
+
+static void readinput(Server * server)
+{
+    unsigned peer, size;
+    const unsigned char * data;
+    while ((data = transportreceive(server->transport, &peer, &size)))
+    {
+        const unsigned char * end = data + size;
+        if (size < 2 || *data++ != MsgInput)
+        {
+            continue;
+        }
+        int slot = clientfor(server, peer);
+        if (slot < 0)
+        {
+            continue;
+        }
+        ServerClient * client = &server->clients[slot];
+        unsigned ack = getvarint(&data, end);
+        unsigned char buttons = data < end ? *data++ : 0;
+        int mousex = unzigzag(getvarint(&data, end));
+        int mousey = unzigzag(getvarint(&data, end));
+        unsigned time = getvarint(&data, end);
+
+        // Acknowledgements can arrive out of date; only ever move forward.
+        client->ack = ack > client->ack && ack <= server->tick ? ack : client->ack;
+        client->idle = 0;
+        client->input.buttons = buttons | (client->input.buttons & InputJump);
+        client->input.mousex += mousex;
+        client->input.mousey += mousey;
+        client->input.time = time;
+    }
+}
+
+// The encoded snapshot for a client, encoding it if nobody with the same baseline needed it yet.
+static const Encoding * encodingfor(Server * server, const ServerClient * client, unsigned * age)
+{
+    const Snapshot * snap = &server->history[server->tick % SnapshotRing];
+    *age = client->ack ? server->tick - (client->ack - 1) : 0;
+    *age = *age < SnapshotRing ? *age : 0;
+    Encoding * encoding = &server->encodings[*age];
+    if (encoding->tick != server->tick + 1)
+    {
+        const Snapshot * base = *age ? &server->history[(server->tick - *age) % SnapshotRing] : NULL;
+        encoding->size = encodesnapshot(base, snap, encoding->data);
+        encoding->tick = server->tick + 1;
+        server->stats.encodings++;
+    }
+    return encoding;
+}
+
+void servertick(Server * server)
+{
+    Uint64 timed = telemetrystart(TimeServer);
+    Uint64 start = SDL_GetPerformanceCounter();
+    server->tick++;
+    readinput(server);
+
+    // The same order as a local game: sectors move, then each player.
+    animatesectors();
+    for (unsigned i = 0; i < MaxClients; i++)
+    {
+        ServerClient * client = &server->clients[i];
+        if (client->active && ++client->idle > ClientTimeout)
+        {
+            transportdrop(server->transport, client->peer);
+            client->active = 0;
+            server->players[i].sector = (unsigned)-1;
+            server->stats.clients--;
+        }
+        if (!client->active)
+        {
+            continue;
+        }
+        player = server->players[i];
+        collisiondetection();
+        handlemovement(&client->input);
+        server->players[i] = player;
+        client->input.buttons &= ~InputJump;
+        client->input.mousex = client->input.mousey = 0;
+    }
+    Uint64 simulated = SDL_GetPerformanceCounter();
+
+    takesnapshot(&server->history[server->tick % SnapshotRing], server->tick, server->players, MaxClients);
+    for (unsigned i = 0; i < MaxClients; i++)
+    {
+        const ServerClient * client = &server->clients[i];
+        if (!client->active)
+        {
+            continue;
+        }
+        unsigned age;
+        const Encoding * encoding = encodingfor(server, client, &age);
+        unsigned char * out = server->message;
+        *out++ = MsgSnapshot;
+        out = putvarint(out, server->tick);
+        out = putvarint(out, age);
+        *out++ = (unsigned char)i;
+        memcpy(out, encoding->data, encoding->size);
+        unsigned size = (unsigned)(out - server->message) + encoding->size;
+        if (transportsend(server->transport, client->peer, server->message, size))
+        {
+            server->stats.snapshots++;
+            server->stats.deltas += age != 0;
+            server->stats.bytes += size;
+        }
+    }
+    Uint64 end = SDL_GetPerformanceCounter();
+
+    server->stats.ticks++;
+    server->stats.simulatems += elapsedms(start, simulated);
+    server->stats.encodems += elapsedms(simulated, end);
+    telemetrycount(CountTicks, 1);
+    telemetrystop(TimeServer, timed);
+}
+
+const ServerStats * serverstats(const Server * server)
+{
+    return &server->stats;
+}
+
+const Snapshot * serversnapshot(const Server * server, unsigned tick)
+{
+    const Snapshot * snap = &server->history[tick % SnapshotRing];
+    return tick && snap->tick == tick ? snap : NULL;
+}
+
+void stopserver(Server * server)
+{
+    if (!server)
+    {
+        return;
+    }
+    setanimationplayers(NULL, 0);
+    for (unsigned t = 0; t < SnapshotRing; t++)
+    {
+        freesnapshot(&server->history[t]);
+        free(server->encodings[t].data);
+    }
+    free(server->message);
+    free(server);
+}
+
+NetClient * startclient(Transport * transport)
+{
+    NetClient * client = calloc(1, sizeof(*client));
+    client->transport = transport;
+    client->slot = MaxClients;
+    for (unsigned t = 0; t < SnapshotRing; t++)
+    {
+        allocsnapshot(&client->history[t]);
+    }
+    return client;
+}
+
+void clientinput(NetClient * client, const InputFrame * input)
+{
+    unsigned char message[32];
+    unsigned char * out = message;
+    *out++ = MsgInput;
+    out = putvarint(out, client->newest);
+    *out++ = input->buttons;
+    out = putvarint(out, zigzag(input->mousex));
+    out = putvarint(out, zigzag(input->mousey));
+    out = putvarint(out, input->time);
+    transportsend(client->transport, 0, message, (unsigned)(out - message));
+}
+
+unsigned clientupdate(NetClient * client)
+{
+    unsigned peer, size, decoded = 0;
+    const unsigned char * data;
+    while ((data = transportreceive(client->transport, &peer, &size)))
+    {
+        const unsigned char * end = data + size;
+        if (size < 4 || *data++ != MsgSnapshot)
+        {
+            continue;
+        }
+        unsigned tick = getvarint(&data, end);
+        unsigned age = getvarint(&data, end);
+        unsigned slot = data < end ? *data++ : MaxClients;
+        if (tick < client->newest || slot >= MaxClients || age >= SnapshotRing)
+        {
+            continue; // Old, or made up
+        }
+
+        // The baseline has to be one we still hold, or this can't be rebuilt.
+        const Snapshot * base = age ? &client->history[(tick - age) % SnapshotRing] : NULL;
+        if (base && base->tick != tick - age)
+        {
+            continue;
+        }
+        Snapshot * snap = &client->history[tick % SnapshotRing];
+        if (!decodesnapshot(base, data, (unsigned)(end - data), snap))
+        {
+            snap->tick = 0;
+            continue;
+        }
+        snap->tick = tick;
+        client->newest = tick + 1;
+        client->slot = slot;
+        decoded++;
+    }
+    return decoded;
+}
+
+const Snapshot * clientsnapshot(const NetClient * client)
+{
+    return client->newest ? &client->history[(client->newest - 1) % SnapshotRing] : NULL;
+}
+
+unsigned clientslot(const NetClient * client)
+{
+    return client->slot;
+}
+
+void stopclient(NetClient * client)
+{
+    if (!client)
+    {
+        return;
+    }
+    for (unsigned t = 0; t < SnapshotRing; t++)
+    {
+        freesnapshot(&client->history[t]);
+    }
+    free(client);
+}
@@ -0,0 +1,63 @@
+#ifndef NETGAME
+#define NETGAME
+
+#include "inputlog.h"
+#include "snapshot.h"
+#include "transport.h"
+
+
+#define ClientTimeout 600 // Ticks without a word before a client's slot is freed
+
+typedef struct serverstats
+{
+    unsigned ticks, clients;                 // Clients: how many are connected now
+    unsigned long long snapshots, deltas;    // Snapshots sent, and how many of them were deltas
+    unsigned long long bytes;                // Snapshot bytes sent
+    unsigned long long encodings;            // Snapshots actually encoded, the rest reuse one of the same baseline
+    double simulatems, encodems;             // Time spent on every tick so far
+} ServerStats;
+
+typedef struct server Server;
+typedef struct netclient NetClient;
+
+/**
+ * startserver: Run the loaded map for whoever connects through transport.
+ * Clients join by sending input and start where the map puts the player.
+ */
+Server * startserver(Transport * transport);
+
+/**
+ * servertick: Read the clients' input, advance the world one tick for every
+ * client and send each one a snapshot. Snapshots are deltas against the
+ * newest one the client has acknowledged while that is still in the
+ * history, and are encoded once per baseline however many clients share it.
+ */
+void servertick(Server * server);
+
+const ServerStats * serverstats(const Server * server);
+
+// The world as the server sent it at a tick still in the history, or NULL.
+const Snapshot * serversnapshot(const Server * server, unsigned tick);
+
+void stopserver(Server * server);
+
+NetClient * startclient(Transport * transport);
+
+// Send one tick of input, together with which snapshot the client has.
+void clientinput(NetClient * client, const InputFrame * input);
+
+/**
+ * clientupdate: Decode every snapshot that has arrived. Returns how many
+ * were new; the newest is clientsnapshot.
+ */
+unsigned clientupdate(NetClient * client);
+
+// The newest snapshot received, or NULL before the first.
+const Snapshot * clientsnapshot(const NetClient * client);
+
+// Which of the snapshot's entities is this client, or MaxClients before the first snapshot.
+unsigned clientslot(const NetClient * client);
+
+void stopclient(NetClient * client);
+
+#endif
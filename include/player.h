@@ -13,6 +13,6 @@ typedef struct player
     EntityState state;
 } Player;
 
-static Player player;
+extern Player player;
 
 #endif
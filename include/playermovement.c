@@ -1,37 +1,92 @@
+#include <math.h>
+
+#include "playermovement.h"
 #include "geometry.h"
 #include "player.h"
 #include "mathlib.h"
+#include "constants.h"
+#include "telemetry.h"
+
+
+Player player;
 
+#define MaxHops 4        // Sectors a single tick's move may cross
+#define EdgeSlack 1e-3f  // How far past an edge rounding may leave the player
+
+// Whether the player fits through the hole from sect into its s'th neighbor.
+static int fits(const Sector * sect, unsigned s, float eyeheight)
+{
+    if (sect->neighbors[s] < 0)
+    {
+        return 0;
+    }
+    // Check height and floor of hole into another sector
+    float hole_low = max(sect->floor, sectors[sect->neighbors[s]].floor);
+    float hole_high = min(sect->ceil, sectors[sect->neighbors[s]].ceil);
+    return hole_high >= player.where.z+HeadMargin && hole_low <= player.where.z-eyeheight+KneeHeight;
+}
+
+// Whether (x,y) is further than EdgeSlack outside the edge from v0 to v1.
+static int beyond(float x, float y, struct xy v0, struct xy v1)
+{
+    float side = PointSide(x, y, v0.x, v0.y, v1.x, v1.y);
+    float xd = v1.x - v0.x, yd = v1.y - v0.y;
+    return side < 0 && side * side > EdgeSlack * EdgeSlack * (xd*xd + yd*yd);
+}
+
+// The sector a move from (px,py) by (dx,dy) ends in, following the end point
+// across portals from sector from, or -1 if it ends beyond a wall. Near a
+// corner one move can cross more than one portal. Sectors are convex, so
+// the end point is in a sector when it is inside every edge. With heights
+// set, holes the player does not fit through count as walls too.
+static int endsector(unsigned from, float px, float py, float dx, float dy, int heights, float eyeheight)
+{
+    float x = px + dx, y = py + dy;
+    unsigned now = from;
+    for (unsigned hop = 0; hop < MaxHops; hop++)
+    {
+        const Sector * const sect = &sectors[now];
+        const struct xy* const vert = sect->vertex;
+        int outside = 0, next = -1;
+        for (unsigned s = 0; s < sect->npoints; s++)
+        {
+            if (beyond(x, y, vert[s], vert[s+1]))
+            {
+                outside = 1;
+                if (sect->neighbors[s] >= 0 && (!heights || fits(sect, s, eyeheight))
+                    && IntersectBox(px,py, x,y, vert[s].x, vert[s].y, vert[s+1].x, vert[s+1].y))
+                {
+                    next = sect->neighbors[s];
+                }
+            }
+        }
+        if (!outside)
+        {
+            return (int)now;
+        }
+        if (next < 0)
+        {
+            return -1;
+        }
+        now = (unsigned)next;
+    }
+    return -1;
+}
 
 /**
  * MovePlayer(dx,dy): Moves the player by (dx,dy) in the map, and
  * also updates their anglesin/anglecos/sector properties properly.
  */
-static void MovePlayer(float dx, float dy)
+void MovePlayer(float dx, float dy)
 {
-    float px = player.where.x, py = player.where.y;
-    
-    // Check if this movement crosses one of this sector's edges
-    // that have a neighboring sector on the other side.
     // Because the edge vertices of each sector are defined in
     // clockwise order, PointSide will always return -1 for a point
     // that is outside the sector and 0 or 1 for a point that is inside.
-    const Sector * const sect = &sectors[player.sector];
-    const struct xy* const vert = sect->vertex;
-    for (unsigned s = 0; s < sect->npoints; ++s)
+    // A move that ends outside every sector keeps the sector it started in.
+    int sector = endsector(player.sector, player.where.x, player.where.y, dx, dy, 0, 0);
+    if (sector >= 0)
     {
-        if
-        (
-            sect->neighbors[s] >= 0
-            // The two 2D boxes would intercect, calculate from.
-            && IntersectBox(px,py, px+dx,py+dy, vert[s].x, vert[s].y, vert[s+1].x, vert[s+1].y)
-            // Make sure we are checking the correct side.
-            && PointSide(px+dx, py+dy, vert[s].x, vert[s].y, vert[s+1].x, vert[s+1].y) < 0
-        )
-        {
-            player.sector = sect->neighbors[s];
-            break;
-        }
+        player.sector = (unsigned)sector;
     }
 
     // Move player
@@ -42,15 +97,24 @@ static void MovePlayer(float dx, float dy)
     player.anglecos = cosf(player.angle);
 }
 
-static void handlemovement(int wasd[4])
+void handlemovement(const InputFrame * input)
 {
+    Uint64 start = telemetrystart(TimeMove);
+    // Jump and duck before aiming, so the view tilt sees the new vertical speed.
+    if (input->buttons & InputJump && player.state.ground)
+    {
+        player.velocity.z += 0.5; player.state.falling = 1;
+    }
+    unsigned ducking = (input->buttons & InputDuck) != 0;
+    if (ducking != player.state.ducking)
+    {
+        player.state.ducking = ducking; player.state.falling = 1;
+    }
     
     // mouse aiming
-    int x, y;
     float yaw = 0;
-    SDL_GetRelativeMouseState(&x,&y);
-    player.angle += x * 0.03f;
-    yaw = clamp(yaw - y*0.05f, -5, 5);
+    player.angle += input->mousex * 0.03f;
+    yaw = clamp(yaw - input->mousey*0.05f, -5, 5);
     player.yaw = yaw - player.velocity.z*0.5f;
     MovePlayer(0, 0); // Currently calculating twice, maybe only need one?
     
@@ -59,31 +123,31 @@ static void handlemovement(int wasd[4])
     float movev[2] = {0.f, 0.f};
     
     // Move forward
-    if (wasd[0])
+    if (input->buttons & InputW)
     {
         movev[0] += player.anglecos*0.2f;
         movev[1] += player.anglesin*0.2f;
     }
     // Move left
-    if (wasd[1])
+    if (input->buttons & InputS)
     {
         movev[0] -= player.anglecos*0.2f;
         movev[1] -= player.anglesin*0.2f;
     }
     // Move back
-    if (wasd[2])
+    if (input->buttons & InputA)
     {
         movev[0] += player.anglesin*0.2f;
         movev[1] -= player.anglecos*0.2f;
     }
     // move foorward
-    if (wasd[3])
+    if (input->buttons & InputD)
     {
         movev[0] -= player.anglesin*0.2f;
         movev[1] += player.anglecos*0.2f;
     }
     
-    int pushing = wasd[0] || wasd[1] || wasd[2] || wasd[3];
+    int pushing = (input->buttons & (InputW | InputS | InputA | InputD)) != 0;
     
     // To keep momentum we want to start reducing speed instead of an abrupt stop.
     float acceleration = pushing ? 0.4 : 0.2;
@@ -95,11 +159,12 @@ static void handlemovement(int wasd[4])
     {
         player.state.moving = 1;
     }
+    telemetrystop(TimeMove, start);
 }
 
-static void collisiondetection()
+void collisiondetection(void)
 {
-    
+    Uint64 start = telemetrystart(TimeCollide);
     float eyeheight = player.state.ducking ? DuckHeight : EyeHeight;
     player.state.ground = !player.state.falling;
     
@@ -150,24 +215,29 @@ static void collisiondetection()
             (
                 IntersectBox(px,py, px+dx,py+dy, vert[s+0].x, vert[s+0].y, vert[s+1].x, vert[s+1].y)
                 && PointSide(px+dx, py+dy, vert[s+0].x, vert[s+0].y, vert[s+1].x, vert[s+1].y) < 0
+                // Check whether we're bumping into a wall.
+                && !fits(sect, s, eyeheight)
             )
             {
-                // Check height and floor of hole into another sector
-                float hole_low = sect->neighbors[s] < 0 ?  9e9 : max(sect->floor, sectors[sect->neighbors[s]].floor);
-                float hole_high = sect->neighbors[s] < 0 ? -9e9 : min(sect->ceil, sectors[sect->neighbors[s]].ceil);
-                
-                // Check whether we're bumping into a wall.
-                if (hole_high < player.where.z+HeadMargin || hole_low  > player.where.z-eyeheight+KneeHeight)
-                {
-                    // Bumps into a wall! Slide along the wall.
-                    // This formula is from Wikipedia article "vector projection".
-                    float xd = vert[s+1].x - vert[s+0].x, yd = vert[s+1].y - vert[s+0].y;
-                    dx = xd * (dx*xd + yd*dy) / (xd*xd + yd*yd);
-                    dy = yd * (dx*xd + yd*dy) / (xd*xd + yd*yd);
-                    player.state.moving = 0;
-                }
+                // Bumps into a wall! Slide along the wall.
+                // This formula is from Wikipedia article "vector projection".
+                float xd = vert[s+1].x - vert[s+0].x, yd = vert[s+1].y - vert[s+0].y;
+                float along = (dx*xd + dy*yd) / (xd*xd + yd*yd);
+                dx = xd * along;
+                dy = yd * along;
+                player.state.moving = 0;
             }
+        // Sliding along one wall can carry the move past its end, through a
+        // portal at the corner and out beyond the next wall, and a player that
+        // rounding left just outside a corner misses the test above. Stop
+        // short instead.
+        if (endsector(player.sector, px, py, dx, dy, 1, eyeheight) < 0)
+        {
+            dx = dy = 0;
+            player.state.moving = 0;
+        }
         MovePlayer(dx, dy);
         player.state.falling = 1;
     }
+    telemetrystop(TimeCollide, start);
 }
@@ -1,12 +1,14 @@
 #ifndef PLAYERMOVEMENT
 #define PLAYERMOVEMENT
 
-#include "playermovement.c"
+#include "inputlog.h"
 
-static void MovePlayer(float dx, float dy);
 
-static void handlemovement(int wasd[4]);
+void MovePlayer(float dx, float dy);
 
-static void collisiondetection(void);
+// Apply one tick of input: aim, jump, duck and walk. Reads nothing but input.
+void handlemovement(const InputFrame * input);
+
+void collisiondetection(void);
 
 #endif
@@ -0,0 +1,223 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "raycast.h"
+#include "geometry.h"
+#include "jobs.h"
+#include "mathlib.h"
+
+
+#define RaysPerJob 64    // Rays one job index casts in a batch
+#define RayEpsilon 1e-4f // Exit distances closer than this are the same crossing
+
+typedef struct raybatch
+{
+    const Ray * rays;
+    RayHit * hits;
+    unsigned count;
+} RayBatch;
+
+// The entities in sector s are entities[entityorder[firstentity[s] .. firstentity[s+1])].
+static const RayEntity * entities = NULL;
+static unsigned * firstentity = NULL;
+static unsigned * entityorder = NULL;
+static unsigned indexedsectors = 0;
+
+void setrayentities(const RayEntity * list, unsigned count)
+{
+    free(firstentity);
+    free(entityorder);
+    entities = NULL;
+    firstentity = NULL;
+    entityorder = NULL;
+    indexedsectors = 0;
+    if (!list || count == 0 || NumSectors == 0)
+    {
+        return;
+    }
+
+    entities = list;
+    indexedsectors = NumSectors;
+    firstentity = calloc(NumSectors + 1, sizeof(*firstentity));
+    entityorder = malloc(sizeof(*entityorder) * count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (list[i].sector < NumSectors)
+        {
+            firstentity[list[i].sector + 1]++;
+        }
+    }
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        firstentity[s + 1] += firstentity[s];
+    }
+    unsigned * fill = malloc(sizeof(*fill) * NumSectors);
+    for (unsigned s = 0; s < NumSectors; s++)
+    {
+        fill[s] = firstentity[s];
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (list[i].sector < NumSectors)
+        {
+            entityorder[fill[list[i].sector]++] = i;
+        }
+    }
+    free(fill);
+}
+
+// Where the ray enters the entity's cylinder, or -1 when it misses. The ray
+// is clipped against the circle in 2D and the height range in z; it hits
+// where both intervals overlap.
+static float hitentity(const RayEntity * e, XYZ from, XYZ dir)
+{
+    float ox = from.x - e->where.x, oy = from.y - e->where.y;
+    float a = dir.x * dir.x + dir.y * dir.y;
+    float b = ox * dir.x + oy * dir.y;
+    float c = ox * ox + oy * oy - e->radius * e->radius;
+    float enter = 0, leave = INFINITY;
+    if (a > 0)
+    {
+        float disc = b * b - a * c;
+        if (disc < 0)
+        {
+            return -1;
+        }
+        float root = sqrtf(disc);
+        enter = (-b - root) / a;
+        leave = (-b + root) / a;
+    }
+    else if (c > 0)
+    {
+        return -1;
+    }
+
+    float bottom = e->where.z, top = e->where.z + e->height;
+    if (dir.z != 0)
+    {
+        float t0 = (bottom - from.z) / dir.z, t1 = (top - from.z) / dir.z;
+        enter = max(enter, min(t0, t1));
+        leave = min(leave, max(t0, t1));
+    }
+    else if (from.z < bottom || from.z > top)
+    {
+        return -1;
+    }
+    enter = max(enter, 0);
+    return enter <= leave ? enter : -1;
+}
+
+RayHit castray(const Ray * ray)
+{
+    float norm = sqrtf(ray->dir.x * ray->dir.x + ray->dir.y * ray->dir.y + ray->dir.z * ray->dir.z);
+    XYZ from = ray->from;
+    XYZ dir = norm > 0 ? (XYZ) {ray->dir.x / norm, ray->dir.y / norm, ray->dir.z / norm} : (XYZ) {0, 0, 0};
+    RayHit hit = {HitNothing, ray->length, {0, 0, 0}, ray->sector, -1};
+    if (ray->sector >= NumSectors)
+    {
+        hit.where = from;
+        return hit;
+    }
+
+    unsigned sector = ray->sector;
+    float start = 0; // Distance at which the ray entered the current sector
+    // Convex sectors are crossed at most once each, so a longer walk means bad geometry.
+    for (unsigned steps = 0; steps <= NumSectors; steps++)
+    {
+        const Sector * const sect = &sectors[sector];
+        const struct xy * const vert = sect->vertex;
+
+        // The side of an edge a point is on changes linearly along the ray, so the
+        // exit is the nearest edge the ray is heading out of. Several edges can lie
+        // on one line (a portal next to a wall); the one holding the crossing wins.
+        int exitedge = -1;
+        float exit = INFINITY;
+        for (unsigned s = 0; s < sect->npoints; s++)
+        {
+            float ex = vert[s+1].x - vert[s].x, ey = vert[s+1].y - vert[s].y;
+            float slope = vxs(ex, ey, dir.x, dir.y);
+            if (slope >= 0)
+            {
+                continue;
+            }
+            float t = -PointSide(from.x, from.y, vert[s].x, vert[s].y, vert[s+1].x, vert[s+1].y) / slope;
+            float along = (from.x + dir.x * t - vert[s].x) * ex + (from.y + dir.y * t - vert[s].y) * ey;
+            int onedge = along >= 0 && along <= ex * ex + ey * ey;
+            if (t < exit - RayEpsilon || (t < exit + RayEpsilon && onedge))
+            {
+                exit = t;
+                exitedge = (int)s;
+            }
+        }
+        exit = max(exit, start);
+        float end = min(exit, ray->length);
+
+        // Anything inside this sector that the ray meets before leaving it.
+        hit.what = HitNothing;
+        hit.distance = end;
+        hit.sector = sector;
+        if (dir.z < 0)
+        {
+            float t = (sect->floor - from.z) / dir.z;
+            if (t <= hit.distance)
+            {
+                hit = (RayHit) {HitFloor, max(t, start), {0, 0, 0}, sector, -1};
+            }
+        }
+        else if (dir.z > 0)
+        {
+            float t = (sect->ceil - from.z) / dir.z;
+            if (t <= hit.distance)
+            {
+                hit = (RayHit) {HitCeiling, max(t, start), {0, 0, 0}, sector, -1};
+            }
+        }
+        if (entities && sector < indexedsectors)
+        {
+            for (unsigned i = firstentity[sector]; i < firstentity[sector + 1]; i++)
+            {
+                float t = hitentity(&entities[entityorder[i]], from, dir);
+                if (t >= start && t <= hit.distance)
+                {
+                    hit = (RayHit) {HitEntity, t, {0, 0, 0}, sector, (int)entityorder[i]};
+                }
+            }
+        }
+        if (hit.what != HitNothing || exitedge < 0 || exit > ray->length)
+        {
+            break;
+        }
+
+        // Leave through the edge: a solid wall, or a portal whose opening the ray misses, stops it.
+        int neighbor = sect->neighbors[exitedge];
+        float z = from.z + dir.z * exit;
+        if (neighbor < 0 || z < sectors[neighbor].floor || z > sectors[neighbor].ceil)
+        {
+            hit = (RayHit) {HitWall, exit, {0, 0, 0}, sector, exitedge};
+            break;
+        }
+        sector = (unsigned)neighbor;
+        start = exit;
+    }
+
+    hit.where = (XYZ) {from.x + dir.x * hit.distance, from.y + dir.y * hit.distance, from.z + dir.z * hit.distance};
+    return hit;
+}
+
+static void castchunk(unsigned index, void * data)
+{
+    const RayBatch * batch = data;
+    unsigned first = index * RaysPerJob;
+    unsigned last = min(first + RaysPerJob, batch->count);
+    for (unsigned i = first; i < last; i++)
+    {
+        batch->hits[i] = castray(&batch->rays[i]);
+    }
+}
+
+void castrays(const Ray * rays, RayHit * hits, unsigned count)
+{
+    RayBatch batch = {rays, hits, count};
+    runjobs((count + RaysPerJob - 1) / RaysPerJob, castchunk, &batch);
+}
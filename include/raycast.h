@@ -0,0 +1,55 @@
+#ifndef RAYCAST
+#define RAYCAST
+
+#include "geometry.h"
+
+
+enum ray_hit {HitNothing, HitWall, HitFloor, HitCeiling, HitEntity};
+
+// Something a ray can hit that isn't level geometry: an upright cylinder
+// standing on where, filed under the sector its feet are in.
+typedef struct rayentity
+{
+    XYZ where;
+    float radius, height;
+    unsigned sector;
+} RayEntity;
+
+// A ray starting at from inside sector, travelling along dir for at most
+// length world units. dir doesn't have to be normalized. Hitscan weapons use
+// a long ray; projectiles cast the segment they move each tick.
+typedef struct ray
+{
+    XYZ from, dir;
+    float length;
+    unsigned sector;
+} Ray;
+
+typedef struct rayhit
+{
+    enum ray_hit what;
+    float distance;  // Along the ray, length when nothing was hit
+    XYZ where;
+    unsigned sector; // Sector the ray was in when it stopped
+    int index;       // Edge of that sector for walls, entity for entities, otherwise -1
+} RayHit;
+
+/**
+ * setrayentities: Use list as the entities rays can hit until the next call.
+ * The list is indexed by sector and must stay alive while rays are cast.
+ * Not safe to call while a cast is running; pass NULL, 0 to clear.
+ */
+void setrayentities(const RayEntity * list, unsigned count);
+
+/**
+ * castray: Walk the ray from its start sector through the portals it passes,
+ * checking floor, ceiling and entities in each sector, and report the first
+ * thing it hits. A portal whose opening is above or below the ray at the
+ * crossing counts as a wall.
+ */
+RayHit castray(const Ray * ray);
+
+// Cast count rays into hits, spread over the job threads.
+void castrays(const Ray * rays, RayHit * hits, unsigned count);
+
+#endif
@@ -1,88 +1,99 @@
 #include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
+#include "renderer.h"
+#include "automap.h"
 #include "color.h"
+#include "material.h"
 #include "geometry.h"
 #include "mathlib.h"
 #include "constants.h"
+#include "player.h"
+#include "jobs.h"
+#include "telemetry.h"
 
 
-static SDL_Renderer * renderer = NULL;
+SDL_Renderer * renderer = NULL;
+enum projection_mode projection = FloatProjection;
+int mipmapping = 1;
+
+// A value interpolated across the columns of a wall in 32.32 fixed point.
+// Only the distance travelled from base is stepped, always upwards, so
+// truncating it rounds towards base just like the float path's division.
+typedef struct columnstep
+{
+    Sint64 at, step;
+    int base, dir;
+} ColumnStep;
+
+#define ColumnValue(c) ((c).base + (c).dir * (int)((c).at >> 32))
+
+// Step from v1 to v2 across a wall width columns wide, starting offset
+// columns in. inv is 1/width. The step is rounded down by at most a unit
+// per column, so starting width+1 units high keeps values that land
+// exactly on a pixel from falling one short.
+static ColumnStep columnstep(int v1, int v2, double inv, int width, int offset)
+{
+    Sint64 delta = (Sint64)v2 - v1;
+    int dir = delta < 0 ? -1 : 1;
+    Sint64 step = (Sint64)((double)(delta * dir) * 4294967296.0 * inv);
+    return (ColumnStep) {step * offset + width + 1, step, v1, dir};
+}
+
+// Where the wall with determinant det and direction (dx, dz) crosses the line
+// from (x3, z3) to (x4, z4). This is Intersect with the wall's terms worked out once.
+static XY clipwall(float det, float dx, float dz, float x3, float z3, float x4, float z4)
+{
+    float edge = vxs(x3, z3, x4, z4);
+    float denom = vxs(dx, dz, x3 - x4, z3 - z4);
+    return (XY) {vxs(det, dx, edge, x3 - x4) / denom, vxs(det, dz, edge, z3 - z4) / denom};
+}
 
 int lerp(int min, int max, int a, int b)
 {
     return min + (max - min) * ((a - min) / (b - max));
 }
 
-// Linear interpolate textures
-// Since we render each sector starting on the left edge with a horizontal edge we want to
-// perform interpolation such that the 2d texture aligns itself with the orientation of the wall.
-//   x, y = (0, 0)  x, y = ( , )
-//   v              /
-//   +----------+ <
-//   |..........|
-//   |..........|
-//   |..........|
-//   +----------+
-//
-//    -----------
-//   /.../       \
-//  /___/ < texture
-// /               \
-//
-SDL_Color linearinterpolate(SDL_Surface * texture, int gx0, int gx1, int gy0, int gy1, int tx0, int tx1, int ty0, int ty1, int ipx, int ipy)
-{
-    // Texture width = 256
-    // Geo width = 700
-    // get the remainder at the end to account for tiling
-    
-    int ty = 0;
-    int tx = 0;
-    
-    if (gy1 != gx0) {
-        tx = ty0 + ((ty1 - ty0) * (ipy - gy0)) / (gy1 - gy0);
-    }
-    
-    if (gx1 != gx0) {
-        ty = tx0 + ((tx1 - tx0) * (ipx - gx0)) / (gx1 - gx0);
+void rendervline(const Framebuffer * fb, int x, int y1, int y2, SDL_Color color, SDL_Color * texture)
+{
+    if (x < 0 || x >= fb->width)
+    {
+        return;
     }
     
-    SDL_Color color;
-    int bpp = texture->format->BytesPerPixel;
-    
-    Uint8 *data = (Uint8 *)texture->pixels + (tx % texture->w) * texture->pitch + (ty % texture->h) * bpp;
-    color.r = data[0];
-    color.g = data[1];
-    color.b = data[2];
-    
-    return color;
-}
-
-void rendervline(int x, int y1, int y2, SDL_Color color, SDL_Color * texture)
-{
     // Render each pixel starting from the top down.
     int col_num = 0;
-    for (unsigned i = y1; i <= y2 || i < 0; i++)
+    Uint32 * column = fb->pixels + x;
+    for (int i = y1; i <= y2; i++)
     {
         // Set the color
         // If it is at the top or bottom point we want to render black to add a boarder.
-        if (i == y1 || i == y2) {
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-        }
-        else {
+        Uint32 pixel = 0xff000000u;
+        if (i != y1 && i != y2) {
             if (texture)
             {
                 color = texture[col_num];
                 col_num++;
             }
-            
-            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, SDL_ALPHA_OPAQUE);
+            pixel = PackColor(color);
         }
         
         // Draw pixel
-        SDL_RenderDrawPoint(renderer, x, i);
+        if (i >= 0 && i < fb->height)
+        {
+            column[i * fb->pitch] = pixel;
+        }
     }
 }
 
+// Scale a color by a sector light level, 256 being full brightness.
+static SDL_Color shade(SDL_Color color, int light)
+{
+    return (SDL_Color) {color.r * light >> 8, color.g * light >> 8, color.b * light >> 8, color.a};
+}
+
 SDL_Color get_color(int * color_num)
 {
     if (*color_num > 4)
@@ -100,47 +111,279 @@ SDL_Color get_color(int * color_num)
     return charcoal;
 }
 
-void drawscreen()
+static void addspan(RenderList * list, Span span)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->spans = realloc(list->spans, list->capacity * sizeof(*list->spans));
+        telemetrycount(CountAllocations, 1);
+    }
+    list->spans[list->count++] = span;
+}
+
+// Queue a sector to draw through a window. The queue is a plain array;
+// when head reaches the end, what is left slides to the front, and only
+// when it is still full does it grow.
+static void queuesector(RenderList * list, unsigned * head, unsigned * tail, Item item)
+{
+    if (*head == list->queuecapacity)
+    {
+        if (*tail > 0)
+        {
+            memmove(list->queue, list->queue + *tail, (*head - *tail) * sizeof(*list->queue));
+            *head -= *tail;
+            *tail = 0;
+        }
+        if (*head == list->queuecapacity)
+        {
+            list->queuecapacity = list->queuecapacity ? list->queuecapacity * 2 : 64;
+            list->queue = realloc(list->queue, list->queuecapacity * sizeof(*list->queue));
+            telemetrycount(CountAllocations, 1);
+        }
+    }
+    list->queue[(*head)++] = item;
+}
+
+static void flatspan(RenderList * list, int x, int y1, int y2, Uint32 pixel)
+{
+    addspan(list, (Span) {(Sint16)x, (Sint16)y1, (Sint16)y2, SpanFlat, 0, pixel, 0, 0, 0, 0, 0, 0});
+}
+
+static void skyspan(RenderList * list, int x, int y1, int y2, Uint32 column)
+{
+    addspan(list, (Span) {(Sint16)x, (Sint16)y1, (Sint16)y2, SpanSky, 0, column, 0, 0, 0, 0, 0, 0});
+}
+
+// The wall of screen column x: the texture column is fixed by x, for a wall
+// span columns wide and height rows tall on screen, and rows advance by a
+// quotient and a remainder so no pixel divides. The mip level is the one
+// whose texels come closest to one per pixel, across or down the wall.
+// Every material lives in the one atlas, so nothing after this depends on
+// which it is.
+// x counts from the screen's left edge, not the wall's, so the texture
+// column wraps several times across the screen. It wraps at the texture's
+// width; the old sampler wrapped at its height, which for the 513 texel
+// wide stone texture put each wrap one texel further off than the last.
+static Span wallspan(int x, const Material * material, const Surface * surface, int span, int height, int light)
+{
+    height = height > 0 ? height : 1;
+    unsigned l = 0;
+    if (mipmapping)
+    {
+        const MipLevel * finest = &material->level[0];
+        unsigned texels = max(finest->height / (unsigned)height, finest->width / (unsigned)span);
+        while ((texels >>= 1) && l + 1 < material->levels)
+        {
+            l++;
+        }
+    }
+    const MipLevel * level = &material->level[l];
+    int width = (int)material->width, rows = (int)level->height;
+    int u = (width * x / span + surface->u) % width;
+    Uint32 column = level->offset + (Uint32)(u * (int)level->width / width);
+    int v = surface->v * rows / (int)material->height;
+    return (Span) {(Sint16)x, 0, 0, SpanWall, (Uint8)l, column, (Uint16)light, (Uint16)rows, (Uint16)v,
+                   (Uint16)(rows / height), rows % height, height};
+}
+
+static void addwall(RenderList * list, Span wall, int y1, int y2)
+{
+    wall.y1 = (Sint16)y1;
+    wall.y2 = (Sint16)y2;
+    addspan(list, wall);
+}
+
+// Fill one span of column x. Flats and walls draw black at both ends, the
+// way rendervline does, and the wall's texture starts just below y1.
+static void rasterspan(const Framebuffer * fb, const Span * span, const int * skyrow)
+{
+    Uint32 * column = fb->pixels + span->x;
+    int y1 = span->y1, y2 = span->y2;
+    if (span->kind == SpanSky)
+    {
+        const Uint32 * sky = Sky + span->source;
+        for (int y = max(y1, 0); y <= min(y2, fb->height - 1); y++)
+        {
+            column[y * fb->pitch] = sky[skyrow[y]];
+        }
+        return;
+    }
+    if (y1 > y2)
+    {
+        return;
+    }
+    if (y1 >= 0 && y1 < fb->height)
+    {
+        column[y1 * fb->pitch] = 0xff000000u;
+    }
+    if (y2 >= 0 && y2 < fb->height)
+    {
+        column[y2 * fb->pitch] = 0xff000000u;
+    }
+    int top = max(y1 + 1, 0), bottom = min(y2 - 1, fb->height - 1);
+    if (span->kind == SpanFlat)
+    {
+        for (int y = top; y <= bottom; y++)
+        {
+            column[y * fb->pitch] = span->source;
+        }
+        return;
+    }
+
+    // Rows clipped off the top still advance the texture.
+    const SDL_Color * texels = Atlas + span->source;
+    int rows = span->rows, height = span->height, light = span->light;
+    Sint64 skipped = (Sint64)(top - (y1 + 1)) * span->extra;
+    int row = (int)(((Sint64)(top - (y1 + 1)) * span->step + skipped / height) % rows);
+    int remainder = (int)(skipped % height);
+    for (int y = top; y <= bottom; y++)
+    {
+        int r = row + span->v;
+        SDL_Color color = texels[(r < rows ? r : r - rows) * AtlasWidth];
+        column[y * fb->pitch] = PackColor(light < 256 ? shade(color, light) : color);
+        row += span->step;
+        remainder += span->extra;
+        if (remainder >= height)
+        {
+            row++;
+            remainder -= height;
+        }
+    }
+}
+
+// Which columns of a view are still open, with room left between ytop and
+// ybottom. The bitmap answers for one column; the tree over it counts the
+// open columns under each node, leaves from size on, so the first or last
+// open column of any range is found in O(log width). A column closes behind
+// a shut door, and also wherever a portal's opening is less than a pixel
+// tall on screen, so even maps without doors close a few per frame.
+typedef struct coverage
+{
+    Uint64 * closed;
+    unsigned * open;
+    int size;
+} Coverage;
+
+static void opencolumns(Coverage * cov, int width)
 {
+    for (int x = 0; x < cov->size; x++)
+    {
+        cov->open[cov->size + x] = x < width;
+    }
+    for (int n = cov->size - 1; n > 0; n--)
+    {
+        cov->open[n] = cov->open[2 * n] + cov->open[2 * n + 1];
+    }
+    memset(cov->closed, 0, sizeof(*cov->closed) * (size_t)((cov->size + 63) / 64));
+}
+
+#define ColumnClosed(cov, x) ((cov)->closed[(x) >> 6] >> ((x) & 63) & 1)
+
+static void closecolumn(Coverage * cov, int x)
+{
+    if (ColumnClosed(cov, x))
+    {
+        return;
+    }
+    cov->closed[x >> 6] |= (Uint64)1 << (x & 63);
+    for (int n = cov->size + x; n > 0; n >>= 1)
+    {
+        cov->open[n]--;
+    }
+}
+
+// The first (or with last set, the last) open column from x1 to x2 under
+// node n, which covers lo to hi. -1 when they are all closed.
+static int findopen(const Coverage * cov, int n, int lo, int hi, int x1, int x2, int last)
+{
+    if (hi < x1 || lo > x2 || cov->open[n] == 0)
+    {
+        return -1;
+    }
+    if (lo == hi)
+    {
+        return lo;
+    }
+    int mid = (lo + hi) / 2;
+    int found = last ? findopen(cov, 2 * n + 1, mid + 1, hi, x1, x2, last) : findopen(cov, 2 * n, lo, mid, x1, x2, last);
+    if (found < 0)
+    {
+        found = last ? findopen(cov, 2 * n, lo, mid, x1, x2, last) : findopen(cov, 2 * n + 1, mid + 1, hi, x1, x2, last);
+    }
+    return found;
+}
+
+void projectview(RenderList * list, int width, int height, const Camera * cam)
+{
+    // The stage only needs the view's size, not its pixels.
+    const Framebuffer size = {NULL, width, height, width};
+    const Framebuffer * fb = &size;
+    list->count = 0;
+    list->tested = list->rejected = 0;
+
     // Use a rendering queue. As we find sectors that needs to render we will add them to the queue.
-    enum { MaxQueue = 32 };
-    Item queue[MaxQueue];
-    Item * head = queue;
-    Item * tail = queue;
-    SDL_Color * color_col = malloc(sizeof(*color_col));
-    size_t color_colbuffersize = sizeof(*color_col);
+    // A big open map can have hundreds of portals in view, so it grows as needed.
+    unsigned head = 0, tail = 0;
     
     // We want to set and store where the top and bottom boarders are for each section at each x cord.
-    int ytop[ScreenWidth] = {0};
-    int ybottom[ScreenWidth];
+    int ytop[fb->width];
+    int ybottom[fb->width];
     
-    for (unsigned x=0; x<ScreenWidth; ++x)
+    for (int x=0; x<fb->width; ++x)
     {
-        ybottom[x] = ScreenHeight - 1;
+        ytop[x] = 0;
+        ybottom[x] = fb->height - 1;
     }
     
-    int renderedsectors[NumSectors];
-
-    for (unsigned n=0; n<NumSectors; ++n)
+    // Columns close once a portal leaves no room between ytop and ybottom.
+    // Nothing further back can show through them, so walls and portals
+    // behind closed columns are skipped without being projected.
+    int leaves = 1;
+    while (leaves < fb->width)
     {
-        renderedsectors[n] = 0;
+        leaves *= 2;
     }
+    Uint64 closed[(leaves + 63) / 64];
+    unsigned open[2 * leaves];
+    Coverage coverage = {closed, open, leaves};
+    opencolumns(&coverage, fb->width);
+    
+    // The field of vision scales with the height of the view.
+    float xfov = HFovScale * fb->height;
+    float yfov = VFovScale * fb->height;
 
-    // Begin whole-screen rendering using the sector where the player currently is.
-    *head = (Item) { player.sector, 0, ScreenWidth-1 };
-    if (++head == queue+MaxQueue)
+    // The sky turns with the camera and nothing else, so which column of it
+    // each screen column shows is set once. The rows are the raster stage's.
+    Uint32 skycolumn[Sky ? fb->width : 1];
+    for (int x = 0; Sky && x < fb->width; x++)
     {
-        head = queue;
+        float turns = (cam->angle + atanf((x - fb->width / 2) / xfov)) / (2 * (float)M_PI);
+        skycolumn[x] = (unsigned)((turns - floorf(turns)) * SkyTurn) % SkyWidth * SkyHeight;
     }
+    
+    // Every sector drawn this frame, handed to the visited set at the end.
+    // Only their counts are cleared afterwards, never the whole map's.
+    if (list->numseen != NumSectors)
+    {
+        free(list->seen);
+        free(list->drawn);
+        list->seen = calloc(NumSectors, sizeof(*list->seen));
+        list->drawn = malloc(sizeof(*list->drawn) * NumSectors);
+        list->numseen = NumSectors;
+        telemetrycount(CountAllocations, 2);
+    }
+    int * renderedsectors = list->seen;
+    unsigned * drawnsectors = list->drawn;
+    unsigned numdrawn = 0;
+
+    // Begin whole-screen rendering using the sector where the player currently is.
+    queuesector(list, &head, &tail, (Item) { cam->sector, 0, fb->width-1 });
 
     do
     {
         // Pick a sector & slice from the queue to drawl
-        const Item now = *tail;
-        if (++tail == queue+MaxQueue)
-        {
-            tail = queue;
-        }
+        const Item now = list->queue[tail++];
 
         // Use bitwise operator to see if we need to give up.
         if (renderedsectors[now.sectorno] & 0x21)
@@ -148,8 +391,27 @@ void drawscreen()
             continue;
         }
         
+        // A sector seen only through closed columns can't be seen at all.
+        list->tested += (unsigned)(now.sx2 - now.sx1 + 1);
+        if (findopen(&coverage, 1, 0, leaves - 1, now.sx1, now.sx2, 0) < 0)
+        {
+            list->rejected += (unsigned)(now.sx2 - now.sx1 + 1);
+            continue;
+        }
+        
+        if (renderedsectors[now.sectorno] == 0)
+        {
+            drawnsectors[numdrawn++] = now.sectorno;
+        }
         ++renderedsectors[now.sectorno];
         const Sector * sect = &sectors[now.sectorno];
+        // Fully lit sectors skip shading altogether.
+        int light = clamp((int)(sect->light * 256), 0, 256);
+        SDL_Color sect_ceil = sect->ceiltexture >= 0 ? materials[sect->ceiltexture].average : ceil_color;
+        SDL_Color sect_floor = sect->floortexture >= 0 ? materials[sect->floortexture].average : floor_color;
+        sect_ceil = light < 256 ? shade(sect_ceil, light) : sect_ceil;
+        sect_floor = light < 256 ? shade(sect_floor, light) : sect_floor;
+        Uint32 ceilpixel = PackColor(sect_ceil), floorpixel = PackColor(sect_floor);
         int color_num = -1;
         for (unsigned s = 0; s < sect->npoints; s++)
         {
@@ -162,10 +424,10 @@ void drawscreen()
             // .......<-.L_____
             // ....--P...|.....
             // ..t.......V.....
-            float vx1 = sect->vertex[s].x - player.where.x;
-            float vx2 = sect->vertex[s+1].x - player.where.x;
-            float vy1 = sect->vertex[s].y - player.where.y;
-            float vy2 = sect->vertex[s+1].y - player.where.y;
+            float vx1 = sect->vertex[s].x - cam->where.x;
+            float vx2 = sect->vertex[s+1].x - cam->where.x;
+            float vy1 = sect->vertex[s].y - cam->where.y;
+            float vy2 = sect->vertex[s+1].y - cam->where.y;
                 
             // Rotate the room to the correct orientation.
             // P == player, -- == orientation,  /  == vertex (at intersection)
@@ -190,8 +452,8 @@ void drawscreen()
             // 0|P)8.........................
             //  L-----------------------------
             //   0 x -->
-            float pcos = player.anglecos;
-            float psin = player.anglesin;
+            float pcos = cam->anglecos;
+            float psin = cam->anglesin;
             
             float tx1 = vx1 * psin - vy1 * pcos;
             float tz1 = vx1 * pcos + vy1 * psin;
@@ -210,8 +472,9 @@ void drawscreen()
                 float nearz = 1e-4f, farz = 5, nearside = 1e-5f, farside = 20.f;
 
                 // Find the intersection between the player view and visable wall
-                XY i1 = Intersect(tx1, tz1, tx2, tz2, -nearside, nearz, -farside, farz);
-                XY i2 = Intersect(tx1, tz1, tx2, tz2, nearside, nearz, farside, farz);
+                float det = vxs(tx1, tz1, tx2, tz2);
+                XY i1 = clipwall(det, tx1 - tx2, tz1 - tz2, -nearside, nearz, -farside, farz);
+                XY i2 = clipwall(det, tx1 - tx2, tz1 - tz2, nearside, nearz, farside, farz);
                 if (tz1 < nearz)
                 {
                     if (i1.y > 0)
@@ -243,13 +506,25 @@ void drawscreen()
             // Perform the perspective transformation.
             // This will make sure the correct field of view is being used.
             // TOOD: Adjustible FOV
-            float xscale1 = hfov / tz1;
-            float yscale1 = vfov / tz1;
-            float xscale2 = hfov / tz2;
-            float yscale2 = vfov / tz2;
+            float xscale1, yscale1, xscale2, yscale2;
+            if (projection == FixedProjection)
+            {
+                float rz1 = 1 / tz1, rz2 = 1 / tz2;
+                xscale1 = xfov * rz1;
+                yscale1 = yfov * rz1;
+                xscale2 = xfov * rz2;
+                yscale2 = yfov * rz2;
+            }
+            else
+            {
+                xscale1 = xfov / tz1;
+                yscale1 = yfov / tz1;
+                xscale2 = xfov / tz2;
+                yscale2 = yfov / tz2;
+            }
 
-            int x1 = ScreenWidth / 2 - (int)(tx1 * xscale1);
-            int x2 = ScreenWidth / 2 - (int)(tx2 * xscale2);
+            int x1 = fb->width / 2 - (int)(tx1 * xscale1);
+            int x2 = fb->width / 2 - (int)(tx2 * xscale2);
             
             if (x1 >= x2 || x2 < now.sx1 || x1 > now.sx2)
             {
@@ -257,9 +532,11 @@ void drawscreen()
             }
             
             int neighbor = sect->neighbors[s];
+            const Surface * surface = &sect->surfaces[s];
+            const Material * material = &materials[surface->texture];
 
-            float yceil = sect->ceil - player.where.z;
-            float yfloor = sect->floor - player.where.z;
+            float yceil = sect->ceil - cam->where.z;
+            float yfloor = sect->floor - cam->where.z;
             
             
             // Get the floor and ceil and transform around player view.
@@ -269,100 +546,461 @@ void drawscreen()
             // Is another sector showing through this portal?
             if (neighbor >= 0)
             {
-                nyceil  = sectors[neighbor].ceil  - player.where.z;
-                nyfloor = sectors[neighbor].floor - player.where.z;
+                nyceil  = sectors[neighbor].ceil  - cam->where.z;
+                nyfloor = sectors[neighbor].floor - cam->where.z;
             }
             
             // Project our ceiling & floor heights into screen coordinates (Y coordinate)
-            #define Yaw(y,z) (y + z * player.yaw)
+            #define Yaw(y,z) (y + z * cam->yaw)
             
-            int y1a = ScreenHeight / 2 - (int)(Yaw(yceil, tz1) * yscale1);
-            int y1b = ScreenHeight / 2 - (int)(Yaw(yfloor, tz1) * yscale1);
-            int y2a = ScreenHeight / 2 - (int)(Yaw(yceil, tz2) * yscale2);
-            int y2b = ScreenHeight / 2 - (int)(Yaw(yfloor, tz2) * yscale2);
+            int y1a = fb->height / 2 - (int)(Yaw(yceil, tz1) * yscale1);
+            int y1b = fb->height / 2 - (int)(Yaw(yfloor, tz1) * yscale1);
+            int y2a = fb->height / 2 - (int)(Yaw(yceil, tz2) * yscale2);
+            int y2b = fb->height / 2 - (int)(Yaw(yfloor, tz2) * yscale2);
             
             // The same for the neighboring sector
-            int ny1a = ScreenHeight / 2 - (int)(Yaw(nyceil, tz1) * yscale1);
-            int ny1b = ScreenHeight / 2 - (int)(Yaw(nyfloor, tz1) * yscale1);
-            int ny2a = ScreenHeight / 2 - (int)(Yaw(nyceil, tz2) * yscale2);
-            int ny2b = ScreenHeight / 2 - (int)(Yaw(nyfloor, tz2) * yscale2);
+            int ny1a = fb->height / 2 - (int)(Yaw(nyceil, tz1) * yscale1);
+            int ny1b = fb->height / 2 - (int)(Yaw(nyfloor, tz1) * yscale1);
+            int ny2a = fb->height / 2 - (int)(Yaw(nyceil, tz2) * yscale2);
+            int ny2b = fb->height / 2 - (int)(Yaw(nyfloor, tz2) * yscale2);
             
             
 
             int beginx = max(x1, now.sx1);
             int endx = min(x2, now.sx2);
             
-            // To add a temp astetic I'm coloring each wall based on the side. We alternate between five colors.
-            SDL_Color wall_color;
-            for (int x = beginx; x <= endx && x <= ScreenWidth; x++)
+            // Trim closed columns off both ends, giving up on the wall if none are left.
+            int openx1 = findopen(&coverage, 1, 0, leaves - 1, beginx, endx, 0);
+            int openx2 = openx1 < 0 ? -1 : findopen(&coverage, 1, 0, leaves - 1, beginx, endx, 1);
+            list->tested += (unsigned)(endx - beginx + 1);
+            list->rejected += (unsigned)(openx1 < 0 ? endx - beginx + 1 : (openx1 - beginx) + (endx - openx2));
+            if (openx1 < 0)
+            {
+                continue;
+            }
+            beginx = openx1;
+            endx = openx2;
+            
+            // The fixed point path steps every per-column value from beginx on.
+            double inv = 1.0 / (x2 - x1);
+            ColumnStep yas = columnstep(y1a, y2a, inv, x2 - x1, beginx - x1);
+            ColumnStep ybs = columnstep(y1b, y2b, inv, x2 - x1, beginx - x1);
+            ColumnStep nyas = columnstep(ny1a, ny2a, inv, x2 - x1, beginx - x1);
+            ColumnStep nybs = columnstep(ny1b, ny2b, inv, x2 - x1, beginx - x1);
+            
+            for (int x = beginx; x <= endx && x < fb->width; x++)
             {
                 // Render the wall!
                 
-                // Calculate the Z coordinate for this point. (Only used for lighting.)
-                int z = ((x - x1) * (tz2-tz1) / (x2-x1) + tz1) * 8;
                 // Acquire the Y coordinates for our ceiling & floor for this X coordinate. Clamp them.
-                int ya = (x - x1) * (y2a-y1a) / (x2-x1) + y1a;
-                int yb = (x - x1) * (y2b-y1b) / (x2-x1) + y1b;
+                int ya, yb, nya, nyb;
+                if (projection == FixedProjection)
+                {
+                    ya = ColumnValue(yas);
+                    yb = ColumnValue(ybs);
+                    nya = ColumnValue(nyas);
+                    nyb = ColumnValue(nybs);
+                    yas.at += yas.step;
+                    ybs.at += ybs.step;
+                    nyas.at += nyas.step;
+                    nybs.at += nybs.step;
+                }
+                else
+                {
+                    // Widen before multiplying: near walls project far off screen.
+                    ya = (int)((Sint64)(x - x1) * (y2a-y1a) / (x2-x1)) + y1a;
+                    yb = (int)((Sint64)(x - x1) * (y2b-y1b) / (x2-x1)) + y1b;
+                    nya = (int)((Sint64)(x - x1) * (ny2a-ny1a) / (x2-x1)) + ny1a;
+                    nyb = (int)((Sint64)(x - x1) * (ny2b-ny1b) / (x2-x1)) + ny1b;
+                }
                 
+                if (ColumnClosed(&coverage, x))
+                {
+                    list->rejected++;
+                    continue;
+                }
                 
                 int cya = clamp(ya, ytop[x], ybottom[x]); // top
                 int cyb = clamp(yb, ytop[x], ybottom[x]); // bottom
                 
                 
                 // Render ceiling: everything above this sector's ceiling height.
-                rendervline(x, ytop[x], cya, ceil_color, NULL);
-                // Render floor: everything below this sector's floor height.
-                rendervline(x, cyb, ybottom[x], floor_color, NULL);
-                
-                size_t new_buffer_size = sizeof(*color_col) * (cyb - cya);
-                if (new_buffer_size > color_colbuffersize) {
-                    color_col = realloc(color_col, new_buffer_size);
+                if (sect->sky)
+                {
+                    skyspan(list, x, ytop[x], cya, skycolumn[x]);
                 }
-                for (int i = 0; i < cyb - cya; i++)
+                else
                 {
-                    // linearinterpolate(SDL_Surface * texture, int gx0, int gx1, int gy0, int gy1, int tx0, int tx1, int ty0, int ty1, int ipx, int ipy)
-//                    printf("%f %f %d %d\n", x1, x2, cya, cyb);
-                    color_col[i] = linearinterpolate(images[0], 0, x2 - x1, 0, yb - ya, 0, images[0]->w, 0, images[0]->h, x, i);
+                    flatspan(list, x, ytop[x], cya, ceilpixel);
                 }
+                // Render floor: everything below this sector's floor height.
+                flatspan(list, x, cyb, ybottom[x], floorpixel);
+                
+                Span wall = wallspan(x, material, surface, x2 - x1, yb - ya, light);
                 
                 // Check to see if there is another sector behind an edge
                 if (neighbor >= 0)
                 {
                     // Same for _their_ floor and ceiling
-                    int nya = (x - x1) * (ny2a-ny1a) / (x2-x1) + ny1a;
                     int cnya = clamp(nya, ytop[x], ybottom[x]);
-                    int nyb = (x - x1) * (ny2b-ny1b) / (x2-x1) + ny1b;
                     int cnyb = clamp(nyb, ytop[x], ybottom[x]);
                     
                     // If our ceiling is higher than their ceiling, render upper wall
-                    unsigned r1 = 0x010101 * (255-z), r2 = 0x040007 * (31-z/8);
-                    rendervline(x, cya, cnya, wall_color, color_col); // Between our and their ceiling
+                    if (sect->sky && sectors[neighbor].sky)
+                    {
+                        // Two skies meet with no wall in between.
+                        skyspan(list, x, cya, cnya, skycolumn[x]);
+                    }
+                    else
+                    {
+                        addwall(list, wall, cya, cnya); // Between our and their ceiling
+                    }
 
-                    ytop[x] = clamp(max(cya, cnya), ytop[x], ScreenHeight-1);   // Shrink the remaining window below these ceilings
+                    ytop[x] = clamp(max(cya, cnya), ytop[x], fb->height-1);   // Shrink the remaining window below these ceilings
                     // If our floor is lower than their floor, render bottom wall
-                    rendervline(x, cnyb+1, cyb, wall_color, color_col); // Between their and our floor
+                    addwall(list, wall, cnyb+1, cyb); // Between their and our floor
                     ybottom[x] = clamp(min(cyb, cnyb), 0, ybottom[x]); // Shrink the remaining window above these floors
+                    if (ytop[x] >= ybottom[x])
+                    {
+                        closecolumn(&coverage, x);
+                    }
                 }
                 else
                 {
-                    if (x == beginx || x == endx)
-                    {
-                        wall_color = (SDL_Color){0, 0, 0, 255};
-                    }
                     // Render the wall of the sector
-                    rendervline(x, cya, cyb, wall_color, color_col);
+                    addwall(list, wall, cya, cyb);
                 }
             }
             
             // Schedule the neighboring sector for rendering within the window formed by this wall.
-            if (neighbor >= 0 && endx >= beginx && (head + MaxQueue + 1 - tail) % MaxQueue)
+            if (neighbor >= 0 && endx >= beginx)
             {
-                *head = (Item) { neighbor, beginx, endx };
-                if(++head == queue+MaxQueue) head = queue;
+                queuesector(list, &head, &tail, (Item) { neighbor, beginx, endx });
             }
         }
         ++renderedsectors[now.sectorno];
     } while (head != tail);
-    free(color_col);
-    SDL_RenderPresent(renderer);
+    MarkVisited(drawnsectors, numdrawn);
+    telemetrycount(CountSectors, numdrawn);
+    for (unsigned n = 0; n < numdrawn; n++)
+    {
+        renderedsectors[drawnsectors[n]] = 0;
+    }
+}
+
+void rasterview(const Framebuffer * fb, const RenderList * list, int x1, int x2)
+{
+    // Which row of the sky each screen row shows only depends on the view's height.
+    int skyrow[Sky ? fb->height : 1];
+    for (int y = 0; Sky && y < fb->height; y++)
+    {
+        skyrow[y] = (int)((unsigned)y * SkyHeight / (unsigned)fb->height);
+    }
+    for (unsigned i = 0; i < list->count; i++)
+    {
+        const Span * span = &list->spans[i];
+        if (span->x >= x1 && span->x <= x2)
+        {
+            rasterspan(fb, span, skyrow);
+        }
+    }
+}
+
+void freerenderlist(RenderList * list)
+{
+    free(list->spans);
+    free(list->queue);
+    free(list->seen);
+    free(list->drawn);
+    *list = (RenderList) {NULL, 0, 0, 0, 0, NULL, 0, NULL, NULL, 0};
+}
+
+void renderline(const Framebuffer * fb, int x0, int y0, int x1, int y1, SDL_Color color)
+{
+    // Bresenham: step along the major axis, carrying the error along the minor one.
+    Uint32 pixel = PackColor(color);
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    for (;;)
+    {
+        if (x0 >= 0 && x0 < fb->width && y0 >= 0 && y0 < fb->height)
+        {
+            fb->pixels[y0 * fb->pitch + x0] = pixel;
+        }
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// Blend color over a pixel with coverage alpha (0-256). Red and blue share one multiply.
+static void blendpixel(const Framebuffer * fb, int x, int y, Uint32 color, Uint32 alpha)
+{
+    if ((unsigned)x >= (unsigned)fb->width || (unsigned)y >= (unsigned)fb->height)
+    {
+        return;
+    }
+    Uint32 * pixel = &fb->pixels[y * fb->pitch + x];
+    Uint32 rb = ((*pixel & 0xff00ff) * (256 - alpha) + (color & 0xff00ff) * alpha) >> 8;
+    Uint32 g = ((*pixel & 0xff00) * (256 - alpha) + (color & 0xff00) * alpha) >> 8;
+    *pixel = 0xff000000u | (rb & 0xff00ff) | (g & 0xff00);
+}
+
+// Liang-Barsky: clip the segment to the framebuffer. Returns 0 when nothing is left.
+static int clipline(const Framebuffer * fb, float * x0, float * y0, float * x1, float * y1)
+{
+    float dx = *x1 - *x0, dy = *y1 - *y0;
+    float p[4] = {-dx, dx, -dy, dy};
+    float q[4] = {*x0, fb->width - 1 - *x0, *y0, fb->height - 1 - *y0};
+    float t0 = 0, t1 = 1;
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] == 0)
+        {
+            if (q[i] < 0)
+            {
+                return 0;
+            }
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0)
+        {
+            t0 = max(t0, t);
+        }
+        else
+        {
+            t1 = min(t1, t);
+        }
+        if (t0 > t1)
+        {
+            return 0;
+        }
+    }
+    *x1 = *x0 + t1 * dx;
+    *y1 = *y0 + t1 * dy;
+    *x0 += t0 * dx;
+    *y0 += t0 * dy;
+    return 1;
+}
+
+void renderaaline(const Framebuffer * fb, float x0, float y0, float x1, float y1, SDL_Color color)
+{
+    if (!clipline(fb, &x0, &y0, &x1, &y1))
+    {
+        return;
+    }
+    
+    // Xiaolin Wu: walk the major axis one pixel at a time and split each step
+    // between the two pixels straddling the line on the minor axis. The minor
+    // coordinate is carried in 16.16 fixed point so the loop has no float math.
+    int steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+    if (steep)
+    {
+        float t = x0; x0 = y0; y0 = t;
+        t = x1; x1 = y1; y1 = t;
+    }
+    if (x0 > x1)
+    {
+        float t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+    
+    float gradient = x1 - x0 > 0 ? (y1 - y0) / (x1 - x0) : 0;
+    int xstart = (int)floorf(x0 + 0.5f);
+    int xend = (int)floorf(x1 + 0.5f);
+    Sint32 intery = (Sint32)((y0 + gradient * (xstart - x0)) * 65536.f);
+    Sint32 step = (Sint32)(gradient * 65536.f);
+    Uint32 pixel = PackColor(color);
+    for (int x = xstart; x <= xend; x++, intery += step)
+    {
+        int y = intery >> 16;
+        Uint32 frac = (intery >> 8) & 0xff;
+        if (steep)
+        {
+            blendpixel(fb, y, x, pixel, 256 - frac);
+            blendpixel(fb, y + 1, x, pixel, frac);
+        }
+        else
+        {
+            blendpixel(fb, x, y, pixel, 256 - frac);
+            blendpixel(fb, x, y + 1, pixel, frac);
+        }
+    }
+}
+
+// Project a world position into an orthographic view. Top looks down the z axis,
+// Front down the y axis and Side down the x axis.
+static SDL_Point orthoproject(const Framebuffer * fb, enum view_perspective per, const Camera * cam, float x, float y, float z)
+{
+    float across = per == Side ? y - cam->where.y : x - cam->where.x;
+    float up = per == Top ? y - cam->where.y : z - cam->where.z;
+    return (SDL_Point) {fb->width / 2 + (int)(across * cam->zoom), fb->height / 2 - (int)(up * cam->zoom)};
+}
+
+// Wireframe of the map for the front and side editor views, drawn straight from the shared wall list.
+static void drawortho(const Framebuffer * fb, enum view_perspective per, const Camera * cam)
+{
+    clearframe(fb, charcoal);
+    
+    for (unsigned w = 0; w < NumWalls; w++)
+    {
+        const Wall * wall = &walls[w];
+        SDL_Color color = wall->neighbor < 0 ? orang_yellow : pers_green;
+        
+        // From the front or side a wall is its floor and ceiling edge, plus the
+        // vertical edges when it is solid.
+        SDL_Point af = orthoproject(fb, per, cam, wall->a.x, wall->a.y, wall->floor);
+        SDL_Point bf = orthoproject(fb, per, cam, wall->b.x, wall->b.y, wall->floor);
+        SDL_Point ac = orthoproject(fb, per, cam, wall->a.x, wall->a.y, wall->ceil);
+        SDL_Point bc = orthoproject(fb, per, cam, wall->b.x, wall->b.y, wall->ceil);
+        renderline(fb, af.x, af.y, bf.x, bf.y, color);
+        renderline(fb, ac.x, ac.y, bc.x, bc.y, color);
+        if (wall->neighbor < 0)
+        {
+            renderline(fb, af.x, af.y, ac.x, ac.y, color);
+            renderline(fb, bf.x, bf.y, bc.x, bc.y, color);
+        }
+    }
+    
+    // Mark the player from their feet to their eyes.
+    SDL_Point eye = orthoproject(fb, per, cam, player.where.x, player.where.y, player.where.z);
+    SDL_Point feet = orthoproject(fb, per, cam, player.where.x, player.where.y, sectors[player.sector].floor);
+    renderline(fb, eye.x, eye.y, feet.x, feet.y, burnt_sen);
+    renderline(fb, eye.x - 2, eye.y, eye.x + 2, eye.y, burnt_sen);
+}
+
+void drawscreen(const Framebuffer * fb, const Viewport * view, const Camera * cam)
+{
+    Framebuffer target = subframe(fb, view->screen_x, view->screen_y, view->width, view->height);
+    if (target.width <= 0 || target.height <= 0)
+    {
+        return;
+    }
+    
+    if (view->per == FirstPerson)
+    {
+        RenderList list = {NULL, 0, 0, 0, 0, NULL, 0, NULL, NULL, 0};
+        projectview(&list, target.width, target.height, cam);
+        rasterview(&target, &list, 0, target.width - 1);
+        freerenderlist(&list);
+    }
+    else if (view->per == Top)
+    {
+        drawautomap(&target, cam);
+    }
+    else
+    {
+        drawortho(&target, view->per, cam);
+    }
+}
+
+RenderStats renderstats = {0};
+
+// One span list per view, kept from frame to frame so they stop growing.
+static RenderList * lists = NULL;
+static int numlists = 0;
+
+typedef struct viewjobs
+{
+    const Framebuffer * fb;
+    const Viewport * views;
+    const Camera * cams;
+    unsigned strips;    // Column strips each first person view is rastered in
+} ViewJobs;
+
+static void projectjob(unsigned index, void * data)
+{
+    const ViewJobs * jobs = data;
+    const Viewport * view = &jobs->views[index];
+    Framebuffer target = subframe(jobs->fb, view->screen_x, view->screen_y, view->width, view->height);
+    lists[index].count = 0;
+    if (view->per == FirstPerson && target.width > 0 && target.height > 0)
+    {
+        projectview(&lists[index], target.width, target.height, &jobs->cams[index]);
+    }
+}
+
+static void rasterjob(unsigned index, void * data)
+{
+    const ViewJobs * jobs = data;
+    unsigned v = index / jobs->strips, strip = index % jobs->strips;
+    const Viewport * view = &jobs->views[v];
+    if (view->per != FirstPerson)
+    {
+        // The map views are drawn whole, by the first strip.
+        if (strip == 0)
+        {
+            drawscreen(jobs->fb, view, &jobs->cams[v]);
+        }
+        return;
+    }
+    Framebuffer target = subframe(jobs->fb, view->screen_x, view->screen_y, view->width, view->height);
+    int x1 = (int)(target.width * strip / jobs->strips);
+    int x2 = (int)(target.width * (strip + 1) / jobs->strips) - 1;
+    if (target.height > 0 && x1 <= x2)
+    {
+        rasterview(&target, &lists[v], x1, x2);
+    }
+}
+
+void drawviews(const Framebuffer * fb, const Viewport * views, const Camera * cams, int num_views)
+{
+    // Pick up what the previous frame discovered while no view is running.
+    updateautomap();
+    if (num_views <= 0)
+    {
+        return;
+    }
+    if (num_views > numlists)
+    {
+        lists = realloc(lists, sizeof(*lists) * num_views);
+        telemetrycount(CountAllocations, 1);
+        for (int i = numlists; i < num_views; i++)
+        {
+            lists[i] = (RenderList) {NULL, 0, 0, 0, 0, NULL, 0, NULL, NULL, 0};
+        }
+        numlists = num_views;
+    }
+    
+    // Viewports never overlap and columns of a view never interact, so the
+    // views project in parallel, then every strip of every view rasters in parallel.
+    ViewJobs jobs = {fb, views, cams, jobthreads()};
+    Uint64 timed = telemetrystart(TimeRender);
+    Uint64 start = SDL_GetPerformanceCounter();
+    runjobs((unsigned)num_views, projectjob, &jobs);
+    Uint64 projected = SDL_GetPerformanceCounter();
+    runjobs((unsigned)num_views * jobs.strips, rasterjob, &jobs);
+    Uint64 end = SDL_GetPerformanceCounter();
+    telemetrystop(TimeRender, timed);
+    
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    renderstats.frames++;
+    renderstats.projectms += (double)(projected - start) * 1000.0 / frequency;
+    renderstats.rasterms += (double)(end - projected) * 1000.0 / frequency;
+    for (int i = 0; i < num_views; i++)
+    {
+        renderstats.spans += lists[i].count;
+        telemetrycount(CountSpans, lists[i].count);
+        renderstats.testedcolumns += lists[i].tested;
+        renderstats.rejectedcolumns += lists[i].rejected;
+        for (unsigned s = 0; s < lists[i].count; s++)
+        {
+            const Span * span = &lists[i].spans[s];
+            renderstats.levelpixels[span->level] += span->kind == SpanWall && span->y2 > span->y1 ? (unsigned)(span->y2 - span->y1 - 1) : 0;
+        }
+    }
 }
@@ -3,11 +3,101 @@
 
 #include <SDL2/SDL.h>
 
-#include "renderer.c"
+#include "framebuffer.h"
+#include "material.h"
+#include "viewport.h"
 
 
-void rendervline(int x, int y1, int y2, SDL_Color middle, SDL_Color * texture);
+extern SDL_Renderer * renderer;
 
-void drawscreen(void);
+// How the first person view projects walls and steps across their columns.
+// FloatProjection divides per column; FixedProjection takes one reciprocal per
+// wall and steps 32.32 fixed point, landing within a pixel of the float path.
+// The fixed path measures no faster than the float one, so float is the
+// default; the benchmark and the golden-image test run both.
+enum projection_mode {FloatProjection, FixedProjection};
+
+extern enum projection_mode projection;
+
+// With mipmapping on each wall column samples the mip level whose texels come
+// closest to one per pixel. Off, every wall samples its finest level.
+extern int mipmapping;
+
+// What a span fills its rows with.
+enum span_kind {SpanFlat, SpanSky, SpanWall};
+
+// One run of a screen column, everything the raster stage needs to fill it
+// without looking at the camera or the sectors. Flat and wall spans draw a
+// black border at y1 and y2, sky spans run edge to edge.
+typedef struct span
+{
+    Sint16 x, y1, y2;     // Column, and the rows from top to bottom inclusive
+    Uint8 kind;
+    Uint8 level;          // Wall: mip level sampled
+    Uint32 source;        // Flat: the packed colour. Sky: Sky index of the column. Wall: atlas index of the texture column's top
+    Uint16 light;         // Wall: sector light, 256 being full brightness
+    Uint16 rows;          // Wall: texture height, where v wraps
+    Uint16 v, step;       // Wall: first texture row and rows per pixel
+    int extra, height;    // Wall: the step's remainder out of height, the wall's height on screen
+} Span;
+
+// The spans of one first person view in the order they are drawn. Later
+// spans overwrite earlier ones in the same column; columns never interact.
+typedef struct renderlist
+{
+    Span * spans;
+    unsigned count, capacity;
+    unsigned tested, rejected;  // Columns of walls and sectors checked, and those skipped as closed
+    // Scratch the visibility stage keeps from frame to frame, so a frame
+    // costs the sectors in view and not the size of the map.
+    Item * queue;               // Portal windows still to draw, grown when full
+    unsigned queuecapacity;
+    int * seen;                 // Times each sector was entered this frame, all 0 between frames
+    unsigned * drawn;           // The sectors entered, in order
+    unsigned numseen;           // Sectors seen and drawn have room for
+} RenderList;
+
+// Time drawviews spent in each stage, summed over the frames drawn.
+typedef struct renderstats
+{
+    unsigned frames;
+    unsigned long long spans;
+    double projectms, rasterms;
+    unsigned long long levelpixels[MaxMipLevels]; // Wall pixels drawn from each mip level
+    unsigned long long testedcolumns, rejectedcolumns; // Checked against the coverage, and found closed
+} RenderStats;
+
+extern RenderStats renderstats;
+
+
+void rendervline(const Framebuffer * fb, int x, int y1, int y2, SDL_Color middle, SDL_Color * texture);
+
+void renderline(const Framebuffer * fb, int x0, int y0, int x1, int y1, SDL_Color color);
+
+// Anti-aliased line, clipped to the framebuffer.
+void renderaaline(const Framebuffer * fb, float x0, float y0, float x1, float y1, SDL_Color color);
+
+/**
+ * projectview: The visibility stage. Walk the portals from the camera's
+ * sector and fill list with the spans of a width x height first person view.
+ * Touches no pixels, so it can run while another list is rastered.
+ */
+void projectview(RenderList * list, int width, int height, const Camera * cam);
+
+/**
+ * rasterview: The raster stage. Fill columns x1 to x2 of fb from the spans
+ * of list. Disjoint column ranges can be rastered in parallel.
+ */
+void rasterview(const Framebuffer * fb, const RenderList * list, int x1, int x2);
+
+void freerenderlist(RenderList * list);
+
+// Render one viewport of fb from the camera.
+void drawscreen(const Framebuffer * fb, const Viewport * view, const Camera * cam);
+
+// Render every viewport: first the visibility of every first person view in
+// parallel, then the raster stage in column strips across the job threads.
+// Each view only writes its own rectangle of fb.
+void drawviews(const Framebuffer * fb, const Viewport * views, const Camera * cams, int num_views);
 
 #endif
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "savestate.h"
+#include "animation.h"
+#include "geometry.h"
+#include "inputlog.h"
+#include "navigation.h"
+#include "telemetry.h"
+
+
+// State layout, all little endian words: the magic and version, the tick,
+// MapFingerprint and NumSectors of the map it belongs to, how many players,
+// sectors and animations follow and the flicker seed. Then the packed
+// players, each changed sector as its index, floor, ceiling and light, and
+// each animation as its index, target and timer.
+#define StateMagic "U3DS"
+#define StateVersion 1
+
+enum { HeaderBytes = 9 * 4, SectorBytes = 4 * 4, AnimBytes = 3 * 4 };
+
+struct rewind
+{
+    SaveState * states;
+    unsigned length;    // States in the ring
+    unsigned newest;    // Where the last one went
+    unsigned count;     // States kept, up to length
+};
+
+static AnimState * animscratch = NULL; // For saving and loading
+static unsigned scratchcapacity = 0;
+
+static void putword(unsigned char * out, unsigned value)
+{
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+}
+
+static unsigned getword(const unsigned char * in)
+{
+    return in[0] | (unsigned)in[1] << 8 | (unsigned)in[2] << 16 | (unsigned)in[3] << 24;
+}
+
+static unsigned floatbits(float f)
+{
+    unsigned bits;
+    memcpy(&bits, &f, sizeof bits);
+    return bits;
+}
+
+static float bitsfloat(unsigned bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+static void growanims(unsigned count)
+{
+    if (count > scratchcapacity)
+    {
+        scratchcapacity = count;
+        animscratch = realloc(animscratch, sizeof(*animscratch) * scratchcapacity);
+        telemetrycount(CountAllocations, 1);
+    }
+}
+
+void savestate(SaveState * save, unsigned tick, const Player * players, unsigned count)
+{
+    // Sectors that moved and came back, like a door that shut again, are left out.
+    unsigned numsectors = 0;
+    for (unsigned i = 0; i < NumChanged; i++)
+    {
+        const Sector * sect = &sectors[ChangedSectors[i]];
+        const SectorState * loaded = &LoadedSectors[ChangedSectors[i]];
+        numsectors += sect->floor != loaded->floor || sect->ceil != loaded->ceil || sect->light != loaded->light;
+    }
+    growanims(numanimations());
+    unsigned seed;
+    unsigned numanims = saveanimations(animscratch, &seed);
+
+    unsigned size = HeaderBytes + count * PlayerBytes + numsectors * SectorBytes + numanims * AnimBytes;
+    if (size > save->capacity)
+    {
+        save->capacity = size * 2;
+        save->data = realloc(save->data, save->capacity);
+        telemetrycount(CountAllocations, 1);
+    }
+    save->size = size;
+
+    unsigned char * out = save->data;
+    memcpy(out, StateMagic, 4);
+    const unsigned header[] = {StateVersion, tick, MapFingerprint, NumSectors, count, numsectors, numanims, seed};
+    for (unsigned i = 0; i < sizeof header / sizeof *header; i++)
+    {
+        putword(out + 4 + 4 * i, header[i]);
+    }
+    out += HeaderBytes;
+    for (unsigned p = 0; p < count; p++, out += PlayerBytes)
+    {
+        packplayer(&players[p], out);
+    }
+    for (unsigned i = 0; i < NumChanged; i++)
+    {
+        unsigned n = ChangedSectors[i];
+        const Sector * sect = &sectors[n];
+        const SectorState * loaded = &LoadedSectors[n];
+        if (sect->floor != loaded->floor || sect->ceil != loaded->ceil || sect->light != loaded->light)
+        {
+            putword(out, n);
+            putword(out + 4, floatbits(sect->floor));
+            putword(out + 8, floatbits(sect->ceil));
+            putword(out + 12, floatbits(sect->light));
+            out += SectorBytes;
+        }
+    }
+    for (unsigned i = 0; i < numanims; i++, out += AnimBytes)
+    {
+        putword(out, animscratch[i].index);
+        putword(out + 4, floatbits(animscratch[i].target));
+        putword(out + 8, animscratch[i].timer);
+    }
+}
+
+unsigned savedtick(const SaveState * save)
+{
+    return save->size >= HeaderBytes ? getword(save->data + 8) : 0;
+}
+
+// Put a sector's heights and light back, marking what changed.
+static void setsector(unsigned n, float floor, float ceil, float light)
+{
+    Sector * sect = &sectors[n];
+    unsigned char what = (sect->floor != floor ? DirtyFloor : 0) | (sect->ceil != ceil ? DirtyCeil : 0)
+                       | (sect->light != light ? DirtyLight : 0);
+    if (what)
+    {
+        sect->floor = floor;
+        sect->ceil = ceil;
+        sect->light = light;
+        MarkDirty(n, what);
+    }
+}
+
+int loadstate(const SaveState * save, Player * players, unsigned count)
+{
+    // Check everything before touching anything.
+    const unsigned char * in = save->data;
+    if (save->size < HeaderBytes || memcmp(in, StateMagic, 4) != 0 || getword(in + 4) != StateVersion
+        || getword(in + 12) != MapFingerprint || getword(in + 16) != NumSectors)
+    {
+        return 0;
+    }
+    unsigned numplayers = getword(in + 20), numsectors = getword(in + 24), numanims = getword(in + 28);
+    unsigned seed = getword(in + 32);
+    if (numplayers > count || numsectors > NumSectors || numanims > numanimations()
+        || save->size != HeaderBytes + numplayers * PlayerBytes + numsectors * SectorBytes + numanims * AnimBytes)
+    {
+        return 0;
+    }
+    const unsigned char * sectorsin = in + HeaderBytes + numplayers * PlayerBytes;
+    const unsigned char * animsin = sectorsin + numsectors * SectorBytes;
+    for (unsigned p = 0; p < numplayers; p++)
+    {
+        if (!checkplayer(in + HeaderBytes + p * PlayerBytes))
+        {
+            return 0;
+        }
+    }
+    for (unsigned i = 0; i < numsectors; i++)
+    {
+        const unsigned char * s = sectorsin + i * SectorBytes;
+        if (getword(s) >= NumSectors || !isfinite(bitsfloat(getword(s + 4)))
+            || !isfinite(bitsfloat(getword(s + 8))) || !isfinite(bitsfloat(getword(s + 12))))
+        {
+            return 0;
+        }
+    }
+    growanims(numanims);
+    for (unsigned i = 0; i < numanims; i++)
+    {
+        const unsigned char * a = animsin + i * AnimBytes;
+        animscratch[i] = (AnimState) {getword(a), bitsfloat(getword(a + 4)), getword(a + 8)};
+        if (animscratch[i].index >= numanimations() || !isfinite(animscratch[i].target))
+        {
+            return 0;
+        }
+    }
+
+    // Every sector changed since loading goes back to how it was loaded,
+    // then the saved ones take their saved values.
+    ClearDirty();
+    for (unsigned i = 0; i < NumChanged; i++)
+    {
+        const SectorState * loaded = &LoadedSectors[ChangedSectors[i]];
+        setsector(ChangedSectors[i], loaded->floor, loaded->ceil, loaded->light);
+    }
+    for (unsigned i = 0; i < numsectors; i++)
+    {
+        const unsigned char * s = sectorsin + i * SectorBytes;
+        setsector(getword(s), bitsfloat(getword(s + 4)), bitsfloat(getword(s + 8)), bitsfloat(getword(s + 12)));
+    }
+    restoreanimations(animscratch, numanims, seed);
+    for (unsigned p = 0; p < numplayers; p++)
+    {
+        unpackplayer(in + HeaderBytes + p * PlayerBytes, &players[p]);
+    }
+    if (NumDirty)
+    {
+        RefreshGeometry();
+        navupdate(DirtySectors, NumDirty);
+    }
+    return 1;
+}
+
+void freesavestate(SaveState * save)
+{
+    free(save->data);
+    *save = (SaveState) {NULL, 0, 0};
+}
+
+int writesavestate(const SaveState * save, const char * path)
+{
+    FILE * fp = fopen(path, "wb");
+    if (!fp)
+    {
+        perror(path);
+        return 0;
+    }
+    int written = fwrite(save->data, 1, save->size, fp) == save->size;
+    return fclose(fp) == 0 && written;
+}
+
+int readsavestate(SaveState * save, const char * path)
+{
+    FILE * fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < 0)
+    {
+        fclose(fp);
+        return 0;
+    }
+    if ((unsigned long)size > save->capacity)
+    {
+        save->capacity = (unsigned)size;
+        save->data = realloc(save->data, save->capacity);
+    }
+    save->size = (unsigned)fread(save->data, 1, (size_t)size, fp);
+    fclose(fp);
+    return save->size == (unsigned long)size;
+}
+
+Rewind * startrewind(unsigned ticks)
+{
+    Rewind * ring = malloc(sizeof(*ring));
+    ring->length = ticks ? ticks : 1;
+    ring->states = calloc(ring->length, sizeof(*ring->states));
+    ring->newest = ring->length - 1;
+    ring->count = 0;
+    return ring;
+}
+
+void recordrewind(Rewind * ring, unsigned tick, const Player * players, unsigned count)
+{
+    ring->newest = (ring->newest + 1) % ring->length;
+    ring->count = ring->count < ring->length ? ring->count + 1 : ring->length;
+    savestate(&ring->states[ring->newest], tick, players, count);
+}
+
+unsigned rewindstate(Rewind * ring, unsigned ticks, Player * players, unsigned count)
+{
+    if (ring->count == 0)
+    {
+        return 0;
+    }
+    ticks = ticks < ring->count ? ticks : ring->count - 1;
+    ring->newest = (ring->newest + ring->length - ticks) % ring->length;
+    ring->count -= ticks;
+    loadstate(&ring->states[ring->newest], players, count);
+    return ticks;
+}
+
+void stoprewind(Rewind * ring)
+{
+    if (!ring)
+    {
+        return;
+    }
+    for (unsigned i = 0; i < ring->length; i++)
+    {
+        freesavestate(&ring->states[i]);
+    }
+    free(ring->states);
+    free(ring);
+}
@@ -0,0 +1,63 @@
+#ifndef SAVESTATE
+#define SAVESTATE
+
+#include "player.h"
+
+
+#define RewindTicks 600 // Ticks of history the game keeps to rewind through, ten seconds
+
+// The simulation at one tick, serialised. Only what changed since the map
+// was loaded is copied: the players, the heights and lights of the sectors
+// that moved, and the animations not where the map started them. The map
+// itself is referenced by MapFingerprint, so a state only loads on the map
+// it was saved on.
+typedef struct savestate
+{
+    unsigned char * data;
+    unsigned size, capacity;
+} SaveState;
+
+/**
+ * savestate: Serialise the simulation at tick into save, with the first
+ * count players. save's buffer is reused, so saving every tick into the
+ * same few states allocates nothing once they have grown.
+ */
+void savestate(SaveState * save, unsigned tick, const Player * players, unsigned count);
+
+/**
+ * loadstate: Put the simulation back as it was saved. The saved players go
+ * into the first of players, of which there must be at least as many. The
+ * wall list and navigation are patched for the sectors that moved, which
+ * are left in DirtySectors. Returns 0, changing nothing, when save is
+ * malformed, puts a player outside the map, holds a value that is not
+ * finite, or is of another version or from another map.
+ */
+int loadstate(const SaveState * save, Player * players, unsigned count);
+
+// The tick a state was saved at.
+unsigned savedtick(const SaveState * save);
+
+void freesavestate(SaveState * save);
+
+// Quick-save files hold one state as it is. Both return 0 on failure.
+int writesavestate(const SaveState * save, const char * path);
+int readsavestate(SaveState * save, const char * path);
+
+typedef struct rewind Rewind;
+
+// A ring of the last ticks states, for stepping back through time.
+Rewind * startrewind(unsigned ticks);
+
+// Save the simulation at tick as the newest state, dropping the oldest once the ring is full.
+void recordrewind(Rewind * ring, unsigned tick, const Player * players, unsigned count);
+
+/**
+ * rewindstate: Load the state ticks back from the newest, or the oldest
+ * kept if that is further, and forget the ones after it. Returns how many
+ * ticks back it went; with nothing recorded it loads nothing and returns 0.
+ */
+unsigned rewindstate(Rewind * ring, unsigned ticks, Player * players, unsigned count);
+
+void stoprewind(Rewind * ring);
+
+#endif
@@ -0,0 +1,283 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "geometry.h"
+#include "navigation.h"
+
+
+#define EntityX      0x01
+#define EntityY      0x02
+#define EntityZ      0x04
+#define EntityAngle  0x08
+#define EntityYaw    0x10
+#define EntitySector 0x20
+#define EntityFlags  0x40
+
+#define SectorFloor 0x01
+#define SectorCeil  0x02
+#define SectorLight 0x04
+
+static const EntitySnap noentity = {0, 0, 0, 0, 0, 0, 0};
+static const SectorSnap nosector = {0, 0, 0};
+
+void allocsnapshot(Snapshot * snap)
+{
+    memset(snap->entities, 0, sizeof snap->entities);
+    snap->tick = 0;
+    snap->sectors = calloc(NumSectors ? NumSectors : 1, sizeof(*snap->sectors));
+}
+
+void freesnapshot(Snapshot * snap)
+{
+    free(snap->sectors);
+    snap->sectors = NULL;
+}
+
+static int quantise(float value, float scale)
+{
+    return (int)lrintf(value * scale);
+}
+
+void takesnapshot(Snapshot * snap, unsigned tick, const Player * players, unsigned count)
+{
+    snap->tick = tick;
+    for (unsigned i = 0; i < MaxClients; i++)
+    {
+        const Player * p = &players[i];
+        if (i >= count || p->sector >= NumSectors)
+        {
+            snap->entities[i] = noentity;
+            continue;
+        }
+        float turns = p->angle / (2 * (float)M_PI);
+        snap->entities[i] = (EntitySnap) {
+            quantise(p->where.x, NetUnits), quantise(p->where.y, NetUnits), quantise(p->where.z, NetUnits),
+            quantise(turns - floorf(turns), 65536) & 0xffff, quantise(p->yaw, 256), p->sector,
+            SnapActive | (p->state.ducking ? SnapDucking : 0) | (p->state.ground ? SnapGround : 0)};
+    }
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        const Sector * sect = &sectors[n];
+        snap->sectors[n] = (SectorSnap) {quantise(sect->floor, NetUnits), quantise(sect->ceil, NetUnits), quantise(sect->light, 255)};
+    }
+}
+
+unsigned maxsnapshotbytes(void)
+{
+    // A skip, a mask and every field as a five byte varint, plus the terminators.
+    return MaxClients * (5 + 1 + 7 * 5) + NumSectors * (5 + 1 + 3 * 5) + 2;
+}
+
+static unsigned char * putvarint(unsigned char * out, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (unsigned char)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+// Zigzag folds small negative numbers into small unsigned ones: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ...
+static unsigned char * putsigned(unsigned char * out, int value)
+{
+    return putvarint(out, ((unsigned)value << 1) ^ (unsigned)(value >> 31));
+}
+
+// Reads past the end or overlong varints set bad instead of reading out of bounds.
+typedef struct reader
+{
+    const unsigned char * at, * end;
+    int bad;
+} Reader;
+
+static unsigned getvarint(Reader * in)
+{
+    unsigned value = 0;
+    for (unsigned shift = 0; ; shift += 7)
+    {
+        if (in->at >= in->end || shift >= 35)
+        {
+            in->bad = 1;
+            return 0;
+        }
+        unsigned char c = *in->at++;
+        value |= (unsigned)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            return value;
+        }
+    }
+}
+
+static int getsigned(Reader * in)
+{
+    unsigned value = getvarint(in);
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// Adds a decoded difference without signed overflow, whatever arrived.
+static int wrapadd(int value, int delta)
+{
+    return (int)((unsigned)value + (unsigned)delta);
+}
+
+// The angle difference the short way round, so turning past zero stays small.
+static int angledelta(int to, int from)
+{
+    return ((to - from + 32768) & 0xffff) - 32768;
+}
+
+unsigned encodesnapshot(const Snapshot * base, const Snapshot * snap, unsigned char * out)
+{
+    unsigned char * start = out;
+
+    // Each changed entity: the number skipped since the last one plus one, a mask and the changes. 0 ends the list.
+    unsigned next = 0;
+    for (unsigned i = 0; i < MaxClients; i++)
+    {
+        const EntitySnap * b = base ? &base->entities[i] : &noentity;
+        const EntitySnap * e = &snap->entities[i];
+        unsigned mask = (e->x != b->x ? EntityX : 0) | (e->y != b->y ? EntityY : 0) | (e->z != b->z ? EntityZ : 0)
+                      | (e->angle != b->angle ? EntityAngle : 0) | (e->yaw != b->yaw ? EntityYaw : 0)
+                      | (e->sector != b->sector ? EntitySector : 0) | (e->flags != b->flags ? EntityFlags : 0);
+        if (!mask)
+        {
+            continue;
+        }
+        out = putvarint(out, i - next + 1);
+        next = i + 1;
+        *out++ = (unsigned char)mask;
+        out = mask & EntityX ? putsigned(out, e->x - b->x) : out;
+        out = mask & EntityY ? putsigned(out, e->y - b->y) : out;
+        out = mask & EntityZ ? putsigned(out, e->z - b->z) : out;
+        out = mask & EntityAngle ? putsigned(out, angledelta(e->angle, b->angle)) : out;
+        out = mask & EntityYaw ? putsigned(out, e->yaw - b->yaw) : out;
+        out = mask & EntitySector ? putvarint(out, e->sector) : out;
+        out = mask & EntityFlags ? putvarint(out, e->flags) : out;
+    }
+    *out++ = 0;
+
+    // Then the sectors the same way.
+    next = 0;
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        const SectorSnap * b = base ? &base->sectors[n] : &nosector;
+        const SectorSnap * s = &snap->sectors[n];
+        unsigned mask = (s->floor != b->floor ? SectorFloor : 0) | (s->ceil != b->ceil ? SectorCeil : 0)
+                      | (s->light != b->light ? SectorLight : 0);
+        if (!mask)
+        {
+            continue;
+        }
+        out = putvarint(out, n - next + 1);
+        next = n + 1;
+        *out++ = (unsigned char)mask;
+        out = mask & SectorFloor ? putsigned(out, s->floor - b->floor) : out;
+        out = mask & SectorCeil ? putsigned(out, s->ceil - b->ceil) : out;
+        out = mask & SectorLight ? putsigned(out, s->light - b->light) : out;
+    }
+    *out++ = 0;
+    return (unsigned)(out - start);
+}
+
+int decodesnapshot(const Snapshot * base, const unsigned char * data, unsigned size, Snapshot * snap)
+{
+    Reader in = {data, data + size, 0};
+    if (base)
+    {
+        memcpy(snap->entities, base->entities, sizeof snap->entities);
+        memcpy(snap->sectors, base->sectors, NumSectors * sizeof(*snap->sectors));
+    }
+    else
+    {
+        memset(snap->entities, 0, sizeof snap->entities);
+        memset(snap->sectors, 0, NumSectors * sizeof(*snap->sectors));
+    }
+
+    unsigned i = 0;
+    for (unsigned skip; (skip = getvarint(&in)) != 0 && !in.bad; i++)
+    {
+        i += skip - 1;
+        if (i >= MaxClients || in.at >= in.end)
+        {
+            return 0;
+        }
+        EntitySnap * e = &snap->entities[i];
+        unsigned mask = *in.at++;
+        e->x = mask & EntityX ? wrapadd(e->x, getsigned(&in)) : e->x;
+        e->y = mask & EntityY ? wrapadd(e->y, getsigned(&in)) : e->y;
+        e->z = mask & EntityZ ? wrapadd(e->z, getsigned(&in)) : e->z;
+        e->angle = mask & EntityAngle ? wrapadd(e->angle, getsigned(&in)) & 0xffff : e->angle;
+        e->yaw = mask & EntityYaw ? wrapadd(e->yaw, getsigned(&in)) : e->yaw;
+        e->sector = mask & EntitySector ? getvarint(&in) : e->sector;
+        e->flags = mask & EntityFlags ? getvarint(&in) : e->flags;
+        if (e->flags & SnapActive && e->sector >= NumSectors)
+        {
+            return 0;
+        }
+    }
+
+    unsigned n = 0;
+    for (unsigned skip; !in.bad && (skip = getvarint(&in)) != 0 && !in.bad; n++)
+    {
+        n += skip - 1;
+        if (n >= NumSectors || in.at >= in.end)
+        {
+            return 0;
+        }
+        SectorSnap * s = &snap->sectors[n];
+        unsigned mask = *in.at++;
+        s->floor = mask & SectorFloor ? wrapadd(s->floor, getsigned(&in)) : s->floor;
+        s->ceil = mask & SectorCeil ? wrapadd(s->ceil, getsigned(&in)) : s->ceil;
+        s->light = mask & SectorLight ? wrapadd(s->light, getsigned(&in)) : s->light;
+    }
+    return !in.bad && in.at == in.end;
+}
+
+void snapshotplayer(const EntitySnap * entity, Player * into)
+{
+    // Not in the world yet, or not anywhere in this map.
+    if (!(entity->flags & SnapActive) || entity->sector >= NumSectors)
+    {
+        return;
+    }
+    into->where = (XYZ) {(float)entity->x / NetUnits, (float)entity->y / NetUnits, (float)entity->z / NetUnits};
+    into->angle = entity->angle * (2 * (float)M_PI / 65536);
+    into->anglesin = sinf(into->angle);
+    into->anglecos = cosf(into->angle);
+    into->yaw = entity->yaw / 256.f;
+    into->sector = entity->sector;
+    into->state.ducking = (entity->flags & SnapDucking) != 0;
+    into->state.ground = (entity->flags & SnapGround) != 0;
+}
+
+void snapshotsectors(const Snapshot * snap)
+{
+    ClearDirty();
+    for (unsigned n = 0; n < NumSectors; n++)
+    {
+        Sector * sect = &sectors[n];
+        const SectorSnap * s = &snap->sectors[n];
+        float floor = (float)s->floor / NetUnits, ceil = (float)s->ceil / NetUnits, light = s->light / 255.f;
+        if (quantise(sect->floor, NetUnits) != s->floor || quantise(sect->ceil, NetUnits) != s->ceil)
+        {
+            sect->floor = floor;
+            sect->ceil = ceil;
+            MarkDirty(n, DirtyFloor | DirtyCeil);
+        }
+        if (quantise(sect->light, 255) != s->light)
+        {
+            sect->light = light;
+            MarkDirty(n, DirtyLight);
+        }
+    }
+    if (NumDirty)
+    {
+        RefreshGeometry();
+        navupdate(DirtySectors, NumDirty);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+#include "player.h"
+
+
+#define MaxClients   64
+#define SnapshotRing 32  // Ticks of history a delta can be taken against
+#define NetUnits     64  // Quantisation steps per world unit
+
+#define SnapActive  0x01
+#define SnapDucking 0x02
+#define SnapGround  0x04
+
+// A player as it goes over the wire, quantised.
+typedef struct entitysnap
+{
+    int x, y, z;          // 1/NetUnits
+    int angle;            // 65536 steps around the circle
+    int yaw;              // 1/256ths
+    unsigned sector;
+    unsigned flags;       // SnapActive, SnapDucking, SnapGround
+} EntitySnap;
+
+// The parts of a sector that change while playing.
+typedef struct sectorsnap
+{
+    int floor, ceil;      // 1/NetUnits
+    int light;            // 0 - 255
+} SectorSnap;
+
+// The world at one tick: every client's player and every sector.
+typedef struct snapshot
+{
+    unsigned tick;
+    EntitySnap entities[MaxClients];
+    SectorSnap * sectors; // NumSectors of them
+} Snapshot;
+
+void allocsnapshot(Snapshot * snap);
+void freesnapshot(Snapshot * snap);
+
+/**
+ * takesnapshot: Quantise the world. Players whose sector is not a sector of
+ * the map are left out as inactive.
+ */
+void takesnapshot(Snapshot * snap, unsigned tick, const Player * players, unsigned count);
+
+// The most bytes an encoded snapshot of the loaded map can take.
+unsigned maxsnapshotbytes(void);
+
+/**
+ * encodesnapshot: Write only what changed between base and snap, as runs of
+ * skipped entities and sectors followed by bit masks of changed fields and
+ * their differences as zigzag varints. A NULL base encodes against an empty
+ * world, which is a full snapshot. Returns the bytes written to out.
+ */
+unsigned encodesnapshot(const Snapshot * base, const Snapshot * snap, unsigned char * out);
+
+/**
+ * decodesnapshot: Rebuild a snapshot from base and its encoding. Returns 0 if
+ * the encoding is malformed, leaving snap unspecified.
+ */
+int decodesnapshot(const Snapshot * base, const unsigned char * in, unsigned size, Snapshot * snap);
+
+// Copy the world in a snapshot into a player and the sectors. An entity that
+// is inactive or outside the map leaves the player as it was.
+void snapshotplayer(const EntitySnap * entity, Player * into);
+void snapshotsectors(const Snapshot * snap);
+
+#endif
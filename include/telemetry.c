@@ -0,0 +1,309 @@
+#include <stdio.h>
+
+#include "telemetry.h"
+
+
+// Times are kept in tenths of a microsecond. The histogram has four buckets
+// to every power of two: bucket v for v below 4, then 4 to 7 tenths, 8 to 9,
+// 10 to 11, 12 to 13 and so on, the last one taking everything past 2.9 s.
+#define Buckets 96
+#define TenthsPerMs 10000.0
+#define MaxReaders 16
+
+static const char * counternames[NumCounters] = {"frames", "sectors", "spans", "allocations", "ticks"};
+static const char * timernames[NumTimers] = {"frame", "render", "animate", "collide", "move", "server", "jobs", "mix", "navigate"};
+
+// Only the thread that owns a block adds to it. The publisher swaps each
+// value for 0 as it reads it, so nothing is lost or counted twice and the
+// counts never wrap unless a period is thousands of seconds long.
+typedef struct telemetryblock
+{
+    void * name;                        // Or NULL to be numbered
+    SDL_atomic_t counts[NumCounters];
+    SDL_atomic_t runs[NumTimers];
+    SDL_atomic_t tenths[NumTimers];
+    SDL_atomic_t longest[NumTimers];
+    SDL_atomic_t buckets[NumTimers][Buckets];
+    SDL_atomic_t busy;
+} TelemetryBlock;
+
+static TelemetryBlock blocks[MaxTelemetryThreads];
+static TelemetryBlock spare;            // Shared by any threads past MaxTelemetryThreads
+static SDL_atomic_t numblocks;
+static SDL_atomic_t recording;
+static _Thread_local TelemetryBlock * mine = NULL;
+static _Thread_local unsigned depth = 0;    // Busy timers running on this thread
+static double tenthspertick = 0;
+
+// The publisher.
+static SDL_Thread * publisher = NULL;
+static SDL_mutex * lock = NULL;
+static SDL_cond * wake = NULL;
+static int stopping = 0;
+static FILE * out = NULL;
+static Transport * readers = NULL;
+static unsigned subscribers[MaxReaders];
+static unsigned numsubscribers = 0;
+static Uint64 started = 0, published = 0;
+static char text[8192];
+
+static unsigned bucketof(unsigned tenths)
+{
+    if (tenths < 4)
+    {
+        return tenths;
+    }
+    unsigned octave = 2;
+    while (tenths >> (octave + 1))
+    {
+        octave++;
+    }
+    unsigned bucket = (octave - 1) * 4 + ((tenths >> (octave - 2)) & 3);
+    return bucket < Buckets ? bucket : Buckets - 1;
+}
+
+static double bucketlow(unsigned bucket)
+{
+    return bucket < 4 ? bucket : (double)((4u + bucket % 4) << (bucket / 4 - 1));
+}
+
+static TelemetryBlock * claimblock(const char * name)
+{
+    unsigned n = (unsigned)SDL_AtomicAdd(&numblocks, 1);
+    if (n >= MaxTelemetryThreads)
+    {
+        return &spare;
+    }
+    SDL_AtomicSetPtr(&blocks[n].name, (void *)name);
+    return &blocks[n];
+}
+
+static TelemetryBlock * myblock(void)
+{
+    if (!mine)
+    {
+        mine = claimblock(NULL);
+    }
+    return mine;
+}
+
+void telemetrythread(const char * name)
+{
+    if (!mine)
+    {
+        mine = claimblock(name);
+    }
+}
+
+void telemetrycount(enum telemetry_counter counter, unsigned n)
+{
+    if (SDL_AtomicGet(&recording))
+    {
+        SDL_AtomicAdd(&myblock()->counts[counter], (int)n);
+    }
+}
+
+Uint64 telemetrystart(enum telemetry_timer timer)
+{
+    if (!SDL_AtomicGet(&recording))
+    {
+        return 0;
+    }
+    depth += timer != TimeFrame;
+    return SDL_GetPerformanceCounter();
+}
+
+void telemetrystop(enum telemetry_timer timer, Uint64 start)
+{
+    // Started while telemetry was off: nothing to record and nothing to unwind.
+    if (!start)
+    {
+        return;
+    }
+    unsigned tenths = (unsigned)((double)(SDL_GetPerformanceCounter() - start) * tenthspertick);
+    TelemetryBlock * block = myblock();
+    SDL_AtomicAdd(&block->runs[timer], 1);
+    SDL_AtomicAdd(&block->tenths[timer], (int)tenths);
+    SDL_AtomicAdd(&block->buckets[timer][bucketof(tenths)], 1);
+    if (tenths > (unsigned)SDL_AtomicGet(&block->longest[timer]))
+    {
+        SDL_AtomicSet(&block->longest[timer], (int)tenths);
+    }
+    if (timer != TimeFrame && --depth == 0)
+    {
+        SDL_AtomicAdd(&block->busy, (int)tenths);
+    }
+}
+
+// The bucket holding the q'th of runs, reported as its middle and never past the longest.
+static double quantile(const unsigned * buckets, unsigned runs, double q, unsigned longest)
+{
+    unsigned want = (unsigned)(q * runs + 0.999), seen = 0, b = 0;
+    for (; b < Buckets - 1 && (seen += buckets[b]) < want; b++)
+    {
+    }
+    double middle = (bucketlow(b) + bucketlow(b + 1)) / 2;
+    return (middle < longest ? middle : longest) / TenthsPerMs;
+}
+
+// Read and clear what every thread recorded since the last period into text.
+static unsigned gather(void)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    double period = (double)(now - published) / (double)SDL_GetPerformanceFrequency();
+    published = now;
+    unsigned size = (unsigned)snprintf(text, sizeof text, "telemetry %.3f %.3f\n",
+                                       (double)(now - started) / (double)SDL_GetPerformanceFrequency(), period);
+
+    unsigned count = (unsigned)SDL_AtomicGet(&numblocks);
+    count = count < MaxTelemetryThreads ? count : MaxTelemetryThreads;
+    unsigned counts[NumCounters] = {0};
+    unsigned runs[NumTimers] = {0}, longest[NumTimers] = {0}, buckets[NumTimers][Buckets] = {{0}};
+    double tenths[NumTimers] = {0}, busy[MaxTelemetryThreads + 1] = {0};
+    for (unsigned n = 0; n <= count; n++)
+    {
+        TelemetryBlock * block = n < count ? &blocks[n] : &spare;
+        for (unsigned c = 0; c < NumCounters; c++)
+        {
+            counts[c] += (unsigned)SDL_AtomicSet(&block->counts[c], 0);
+        }
+        for (unsigned t = 0; t < NumTimers; t++)
+        {
+            runs[t] += (unsigned)SDL_AtomicSet(&block->runs[t], 0);
+            tenths[t] += (unsigned)SDL_AtomicSet(&block->tenths[t], 0);
+            unsigned most = (unsigned)SDL_AtomicSet(&block->longest[t], 0);
+            longest[t] = most > longest[t] ? most : longest[t];
+            for (unsigned b = 0; b < Buckets; b++)
+            {
+                buckets[t][b] += (unsigned)SDL_AtomicSet(&block->buckets[t][b], 0);
+            }
+        }
+        busy[n] = (unsigned)SDL_AtomicSet(&block->busy, 0) / TenthsPerMs / 10 / (period > 0 ? period : 1);
+    }
+
+    for (unsigned c = 0; c < NumCounters && size < sizeof text; c++)
+    {
+        size += (unsigned)snprintf(text + size, sizeof text - size, "count %s %u\n", counternames[c], counts[c]);
+    }
+    for (unsigned t = 0; t < NumTimers && size < sizeof text; t++)
+    {
+        unsigned n = runs[t];
+        size += (unsigned)snprintf(text + size, sizeof text - size, "timer %s %u %.4f %.4f %.4f %.4f\n", timernames[t], n,
+                                   n ? tenths[t] / n / TenthsPerMs : 0.0, n ? quantile(buckets[t], n, 0.5, longest[t]) : 0.0,
+                                   n ? quantile(buckets[t], n, 0.99, longest[t]) : 0.0, longest[t] / TenthsPerMs);
+    }
+    for (unsigned n = 0; n < count && size < sizeof text; n++)
+    {
+        const char * name = SDL_AtomicGetPtr(&blocks[n].name);
+        size += name ? (unsigned)snprintf(text + size, sizeof text - size, "thread %s %.1f\n", name, busy[n])
+                     : (unsigned)snprintf(text + size, sizeof text - size, "thread thread%u %.1f\n", n, busy[n]);
+    }
+    if (count == MaxTelemetryThreads && size < sizeof text)
+    {
+        size += (unsigned)snprintf(text + size, sizeof text - size, "thread others %.1f\n", busy[count]);
+    }
+    if (size < sizeof text)
+    {
+        size += (unsigned)snprintf(text + size, sizeof text - size, "end\n");
+    }
+    return size < sizeof text ? size : sizeof text - 1;
+}
+
+static void publish(void)
+{
+    unsigned size = gather();
+    if (out)
+    {
+        fputs(text, out);
+        fflush(out);
+        return;
+    }
+
+    // Anyone who sends anything is sent every block until they go away.
+    unsigned peer, length;
+    while (transportreceive(readers, &peer, &length))
+    {
+        unsigned known = 0;
+        for (unsigned i = 0; i < numsubscribers; i++)
+        {
+            known |= subscribers[i] == peer;
+        }
+        if (!known && numsubscribers < MaxReaders)
+        {
+            subscribers[numsubscribers++] = peer;
+        }
+    }
+    for (unsigned i = 0; i < numsubscribers; i++)
+    {
+        if (!transportsend(readers, subscribers[i], text, size))
+        {
+            subscribers[i--] = subscribers[--numsubscribers];
+        }
+    }
+}
+
+static int publishloop(void * unused)
+{
+    (void)unused;
+    SDL_LockMutex(lock);
+    while (!stopping)
+    {
+        SDL_CondWaitTimeout(wake, lock, TelemetryPeriodMs);
+        if (!stopping)
+        {
+            publish();
+        }
+    }
+    SDL_UnlockMutex(lock);
+    return 0;
+}
+
+int starttelemetry(const char * path, Transport * transport)
+{
+    if (publisher)
+    {
+        return 1;
+    }
+    out = transport ? NULL : fopen(path, "w");
+    if (!transport && !out)
+    {
+        perror(path);
+        return 0;
+    }
+    readers = transport;
+    numsubscribers = 0;
+    stopping = 0;
+    tenthspertick = 1e7 / (double)SDL_GetPerformanceFrequency();
+    started = published = SDL_GetPerformanceCounter();
+    lock = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    SDL_AtomicSet(&recording, 1);
+    publisher = SDL_CreateThread(publishloop, "telemetry", NULL);
+    return 1;
+}
+
+void stoptelemetry(void)
+{
+    if (!publisher)
+    {
+        return;
+    }
+    SDL_AtomicSet(&recording, 0);
+    SDL_LockMutex(lock);
+    stopping = 1;
+    SDL_CondSignal(wake);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(publisher, NULL);
+    publisher = NULL;
+
+    // What was recorded since the last period.
+    publish();
+    if (out)
+    {
+        fclose(out);
+        out = NULL;
+    }
+    readers = NULL;
+    SDL_DestroyCond(wake);
+    SDL_DestroyMutex(lock);
+}
@@ -0,0 +1,74 @@
+#ifndef TELEMETRY
+#define TELEMETRY
+
+#include <SDL2/SDL.h>
+
+#include "transport.h"
+
+
+#define TelemetryPeriodMs 1000 // How often the counters are published
+#define MaxTelemetryThreads 32
+
+// Things counted. Each period reports how many happened in it.
+enum telemetry_counter
+{
+    CountFrames,
+    CountSectors,       // Sectors drawn, summed over every view
+    CountSpans,
+    CountAllocations,   // Buffers grown on the per frame paths; none once they have settled
+    CountTicks,         // Server ticks
+    NumCounters
+};
+
+// Things timed. Each period reports how often they ran and a histogram of
+// how long they took.
+enum telemetry_timer
+{
+    TimeFrame,          // All of mainloop's loop, presenting the frame included
+    TimeRender,         // drawviews
+    TimeAnimate,        // animatesectors
+    TimeCollide,        // collisiondetection
+    TimeMove,           // handlemovement
+    TimeServer,         // servertick
+    TimeJobs,           // A worker running its share of a batch
+    TimeMix,            // Mixing one block of audio
+    TimeNavigate,       // Answering one batch of path queries
+    NumTimers
+};
+
+/**
+ * starttelemetry: Start publishing every TelemetryPeriodMs, from a thread of
+ * its own, to a file at path or, when transport is given, to every reader
+ * that sends it a message. Until this is called, and after stoptelemetry,
+ * counting and timing cost one atomic read. Returns 0 if path can't be written.
+ *
+ * Each period is published as a block of lines:
+ *
+ *   telemetry seconds period       Since starting, and the seconds the block covers
+ *   count name n                   Times it happened in the period
+ *   timer name n mean p50 p99 max  Times it ran and how long, in ms; the quantiles
+ *                                  are to a quarter of a power of two
+ *   thread name busy               Percent of the period the thread spent in timed work
+ *   end
+ */
+int starttelemetry(const char * path, Transport * transport);
+
+void stoptelemetry(void);
+
+/**
+ * telemetrythread: Name the calling thread in what is published, before it
+ * counts or times anything; name must last, like a literal. Threads that
+ * don't name themselves are numbered. Each thread counts into a block of
+ * its own, so recording never takes a lock.
+ */
+void telemetrythread(const char * name);
+
+void telemetrycount(enum telemetry_counter counter, unsigned n);
+
+// Time a stretch of work: telemetrystop(timer, telemetrystart(timer)) around
+// it. Everything but TimeFrame counts towards the thread being busy, once
+// however deeply the timers nest.
+Uint64 telemetrystart(enum telemetry_timer timer);
+void telemetrystop(enum telemetry_timer timer, Uint64 start);
+
+#endif
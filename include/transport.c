@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "transport.h"
+
+
+int transportsend(Transport * transport, unsigned peer, const void * data, unsigned size)
+{
+    if (transport->loss)
+    {
+        transport->seed = transport->seed * 1103515245u + 12345u;
+        if ((transport->seed >> 8) % 100 < transport->loss)
+        {
+            return 0;
+        }
+    }
+    if (!transport->send(transport, peer, data, size))
+    {
+        return 0;
+    }
+    transport->sent += size;
+    return 1;
+}
+
+const void * transportreceive(Transport * transport, unsigned * peer, unsigned * size)
+{
+    const void * data = transport->receive(transport, peer, size);
+    transport->received += data ? *size : 0;
+    return data;
+}
+
+void transportdrop(Transport * transport, unsigned peer)
+{
+    transport->drop(transport, peer);
+}
+
+void closetransport(Transport * transport)
+{
+    if (transport)
+    {
+        transport->close(transport);
+    }
+}
+
+
+// In-process transport: every endpoint owns a queue of incoming messages.
+
+typedef struct localmessage
+{
+    struct localmessage * next;
+    unsigned peer, size;
+    unsigned char data[];
+} LocalMessage;
+
+typedef struct localtransport
+{
+    Transport base;
+    struct localtransport * server;   // Clients: the server, NULL once it closed
+    struct localtransport ** clients; // Server: clients by peer, NULL once they closed
+    unsigned numclients;
+    unsigned peer;                    // Clients: which peer the server knows them as
+    LocalMessage * head, * tail;
+    LocalMessage * current;           // Last message handed out, freed on the next receive
+} LocalTransport;
+
+static void localpush(LocalTransport * to, unsigned peer, const void * data, unsigned size)
+{
+    LocalMessage * message = malloc(sizeof(*message) + size);
+    message->next = NULL;
+    message->peer = peer;
+    message->size = size;
+    memcpy(message->data, data, size);
+    if (to->tail)
+    {
+        to->tail->next = message;
+    }
+    else
+    {
+        to->head = message;
+    }
+    to->tail = message;
+}
+
+static int localsend(Transport * transport, unsigned peer, const void * data, unsigned size)
+{
+    LocalTransport * local = (LocalTransport *)transport;
+    if (local->clients || !local->server)
+    {
+        // Server side, or a client whose server has gone.
+        if (!local->clients || peer >= local->numclients || !local->clients[peer])
+        {
+            return 0;
+        }
+        localpush(local->clients[peer], 0, data, size);
+        return 1;
+    }
+    localpush(local->server, local->peer, data, size);
+    return 1;
+}
+
+static const void * localreceive(Transport * transport, unsigned * peer, unsigned * size)
+{
+    LocalTransport * local = (LocalTransport *)transport;
+    free(local->current);
+    local->current = local->head;
+    if (!local->head)
+    {
+        return NULL;
+    }
+    local->head = local->head->next;
+    local->tail = local->head ? local->tail : NULL;
+    *peer = local->current->peer;
+    *size = local->current->size;
+    return local->current->data;
+}
+
+static void localdrop(Transport * transport, unsigned peer)
+{
+    LocalTransport * local = (LocalTransport *)transport;
+    if (!local->clients)
+    {
+        // A client can only let go of its server.
+        if (local->server)
+        {
+            local->server->clients[local->peer] = NULL;
+            local->server = NULL;
+        }
+        return;
+    }
+    if (peer >= local->numclients || !local->clients[peer])
+    {
+        return;
+    }
+    local->clients[peer]->server = NULL;
+    local->clients[peer] = NULL;
+    LocalMessage ** at = &local->head;
+    local->tail = NULL;
+    while (*at)
+    {
+        LocalMessage * message = *at;
+        if (message->peer == peer)
+        {
+            *at = message->next;
+            free(message);
+            continue;
+        }
+        local->tail = message;
+        at = &message->next;
+    }
+}
+
+static void localclose(Transport * transport)
+{
+    LocalTransport * local = (LocalTransport *)transport;
+    for (unsigned i = 0; i < local->numclients; i++)
+    {
+        if (local->clients[i])
+        {
+            local->clients[i]->server = NULL;
+        }
+    }
+    if (local->server)
+    {
+        local->server->clients[local->peer] = NULL;
+    }
+    while (local->head)
+    {
+        LocalMessage * next = local->head->next;
+        free(local->head);
+        local->head = next;
+    }
+    free(local->current);
+    free(local->clients);
+    free(local);
+}
+
+static LocalTransport * newlocal(void)
+{
+    LocalTransport * local = calloc(1, sizeof(*local));
+    local->base = (Transport) {localsend, localreceive, localdrop, localclose, 0, 1, 0, 0};
+    return local;
+}
+
+Transport * localserver(void)
+{
+    LocalTransport * local = newlocal();
+    local->clients = malloc(sizeof(*local->clients));
+    return &local->base;
+}
+
+Transport * localconnect(Transport * server)
+{
+    LocalTransport * host = (LocalTransport *)server;
+    LocalTransport * local = newlocal();
+    local->server = host;
+    local->peer = host->numclients;
+    host->clients = realloc(host->clients, ++host->numclients * sizeof(*host->clients));
+    host->clients[local->peer] = local;
+    return &local->base;
+}
+
+
+#ifndef _WIN32
+
+// Socket transport: each message goes out as a four byte length and the
+// bytes. Writes that the socket can't take yet wait in an outgoing buffer,
+// a peer that falls too far behind is dropped.
+
+#define MaxBacklog (1 << 20)
+
+typedef struct socketpeer
+{
+    int fd;
+    unsigned char * in, * out;
+    unsigned have, incapacity;  // Bytes read so far
+    unsigned pending, outcapacity;
+    unsigned consumed;          // Bytes of in handed out by the last receive
+    int held;                   // Delivered a message, so the number waits for a drop
+} SocketPeer;
+
+typedef struct sockettransport
+{
+    Transport base;
+    int listener;               // Servers only, -1 on clients
+    char path[108];
+    SocketPeer * peers;
+    unsigned numpeers, next;
+} SocketTransport;
+
+#ifdef MSG_NOSIGNAL
+#define SendFlags MSG_NOSIGNAL
+#else
+#define SendFlags 0
+#endif
+
+static void droppeer(SocketPeer * peer)
+{
+    close(peer->fd);
+    peer->fd = -1;
+    peer->have = peer->pending = peer->consumed = 0;
+}
+
+static int nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void flushpeer(SocketPeer * peer)
+{
+    unsigned done = 0;
+    while (done < peer->pending)
+    {
+        ssize_t n = send(peer->fd, peer->out + done, peer->pending - done, SendFlags);
+        if (n <= 0)
+        {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                droppeer(peer);
+                return;
+            }
+            break;
+        }
+        done += (unsigned)n;
+    }
+    memmove(peer->out, peer->out + done, peer->pending - done);
+    peer->pending -= done;
+}
+
+static int socketsend(Transport * transport, unsigned id, const void * data, unsigned size)
+{
+    SocketTransport * sock = (SocketTransport *)transport;
+    if (id >= sock->numpeers || sock->peers[id].fd < 0)
+    {
+        return 0;
+    }
+    SocketPeer * peer = &sock->peers[id];
+    if (peer->pending + size + 4 > MaxBacklog)
+    {
+        droppeer(peer);
+        return 0;
+    }
+    if (peer->pending + size + 4 > peer->outcapacity)
+    {
+        peer->outcapacity = peer->pending + size + 4;
+        peer->out = realloc(peer->out, peer->outcapacity);
+    }
+    unsigned char * at = peer->out + peer->pending;
+    at[0] = size & 0xff;
+    at[1] = (size >> 8) & 0xff;
+    at[2] = (size >> 16) & 0xff;
+    at[3] = (size >> 24) & 0xff;
+    memcpy(at + 4, data, size);
+    peer->pending += size + 4;
+    flushpeer(peer);
+    return peer->fd >= 0;
+}
+
+// A whole message at the front of the peer's input, if one has arrived.
+static const void * socketmessage(SocketPeer * peer, unsigned * size)
+{
+    if (peer->have < 4)
+    {
+        return NULL;
+    }
+    unsigned length = peer->in[0] | (unsigned)peer->in[1] << 8 | (unsigned)peer->in[2] << 16 | (unsigned)peer->in[3] << 24;
+    if (length > MaxBacklog)
+    {
+        droppeer(peer);
+        return NULL;
+    }
+    if (peer->have < length + 4)
+    {
+        return NULL;
+    }
+    *size = length;
+    peer->consumed = length + 4;
+    return peer->in + 4;
+}
+
+static const void * socketreceive(Transport * transport, unsigned * id, unsigned * size)
+{
+    SocketTransport * sock = (SocketTransport *)transport;
+
+    // Let go of the message handed out last time.
+    for (unsigned i = 0; i < sock->numpeers; i++)
+    {
+        SocketPeer * peer = &sock->peers[i];
+        if (peer->consumed)
+        {
+            memmove(peer->in, peer->in + peer->consumed, peer->have - peer->consumed);
+            peer->have -= peer->consumed;
+            peer->consumed = 0;
+        }
+    }
+
+    for (int fd; sock->listener >= 0 && (fd = accept(sock->listener, NULL, NULL)) >= 0; )
+    {
+        if (!nonblocking(fd))
+        {
+            close(fd);
+            continue;
+        }
+        // Reuse the slot of a peer that is gone and released, keeping its buffers.
+        unsigned i = 0;
+        while (i < sock->numpeers && (sock->peers[i].fd >= 0 || sock->peers[i].held))
+        {
+            i++;
+        }
+        if (i == sock->numpeers)
+        {
+            sock->peers = realloc(sock->peers, ++sock->numpeers * sizeof(*sock->peers));
+            sock->peers[i] = (SocketPeer) {-1, NULL, NULL, 0, 0, 0, 0, 0, 0};
+        }
+        sock->peers[i].fd = fd;
+    }
+
+    // Take turns between peers so a chatty one can't starve the rest.
+    for (unsigned n = 0; n < sock->numpeers; n++)
+    {
+        unsigned i = (sock->next + n) % sock->numpeers;
+        SocketPeer * peer = &sock->peers[i];
+        if (peer->fd < 0)
+        {
+            continue;
+        }
+        if (peer->pending)
+        {
+            flushpeer(peer);
+        }
+        const void * message = socketmessage(peer, size);
+        while (!message && peer->fd >= 0)
+        {
+            if (peer->incapacity - peer->have < 4096)
+            {
+                peer->incapacity = peer->incapacity * 2 + 4096;
+                peer->in = realloc(peer->in, peer->incapacity);
+            }
+            ssize_t got = recv(peer->fd, peer->in + peer->have, peer->incapacity - peer->have, 0);
+            if (got <= 0)
+            {
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    droppeer(peer);
+                }
+                break;
+            }
+            peer->have += (unsigned)got;
+            message = socketmessage(peer, size);
+        }
+        if (message)
+        {
+            peer->held = 1;
+            sock->next = i + 1;
+            *id = i;
+            return message;
+        }
+    }
+    return NULL;
+}
+
+static void socketdrop(Transport * transport, unsigned id)
+{
+    SocketTransport * sock = (SocketTransport *)transport;
+    if (id >= sock->numpeers)
+    {
+        return;
+    }
+    if (sock->peers[id].fd >= 0)
+    {
+        droppeer(&sock->peers[id]);
+    }
+    sock->peers[id].held = 0;
+}
+
+static void socketclose(Transport * transport)
+{
+    SocketTransport * sock = (SocketTransport *)transport;
+    for (unsigned i = 0; i < sock->numpeers; i++)
+    {
+        if (sock->peers[i].fd >= 0)
+        {
+            close(sock->peers[i].fd);
+        }
+        free(sock->peers[i].in);
+        free(sock->peers[i].out);
+    }
+    if (sock->listener >= 0)
+    {
+        close(sock->listener);
+        unlink(sock->path);
+    }
+    free(sock->peers);
+    free(sock);
+}
+
+static SocketTransport * newsocket(const char * path, struct sockaddr_un * address)
+{
+    if (strlen(path) >= sizeof address->sun_path)
+    {
+        printf("%s: socket path too long\n", path);
+        return NULL;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+
+    SocketTransport * sock = calloc(1, sizeof(*sock));
+    sock->base = (Transport) {socketsend, socketreceive, socketdrop, socketclose, 0, 1, 0, 0};
+    sock->listener = -1;
+    snprintf(sock->path, sizeof sock->path, "%s", path);
+    return sock;
+}
+
+Transport * socketserver(const char * path)
+{
+    struct sockaddr_un address;
+    SocketTransport * sock = newsocket(path, &address);
+    if (!sock)
+    {
+        return NULL;
+    }
+    unlink(path);
+    sock->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock->listener < 0
+        || bind(sock->listener, (struct sockaddr *)&address, sizeof address) != 0
+        || listen(sock->listener, SOMAXCONN) != 0
+        || !nonblocking(sock->listener))
+    {
+        perror(path);
+        if (sock->listener >= 0)
+        {
+            close(sock->listener);
+        }
+        free(sock);
+        return NULL;
+    }
+    return &sock->base;
+}
+
+Transport * socketconnect(const char * path)
+{
+    struct sockaddr_un address;
+    SocketTransport * sock = newsocket(path, &address);
+    if (!sock)
+    {
+        return NULL;
+    }
+    // Connect blocking, so a busy listen queue waits instead of failing.
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof address) != 0 || !nonblocking(fd))
+    {
+        perror(path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(sock);
+        return NULL;
+    }
+    sock->peers = malloc(sizeof(*sock->peers));
+    sock->peers[0] = (SocketPeer) {fd, NULL, NULL, 0, 0, 0, 0, 0};
+    sock->numpeers = 1;
+    return &sock->base;
+}
+
+#else
+
+Transport * socketserver(const char * path)
+{
+    printf("%s: no UNIX domain sockets on this platform\n", path);
+    return NULL;
+}
+
+Transport * socketconnect(const char * path)
+{
+    return socketserver(path);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TRANSPORT
+#define TRANSPORT
+
+
+// A message pipe between one server and its clients. Messages arrive whole
+// or not at all, in order per peer. On a server, peers are the clients
+// numbered as they first show up; on a client the only peer is the server, 0.
+// A number that has delivered a message stays with its peer until the owner
+// drops it, so a newcomer never takes over a client the owner still knows.
+typedef struct transport Transport;
+
+struct transport
+{
+    int (*send)(Transport * transport, unsigned peer, const void * data, unsigned size);
+    const void * (*receive)(Transport * transport, unsigned * peer, unsigned * size);
+    void (*drop)(Transport * transport, unsigned peer);
+    void (*close)(Transport * transport);
+    unsigned loss;                      // Percent of outgoing messages dropped, for testing
+    unsigned seed;
+    unsigned long long sent, received;  // Bytes that went through
+};
+
+/**
+ * transportsend: Queue a message for a peer. Returns 0 when the peer is gone
+ * or the message was dropped.
+ */
+int transportsend(Transport * transport, unsigned peer, const void * data, unsigned size);
+
+/**
+ * transportreceive: The next waiting message from any peer, or NULL when
+ * there is none. Never blocks. The message stays valid until the next call.
+ */
+const void * transportreceive(Transport * transport, unsigned * peer, unsigned * size);
+
+/**
+ * transportdrop: Disconnect a peer and give its number back for reuse. Its
+ * unread messages are thrown away.
+ */
+void transportdrop(Transport * transport, unsigned peer);
+
+void closetransport(Transport * transport);
+
+// In-process stand-in: queues in memory, for tests and benchmarks in one thread.
+Transport * localserver(void);
+Transport * localconnect(Transport * server);
+
+// UNIX domain stream sockets on a filesystem path.
+Transport * socketserver(const char * path);
+Transport * socketconnect(const char * path);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "viewport.h"
+#include "constants.h"
+#include "mathlib.h"
+#include "player.h"
+
+
+#define ViewBorder 16
+#define ViewPadding 8
+
+Viewport * create_views(enum view_perspective * perspectives, int num_perspectives)
+{
+    Viewport * views = malloc(sizeof(*views) * num_perspectives);
+
+    // Grid used for anything but one or three views.
+    int columns = (int)ceilf(sqrtf((float)num_perspectives));
+    int rows = (num_perspectives + columns - 1) / max(columns, 1);
+    int cell_width = (ScreenWidth - ViewBorder * 2 - ViewPadding * (columns - 1)) / max(columns, 1);
+    int cell_height = (ScreenHeight - ViewBorder * 2 - ViewPadding * (rows - 1)) / max(rows, 1);
+
+    // Three views: one wide view on top, two half width views below it.
+    int wide_width = ScreenWidth - ViewBorder * 2;
+    int slim_width = (ScreenWidth - ViewBorder * 2 - ViewPadding) / 2;
+    int short_height = (ScreenHeight - ViewBorder * 2 - ViewPadding) / 2;
+
+    for (int i = 0; i < num_perspectives; i++)
+    {
+        Viewport view = {perspectives[i], 0, 0, 0, 0};
+        if (num_perspectives == 1)
+        {
+            view.width = ScreenWidth;
+            view.height = ScreenHeight;
+        }
+        else if (num_perspectives == 3)
+        {
+            view.height = short_height;
+            view.width = i == 0 ? wide_width : slim_width;
+            view.screen_x = i == 2 ? ViewBorder + slim_width + ViewPadding : ViewBorder;
+            view.screen_y = i == 0 ? ViewBorder : ViewBorder + short_height + ViewPadding;
+        }
+        else
+        {
+            view.width = cell_width;
+            view.height = cell_height;
+            view.screen_x = ViewBorder + (i % columns) * (cell_width + ViewPadding);
+            view.screen_y = ViewBorder + (i / columns) * (cell_height + ViewPadding);
+        }
+        views[i] = view;
+    }
+    return views;
+}
+
+Camera playercamera(void)
+{
+    return (Camera) {player.where, player.angle, player.anglesin, player.anglecos, player.yaw, player.sector, 1};
+}
+
+Camera viewcamera(const Viewport * view)
+{
+    if (view->per == FirstPerson)
+    {
+        return playercamera();
+    }
+
+    // Fit the map's extent along the two axes this view shows, with a small margin.
+    float across = view->per == Side ? MapMax.y - MapMin.y : MapMax.x - MapMin.x;
+    float down = view->per == Top ? MapMax.y - MapMin.y : MapMax.z - MapMin.z;
+    float zoom = 0.9f * min(view->width / max(across, 1.f), view->height / max(down, 1.f));
+
+    Camera cam = playercamera();
+    cam.where = (XYZ) {(MapMin.x + MapMax.x) / 2, (MapMin.y + MapMax.y) / 2, (MapMin.z + MapMax.z) / 2};
+    cam.zoom = zoom;
+    return cam;
+}
@@ -0,0 +1,39 @@
+#ifndef VIEWPORT
+#define VIEWPORT
+
+#include "geometry.h"
+
+
+enum view_perspective {Top, Front, Side, FirstPerson};
+
+// A rectangle of the screen and the perspective rendered into it.
+typedef struct viewport
+{
+    enum view_perspective per;
+    int height, width, screen_x, screen_y;
+} Viewport;
+
+// Where a view looks from. The orthographic views only use where (as the
+// centre of the view) and zoom (pixels per world unit).
+typedef struct camera
+{
+    XYZ where;
+    float angle, anglesin, anglecos, yaw;
+    unsigned sector;
+    float zoom;
+} Camera;
+
+/**
+ * create_views: Lay out one viewport per perspective on the screen.
+ * One view fills the screen, three put the first one across the top and the
+ * rest below it, any other count is arranged as a grid.
+ */
+Viewport * create_views(enum view_perspective * perspectives, int num_perspectives);
+
+// The camera of the player's eyes.
+Camera playercamera(void);
+
+// A camera for the view: the player for FirstPerson, the whole map fitted into the view otherwise.
+Camera viewcamera(const Viewport * view);
+
+#endif
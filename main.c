@@ -9,6 +9,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "include/constants.h"
@@ -18,58 +20,293 @@
 #include "include/player.h"
 #include "include/playermovement.h"
 #include "include/renderer.h"
+#include "include/viewport.h"
+#include "include/jobs.h"
+#include "include/animation.h"
+#include "include/automap.h"
+#include "include/inputlog.h"
+#include "include/netgame.h"
+#include "include/material.h"
+#include "include/audio.h"
+#include "include/savestate.h"
+#include "include/telemetry.h"
 
+#define ServerTickMs 16
+#define ServerReportTicks 600 // Print the server's stats this often
+#define StepTicks 20          // Ticks between footsteps while walking
+#define QuickSaveName "quicksave.u3ds"
 
-static void UnloadData()
-{
-    // Clear the geometry
-    for (unsigned i = 0; i < NumSectors; i++)
-    {
-        free(sectors[i].vertex);
-    }
-    for (unsigned i=0; i < NumSectors; i++) {
-        free(sectors[i].neighbors);
-    }
-    free(sectors);
-    sectors = NULL;
-    
-    // Clear the texture memory
-    NumSectors = 0;
-    for (unsigned i = 0; i < nimages; i++)
-    {
-       SDL_FreeSurface(images[i]);
-    }
-//    free(images);
-}
 
-void mainloop()
+// With recording set every tick's input is appended to it; with replay set
+// input comes from the log instead of the keyboard and mouse. With net set
+// input goes to a server and the world comes back from it.
+void mainloop(Viewport * views, int num_views, InputLog * recording, InputLog * replay, NetClient * net)
 {
-    int * wasd;
-    wasd = malloc(sizeof(int) * 4);
-    wasd[0] = 0;
-    wasd[1] = 0;
-    wasd[2] = 0;
-    wasd[3] = 0;
+    InputFrame input = {0, 0, 0, 0};
+    
+    // Every view renders into one framebuffer which is streamed to the window once per frame.
+    Framebuffer fb = {malloc(sizeof(Uint32) * ScreenWidth * ScreenHeight), ScreenWidth, ScreenHeight, ScreenWidth};
+    SDL_Texture * screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ScreenWidth, ScreenHeight);
+    Camera cams[num_views];
+    clearframe(&fb, (SDL_Color){0, 0, 0, 255});
+    unsigned stepticks = 0;
+    // Saving and rewinding only play alone: a log or a server would no longer match.
+    Rewind * history = net || recording || replay ? NULL : startrewind(RewindTicks);
+    SaveState quicksave = {NULL, 0, 0};
+    unsigned tick = 0;
     
     SDL_bool done = SDL_FALSE;
     while (!done)
     {
         SDL_Event event;
+        Uint64 framestart = telemetrystart(TimeFrame);
+        
+        // Tab swaps the game view for the automap.
+        views[0].per = showautomap ? Top : FirstPerson;
+        for (int i = 0; i < num_views; i++)
+        {
+            cams[i] = viewcamera(&views[i]);
+        }
+        if (showautomap)
+        {
+            cams[0] = automapcamera();
+        }
+        drawviews(&fb, views, cams, num_views);
+        SDL_UpdateTexture(screen, NULL, fb.pixels, fb.pitch * sizeof(*fb.pixels));
+        SDL_RenderCopy(renderer, screen, NULL, NULL);
+        SDL_RenderPresent(renderer);
         
-        drawscreen();
-        collisiondetection();
-        handleinput(&event, &done, wasd);
-        handlemovement(wasd);
+        if (!net)
+        {
+            animatesectors();
+            audiosectors(DirtySectors, NumDirty);
+            collisiondetection();
+        }
+        if (replay)
+        {
+            // Still poll, so the window can be closed during playback.
+            InputFrame live = input;
+            handleinput(&event, &done, &live);
+            if (!replayinput(replay, &input))
+            {
+                break;
+            }
+        }
+        else
+        {
+            handleinput(&event, &done, &input);
+        }
+        if (input.buttons & InputAutomap)
+        {
+            showautomap = !showautomap;
+        }
+        if (net)
+        {
+            clientinput(net, &input);
+            if (clientupdate(net))
+            {
+                snapshotsectors(clientsnapshot(net));
+                audiosectors(DirtySectors, NumDirty);
+                snapshotplayer(&clientsnapshot(net)->entities[clientslot(net)], &player);
+            }
+        }
+        else
+        {
+            handlemovement(&input);
+        }
+        if (history && gamekeys & KeyRewind)
+        {
+            // Step back a tick for every tick held, throwing this one away.
+            tick -= rewindstate(history, 1, &player, 1);
+            audiosectors(DirtySectors, NumDirty);
+        }
+        else if (history)
+        {
+            recordrewind(history, ++tick, &player, 1);
+            if (gamekeys & KeyQuickSave)
+            {
+                savestate(&quicksave, tick, &player, 1);
+                writesavestate(&quicksave, QuickSaveName);
+            }
+            if (gamekeys & KeyQuickLoad && readsavestate(&quicksave, QuickSaveName))
+            {
+                if (loadstate(&quicksave, &player, 1))
+                {
+                    tick = savedtick(&quicksave);
+                    audiosectors(DirtySectors, NumDirty);
+                }
+                else
+                {
+                    printf("%s is from another map\n", QuickSaveName);
+                }
+            }
+        }
+        setlistener(player.where, player.angle, player.sector);
+        stepticks = player.state.ground && player.state.moving ? stepticks + 1 : 0;
+        if (stepticks % StepTicks == 1)
+        {
+            playsound(SoundStep, player.where, player.sector, 0.5f, 0);
+        }
+        if (recording)
+        {
+            recordinput(recording, &input);
+        }
+        if (replay && !checkreplay(replay))
+        {
+            printf("Replay desynchronized at tick %u\n", inputticks(replay));
+        }
+        telemetrycount(CountFrames, 1);
+        telemetrystop(TimeFrame, framestart);
     }
+    
+    stoprewind(history);
+    freesavestate(&quicksave);
+    SDL_DestroyTexture(screen);
+    free(fb.pixels);
+}
+
+// A dedicated server: no window, just the world at a fixed tick for the
+// clients connecting on a socket, until it is interrupted or terminated.
+int runserver(const char * path)
+{
+    // The events subsystem turns SIGINT and SIGTERM into a quit event.
+    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    LoadData(MapName);
+    Transport * transport = socketserver(path);
+    if (!transport)
+    {
+        UnloadData();
+        SDL_Quit();
+        return 1;
+    }
+    Server * server = startserver(transport);
+    printf("Serving %s on %s\n", MapName, path);
+    fflush(stdout);
+    for (Uint32 next = SDL_GetTicks() + ServerTickMs; !SDL_QuitRequested(); next += ServerTickMs)
+    {
+        servertick(server);
+        const ServerStats * stats = serverstats(server);
+        if (stats->ticks % ServerReportTicks == 0)
+        {
+            printf("tick %u: %u clients, %.3f ms per tick, %.1f snapshot bytes per client per tick\n",
+                   stats->ticks, stats->clients, (stats->simulatems + stats->encodems) / stats->ticks,
+                   stats->snapshots ? (double)stats->bytes / stats->snapshots : 0.0);
+            fflush(stdout);
+        }
+        Uint32 now = SDL_GetTicks();
+        if ((Sint32)(next - now) > 0)
+        {
+            SDL_Delay(next - now);
+        }
+    }
+    printf("Stopped after %u ticks\n", serverstats(server)->ticks);
+    stopserver(server);
+    closetransport(transport);
+    shutdownjobs();
+    UnloadData();
+    SDL_Quit();
+    return 0;
 }
 
 int main(int argc, const char * argv[])
 {
-    LoadData();
+    // --editor shows the top, front and side views next to the game view.
+    // --record file logs every tick's input; --replay file plays such a log back.
+    // --server path runs a headless server on a socket; --connect path plays on one.
+    // --texture-budget MB caps the texture atlas, dropping the finest mip levels to fit.
+    // --telemetry file streams live counters to a file; --telemetry-socket path to readers on a socket.
+    enum view_perspective game[] = {FirstPerson};
+    enum view_perspective editor[] = {FirstPerson, Top, Front, Side};
+    int editing = 0;
+    const char * recordpath = NULL;
+    const char * replaypath = NULL;
+    const char * connectpath = NULL;
+    const char * serverpath = NULL;
+    const char * telemetrypath = NULL;
+    const char * telemetrysocket = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--editor") == 0)
+        {
+            editing = 1;
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordpath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replaypath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+        {
+            serverpath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+        {
+            connectpath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+        {
+            TextureBudget = (size_t)strtoul(argv[++i], NULL, 10) << 20;
+        }
+        else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+        {
+            telemetrypath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--telemetry-socket") == 0 && i + 1 < argc)
+        {
+            telemetrysocket = argv[++i];
+        }
+    }
+    Transport * readers = telemetrysocket ? socketserver(telemetrysocket) : NULL;
+    if (telemetrysocket && !readers)
+    {
+        return 1;
+    }
+    telemetrythread("main");
+    if ((telemetrypath || readers) && !starttelemetry(telemetrypath, readers))
+    {
+        return 1;
+    }
+    if (serverpath)
+    {
+        int status = runserver(serverpath);
+        stoptelemetry();
+        closetransport(readers);
+        return status;
+    }
+    Viewport * views = editing ? create_views(editor, 4) : create_views(game, 1);
+    
+    InputLog * replay = replaypath ? startreplay(replaypath) : NULL;
+    if (replaypath && !replay)
+    {
+        return 1;
+    }
+    const char * mapname = replay ? replaymap(replay) : MapName;
+    LoadData(mapname);
+    InputLog * recording = recordpath ? startrecording(recordpath, mapname) : NULL;
+    // Server and client both play MapName.
+    Transport * transport = connectpath ? socketconnect(connectpath) : NULL;
+    if (connectpath && !transport)
+    {
+        return 1;
+    }
+    NetClient * net = transport ? startclient(transport) : NULL;
+    if (editing)
+    {
+        revealautomap();
+    }
     if (SDL_Init(SDL_INIT_VIDEO) == 0) {
         SDL_Window* window = NULL;
         if (SDL_CreateWindowAndRenderer(ScreenWidth, ScreenHeight, 0, &window, &renderer) == 0) {
-            mainloop();
+            // The game plays on silently without an audio device.
+            startaudio(NULL);
+            mainloop(views, editing ? 4 : 1, recording, replay, net);
         }
         if (renderer) {
             SDL_DestroyRenderer(renderer);
@@ -78,6 +315,15 @@ int main(int argc, const char * argv[])
             SDL_DestroyWindow(window);
         }
     }
+    stopaudio();
+    stoprecording(recording);
+    stopreplay(replay);
+    stopclient(net);
+    closetransport(transport);
+    stoptelemetry();
+    closetransport(readers);
+    shutdownjobs();
+    free(views);
     UnloadData();
     IMG_Quit();
     SDL_Quit();
@@ -0,0 +1,352 @@
+//
+//  goldenimage.c
+//  UNTITLED3Dgame
+//
+//  Headless golden-image regression test for the renderer.
+//  Every camera pose below is rendered through drawscreen into an offscreen
+//  framebuffer and compared against the reference bitmap checked in under
+//  tests/golden/. ctest runs it from the repository root so the maps and
+//  textures resolve; run it by hand with --update to rewrite the references.
+//  A frame that fails is written to GoldenOutputDir in the build directory,
+//  with a .diff.bmp marking the pixels that differ in magenta.
+//  References come from the float projection; the fixed point projection is
+//  checked against the same images. Walls are pinned to their finest mip
+//  level, so the references don't move with the level selection, except in
+//  the poses that ask for mipmapping.
+//  Textures that are not square are also packed into the atlas on their own,
+//  and every mip level is checked against a box filter of the level above.
+//
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "../include/constants.h"
+#include "../include/filehandling.h"
+#include "../include/geometry.h"
+#include "../include/player.h"
+#include "../include/renderer.h"
+#include "../include/viewport.h"
+#include "../include/jobs.h"
+#include "../include/automap.h"
+#include "../include/material.h"
+#include "../include/mathlib.h"
+
+#define GoldenDir "tests/golden"
+#ifndef GoldenOutputDir
+#define GoldenOutputDir "."
+#endif
+
+// A pixel only counts as different when one of its channels is off by more than
+// ChannelTolerance, and a frame only fails once more than MismatchRatio of its
+// pixels differ. That leaves room for rounding changes in faster rasterizers.
+#define ChannelTolerance 8
+#define MismatchRatio 0.002f
+
+typedef struct camerapose
+{
+    const char * name;
+    float x, y, angle, yaw;
+    unsigned sector;
+    int editor; // Render the four view editor layout instead of the game view
+    int mipmap; // Let walls pick their mip level instead of pinning the finest
+} CameraPose;
+
+typedef struct goldenmap
+{
+    const char * mapname;
+    const CameraPose * poses;
+    unsigned nposes;
+} GoldenMap;
+
+static const CameraPose test_poses[] =
+{
+    {.name = "start",   .x = 2,     .y = 6,     .angle = 0.1f,  .yaw = 0.1f, .sector = 0},
+    {.name = "center",  .x = 15,    .y = 10,    .angle = 1.0f,  .yaw = 0,    .sector = 0},
+    {.name = "corner",  .x = 28,    .y = 18,    .angle = 3.5f,  .yaw = 0,    .sector = 0},
+    {.name = "lookup",  .x = 5,     .y = 15,    .angle = -0.8f, .yaw = 0.4f, .sector = 0},
+};
+
+static const CameraPose clear_poses[] =
+{
+    {.name = "start",   .x = 2,     .y = 6,     .angle = 0,     .yaw = 0,     .sector = 0},
+    {.name = "stairs",  .x = 3,     .y = 9,     .angle = 0,     .yaw = 0,     .sector = 0},
+    {.name = "landing", .x = 12,    .y = 9,     .angle = 1.57f, .yaw = 0,     .sector = 14},
+    {.name = "upper",   .x = 23.3f, .y = 9,     .angle = 3.14f, .yaw = 0.3f,  .sector = 5},
+    {.name = "hall",    .x = 6.2f,  .y = 12.1f, .angle = -1.0f, .yaw = 0,     .sector = 22},
+    {.name = "balcony", .x = 10,    .y = 9,     .angle = 2.4f,  .yaw = -0.3f, .sector = 10},
+    {.name = "editor",  .x = 3,     .y = 9,     .angle = 0,     .yaw = 0,     .sector = 0, .editor = 1},
+    {.name = "far",     .x = 6.2f,  .y = 12.1f, .angle = -1.0f, .yaw = 0,     .sector = 22, .mipmap = 1},
+};
+
+// Mip chains whose widths reach 1 before their heights do, or that halve
+// unevenly, as width x height.
+static const unsigned mip_sizes[][2] = {{64, 512}, {3, 40}, {96, 20}};
+
+static const GoldenMap golden_maps[] =
+{
+    {"map-test.txt",  test_poses,  sizeof(test_poses) / sizeof(*test_poses)},
+    {"map-clear.txt", clear_poses, sizeof(clear_poses) / sizeof(*clear_poses)},
+};
+
+static void setpose(const CameraPose * pose)
+{
+    player.where.x = pose->x;
+    player.where.y = pose->y;
+    player.where.z = sectors[pose->sector].floor + EyeHeight;
+    player.velocity = (XYZ) {0, 0, 0};
+    player.angle = pose->angle;
+    player.anglesin = sinf(pose->angle);
+    player.anglecos = cosf(pose->angle);
+    player.yaw = pose->yaw;
+    player.sector = pose->sector;
+}
+
+// Count the pixels that differ by more than the tolerance. Both surfaces are ARGB8888.
+static unsigned comparesurfaces(SDL_Surface * actual, SDL_Surface * expected)
+{
+    unsigned mismatches = 0;
+    for (int y = 0; y < actual->h; y++)
+    {
+        const Uint32 * a = (const Uint32 *)((const Uint8 *)actual->pixels + y * actual->pitch);
+        const Uint32 * e = (const Uint32 *)((const Uint8 *)expected->pixels + y * expected->pitch);
+        for (int x = 0; x < actual->w; x++)
+        {
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                int diff = (int)((a[x] >> shift) & 0xff) - (int)((e[x] >> shift) & 0xff);
+                if (diff > ChannelTolerance || diff < -ChannelTolerance)
+                {
+                    mismatches++;
+                    break;
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Write what was drawn and, against a reference, where it differs: the differing
+// pixels in magenta over a darkened copy of the frame.
+static void writefailure(SDL_Surface * actual, SDL_Surface * expected, const char * mapname, const CameraPose * pose)
+{
+    char path[512];
+    snprintf(path, sizeof path, "%s/%.*s-%s.actual.bmp", GoldenOutputDir, (int)(strlen(mapname) - 4), mapname, pose->name);
+    SDL_SaveBMP(actual, path);
+    printf("     wrote %s\n", path);
+    if (!expected)
+    {
+        return;
+    }
+    SDL_Surface * diff = SDL_CreateRGBSurfaceWithFormat(0, actual->w, actual->h, 32, SDL_PIXELFORMAT_ARGB8888);
+    for (int y = 0; diff && y < actual->h; y++)
+    {
+        const Uint32 * a = (const Uint32 *)((const Uint8 *)actual->pixels + y * actual->pitch);
+        const Uint32 * e = (const Uint32 *)((const Uint8 *)expected->pixels + y * expected->pitch);
+        Uint32 * d = (Uint32 *)((Uint8 *)diff->pixels + y * diff->pitch);
+        for (int x = 0; x < actual->w; x++)
+        {
+            int differs = 0;
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                int delta = (int)((a[x] >> shift) & 0xff) - (int)((e[x] >> shift) & 0xff);
+                differs |= delta > ChannelTolerance || delta < -ChannelTolerance;
+            }
+            d[x] = differs ? 0xffff00ff : 0xff000000 | ((a[x] >> 2) & 0x3f3f3f);
+        }
+    }
+    if (diff)
+    {
+        snprintf(path, sizeof path, "%s/%.*s-%s.diff.bmp", GoldenOutputDir, (int)(strlen(mapname) - 4), mapname, pose->name);
+        SDL_SaveBMP(diff, path);
+        printf("     wrote %s\n", path);
+        SDL_FreeSurface(diff);
+    }
+}
+
+// Render one pose and check it against its reference, or overwrite the reference when updating.
+static int checkpose(SDL_Surface * frame, const char * mapname, const CameraPose * pose, int update)
+{
+    enum view_perspective game[] = {FirstPerson};
+    enum view_perspective editor[] = {FirstPerson, Top, Front, Side};
+    int num_views = pose->editor ? 4 : 1;
+    Viewport * views = create_views(pose->editor ? editor : game, num_views);
+    Framebuffer fb = {frame->pixels, frame->w, frame->h, frame->pitch / (int)sizeof(Uint32)};
+
+    char path[512];
+    snprintf(path, sizeof path, "%s/%.*s-%s.bmp", GoldenDir, (int)(strlen(mapname) - 4), mapname, pose->name);
+
+    setpose(pose);
+    mipmapping = pose->mipmap;
+    if (pose->editor)
+    {
+        revealautomap();
+    }
+    SDL_FillRect(frame, NULL, SDL_MapRGB(frame->format, 255, 0, 255));
+    Camera cams[num_views];
+    for (int i = 0; i < num_views; i++)
+    {
+        cams[i] = viewcamera(&views[i]);
+    }
+    drawviews(&fb, views, cams, num_views);
+    free(views);
+
+    if (update)
+    {
+        if (SDL_SaveBMP(frame, path) != 0)
+        {
+            printf("FAIL %s: could not write reference (%s)\n", path, SDL_GetError());
+            return 1;
+        }
+        printf("UPDATED %s\n", path);
+        return 0;
+    }
+
+    SDL_Surface * loaded = SDL_LoadBMP(path);
+    if (!loaded)
+    {
+        printf("FAIL %s: missing reference, run with --update to create it\n", path);
+        writefailure(frame, NULL, mapname, pose);
+        return 1;
+    }
+    SDL_Surface * expected = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+
+    int failed = 0;
+    if (!expected || expected->w != frame->w || expected->h != frame->h)
+    {
+        printf("FAIL %s: reference is not %dx%d\n", path, frame->w, frame->h);
+        SDL_FreeSurface(expected);
+        expected = NULL;
+        failed = 1;
+    }
+    else
+    {
+        unsigned mismatches = comparesurfaces(frame, expected);
+        failed = mismatches > MismatchRatio * frame->w * frame->h;
+        printf("%s %s (%s): %u pixels differ\n", failed ? "FAIL" : "PASS", path,
+               projection == FixedProjection ? "fixed" : "float", mismatches);
+    }
+    if (failed)
+    {
+        writefailure(frame, expected, mapname, pose);
+    }
+    SDL_FreeSurface(expected);
+    return failed;
+}
+
+// The grey level of texel (x, y) of a test texture. Grey reads the same
+// whichever order the loader puts the channels in.
+static Uint8 testtexel(unsigned x, unsigned y)
+{
+    return (Uint8)(x * 37 + y * 11);
+}
+
+// Pack a texture of the given size into the atlas on its own and check that
+// every level lies inside the atlas and holds the box filter of the level
+// above it, as read back from the atlas, so no level overwrote another.
+static int checkmipchain(unsigned width, unsigned height)
+{
+    char path[512];
+    snprintf(path, sizeof path, "%s/mip-%ux%u.bmp", GoldenOutputDir, width, height);
+    SDL_Surface * image = SDL_CreateRGBSurfaceWithFormat(0, (int)width, (int)height, 32, SDL_PIXELFORMAT_ARGB8888);
+    for (unsigned y = 0; y < height; y++)
+    {
+        Uint32 * row = (Uint32 *)((Uint8 *)image->pixels + y * image->pitch);
+        for (unsigned x = 0; x < width; x++)
+        {
+            row[x] = 0xff000000u | testtexel(x, y) * 0x010101u;
+        }
+    }
+    SDL_SaveBMP(image, path);
+    SDL_FreeSurface(image);
+
+    char line[520];
+    snprintf(line, sizeof line, "%s\n", path);
+    LoadMaterial("texture", line);
+    BuildAtlas();
+    const Material * material = &materials[0];
+    unsigned bad = 0;
+    for (unsigned l = 0; l < material->levels; l++)
+    {
+        const MipLevel * level = &material->level[l];
+        if (level->offset % AtlasWidth + level->width > AtlasWidth || level->offset / AtlasWidth + level->height > AtlasHeight)
+        {
+            printf("FAIL mip chain %ux%u: level %u (%ux%u) runs outside the %ux%u atlas\n",
+                   width, height, l, level->width, level->height, AtlasWidth, AtlasHeight);
+            bad++;
+            continue;
+        }
+        const MipLevel * above = &material->level[l ? l - 1 : 0];
+        for (unsigned y = 0; y < level->height; y++)
+        {
+            for (unsigned x = 0; x < level->width; x++)
+            {
+                unsigned want = testtexel(x, y);
+                if (l > 0)
+                {
+                    unsigned x1 = min(2 * x + 1, above->width - 1), y1 = min(2 * y + 1, above->height - 1);
+                    const SDL_Color * row0 = Atlas + above->offset + (size_t)2 * y * AtlasWidth;
+                    const SDL_Color * row1 = Atlas + above->offset + (size_t)y1 * AtlasWidth;
+                    want = (row0[2 * x].r + row0[x1].r + row1[2 * x].r + row1[x1].r + 2) >> 2;
+                }
+                bad += Atlas[level->offset + (size_t)y * AtlasWidth + x].r != want;
+            }
+        }
+    }
+    printf("%s mip chain %ux%u: %u levels, %u texels wrong\n", bad ? "FAIL" : "PASS", width, height, material->levels, bad);
+    FreeMaterials();
+    remove(path);
+    return bad != 0;
+}
+
+int main(int argc, const char * argv[])
+{
+    int update = argc > 1 && strcmp(argv[1], "--update") == 0;
+
+    // No window is ever opened, but keep SDL away from any real display.
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    {
+        printf("SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    SDL_Surface * frame = SDL_CreateRGBSurfaceWithFormat(0, ScreenWidth, ScreenHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!frame)
+    {
+        printf("Offscreen surface: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    int failures = 0;
+    for (unsigned m = 0; m < sizeof(golden_maps) / sizeof(*golden_maps); m++)
+    {
+        LoadData(golden_maps[m].mapname);
+        for (unsigned p = 0; p < golden_maps[m].nposes; p++)
+        {
+            projection = FloatProjection;
+            failures += checkpose(frame, golden_maps[m].mapname, &golden_maps[m].poses[p], update);
+            if (!update)
+            {
+                projection = FixedProjection;
+                failures += checkpose(frame, golden_maps[m].mapname, &golden_maps[m].poses[p], 0);
+            }
+        }
+        UnloadData();
+    }
+    for (unsigned t = 0; !update && t < sizeof(mip_sizes) / sizeof(*mip_sizes); t++)
+    {
+        failures += checkmipchain(mip_sizes[t][0], mip_sizes[t][1]);
+    }
+
+    shutdownjobs();
+    SDL_FreeSurface(frame);
+    IMG_Quit();
+    SDL_Quit();
+
+    printf("%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}